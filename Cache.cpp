@@ -0,0 +1,392 @@
+// ****************************************************************************
+// File: Cache.cpp
+// Desc: Result cache. A segment's results are saved as an edit list keyed by a
+//       hash of its bytes, its functions and data items before the passes, the
+//       heuristics version and the chosen options.
+//       The same build processed again in the same state gets the edits replayed
+//       in one batch instead of running the passes. A run over an IDB that an
+//       earlier run already changed is a miss, so the later runs still find more.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "ContainersInl.h"
+#include <WaitBoxEx.h>
+#include "Engine/EditList.h"
+
+// Bump when a pass changes the decisions it makes, so old results are not replayed
+#define CACHE_VERSION 2
+
+// Cache folder under the IDA user folder
+#define CACHE_FOLDER "ExtraPass"
+
+// Bytes hashed per read
+#define HASH_CHUNK (64 * 1024)
+
+typedef Container::FlatMap<ea_t, ea_t, BADADDR, MemTagAlloc<MEM_CACHE> > ADDRMAP;
+
+// Hash of a segment's bytes, kept while the plug-in is resident
+struct tSEGHASH
+{
+	ea_t eaStart, eaEnd;
+	UINT64 uHash;
+};
+
+// A data item as it was before the passes
+struct tDATAITEM
+{
+	ea_t ea;
+	UINT uSize;
+	flags_t Flags;
+};
+
+extern size_t IMP_ApplyEdits(tEDITLIST &rList, adiff_t Delta, UINT &ruFailed);
+
+static char s_szFile[QMAXPATH] = { 0 };	// Cache file of the segment being processed, empty if none
+static ea_t s_eaStart = BADADDR, s_eaEnd = BADADDR;
+static ADDRMAP s_Funcs;					// Function chunk start to owner, entry chunks own themselves
+static qvector<tDATAITEM> s_Data;
+static size_t s_uDataMem = 0, s_uSegHashesMem = 0;	// Their buffers as counted to MEM_CACHE
+static UINT s_uHits = 0, s_uMisses = 0, s_uStored = 0;
+static TIMESTAMP s_ReplayTime = 0;
+static qvector<tSEGHASH> s_SegHashes;
+
+
+// 64bit FNV-1a
+static inline UINT64 Hash(UINT64 uHash, const void *pData, size_t uSize)
+{
+	const BYTE *pb = (const BYTE *) pData;
+	for(size_t i = 0; i < uSize; i++)
+		uHash = ((uHash ^ pb[i]) * 0x100000001B3ULL);
+	return(uHash);
+}
+
+// Hash of the segment bytes, the passes don't change them so it's kept for the next runs
+// Returns FALSE if the bytes couldn't be read
+static BOOL BytesHash(ea_t eaStart, ea_t eaEnd, UINT64 &ruHash)
+{
+	for(size_t i = 0; i < s_SegHashes.size(); i++)
+	{
+		if((s_SegHashes[i].eaStart == eaStart) && (s_SegHashes[i].eaEnd == eaEnd))
+		{
+			ruHash = s_SegHashes[i].uHash;
+			return(TRUE);
+		}
+	}
+
+	UINT64 uHash = 0xCBF29CE484222325ULL;
+	if(BYTE *pBuffer = (BYTE *) MemAlloc(MEM_CACHE, HASH_CHUNK))
+	{
+		for(ea_t ea = eaStart; ea < eaEnd; ea += HASH_CHUNK)
+		{
+			UINT uSize = (UINT) min((eaEnd - ea), HASH_CHUNK);
+			if(!get_many_bytes(ea, pBuffer, uSize))
+			{
+				// Has unloaded bytes, do it the slow way
+				for(UINT i = 0; i < uSize; i++)
+				{
+					BOOL bLoaded = isLoaded(ea + i);
+					pBuffer[i] = (bLoaded ? get_byte(ea + i) : 0);
+					uHash = Hash(uHash, &bLoaded, 1);
+				}
+			}
+			uHash = Hash(uHash, pBuffer, uSize);
+		}
+		MemFree(MEM_CACHE, pBuffer, HASH_CHUNK);
+		tSEGHASH SegHash = { eaStart, eaEnd, uHash };
+		s_SegHashes.push_back(SegHash);
+		MemTrackVector(MEM_CACHE, s_SegHashes, s_uSegHashesMem);
+		ruHash = uHash;
+		return(TRUE);
+	}
+	return(FALSE);
+}
+
+// Key of the segment bytes hash, it's position relative to the image base, version, options
+// and the analysis state hash. Returns FALSE, no key, if the bytes couldn't be hashed
+static BOOL SegmentKey(ea_t eaStart, ea_t eaEnd, UINT uOptions, UINT64 uState, UINT64 &ruKey)
+{
+	UINT64 uBytes = 0;
+	if(!BytesHash(eaStart, eaEnd, uBytes))
+		return(FALSE);
+
+	UINT64 uHash = 0xCBF29CE484222325ULL;
+	uHash = Hash(uHash, MY_VERSION, SIZESTR(MY_VERSION));
+	UINT auHeader[4] = { CACHE_VERSION, uOptions, (UINT) (eaStart - get_imagebase()), (UINT) (eaEnd - eaStart) };
+	uHash = Hash(uHash, auHeader, sizeof(auHeader));
+	uHash = Hash(uHash, &uBytes, sizeof(uBytes));
+	ruKey = Hash(uHash, &uState, sizeof(uState));
+	return(TRUE);
+}
+
+// Build the cache file name for the key, creating the folder if needed
+static BOOL MakeFileName(UINT64 uKey, char *pszFile, size_t uSize)
+{
+	char szFolder[QMAXPATH];
+	qmakepath(szFolder, sizeof(szFolder), get_user_idadir(), CACHE_FOLDER, NULL);
+	if(!CreateDirectory(szFolder, NULL) && (GetLastError() != ERROR_ALREADY_EXISTS))
+	{
+		msg("** Can't create the cache folder \"%s\"! **\n", szFolder);
+		return(FALSE);
+	}
+
+	char szName[32] = { 0 };
+	_snprintf(szName, SIZESTR(szName), "%016I64X.epl", uKey);
+	qmakepath(pszFile, uSize, szFolder, szName, NULL);
+	return(TRUE);
+}
+
+// First function chunk at or after "ea"
+static inline func_t *FirstChunk(ea_t ea)
+{
+	if(func_t *pChunk = get_fchunk(ea))
+		return(pChunk);
+	return(get_next_fchunk(ea));
+}
+
+static bool idaapi IsDataItem(flags_t flags, void *ud)
+{
+	return(isData(flags));
+}
+
+// Address of the first data item at or after "ea"
+static inline ea_t NextData(ea_t ea, ea_t eaEnd)
+{
+	if(ea >= eaEnd)
+		return(BADADDR);
+	if(isData(getFlags(ea)))
+		return(ea);
+	return(nextthat(ea, eaEnd, IsDataItem, NULL));
+}
+
+// Record the function chunks and data items of the segment before the passes
+// Returns a hash of them relative to the image base, the analysis state part of the key
+static UINT64 TakeSnapshot()
+{
+	UINT64 uHash = 0xCBF29CE484222325ULL;
+	ea_t eaBase = get_imagebase();
+	for(func_t *pChunk = FirstChunk(s_eaStart); pChunk && (pChunk->startEA < s_eaEnd); pChunk = get_next_fchunk(pChunk->startEA))
+	{
+		if(pChunk->startEA >= s_eaStart)
+		{
+			ea_t eaOwner = ((pChunk->flags & FUNC_TAIL) ? pChunk->owner : pChunk->startEA);
+			s_Funcs.Insert(pChunk->startEA, eaOwner);
+			UINT auChunk[3] = { (UINT) (pChunk->startEA - eaBase), (UINT) (pChunk->endEA - eaBase), (UINT) (eaOwner - eaBase) };
+			uHash = Hash(uHash, auChunk, sizeof(auChunk));
+		}
+	}
+
+	for(ea_t ea = NextData(s_eaStart, s_eaEnd); ea != BADADDR; ea = NextData(get_item_end(ea), s_eaEnd))
+	{
+		tDATAITEM Item = { ea, (UINT) get_item_size(ea), getFlags(ea) };
+		s_Data.push_back(Item);
+
+		// Just the type bits, names and comments don't change what the passes do
+		UINT auItem[3] = { (UINT) (ea - eaBase), Item.uSize, (UINT) (Item.Flags & (MS_CLS | DT_TYPE | MS_0TYPE | MS_1TYPE)) };
+		uHash = Hash(uHash, auItem, sizeof(auItem));
+	}
+	MemTrackVector(MEM_CACHE, s_Data, s_uDataMem);
+	return(uHash);
+}
+
+// Edit for a data item that's new or changed type, the ones the passes make
+static void AddDataEdit(tEDITLIST &rList, ea_t ea, UINT uSize, flags_t Flags)
+{
+	if(isAlign(Flags))
+		EDL_Add(rList, EDIT_ALIGN, ea, uSize);
+	else
+	if(isByte(Flags))
+		EDL_Add(rList, EDIT_BYTES, ea, uSize);
+	else
+	if(isDwrd(Flags) && isOff0(Flags))
+		EDL_Add(rList, EDIT_OFFSETS, ea, uSize);
+}
+
+// Edit for a data item that's gone
+static void AddGoneEdit(tEDITLIST &rList, const tDATAITEM &rItem)
+{
+	EDL_Add(rList, (isCode(getFlags(rItem.ea)) ? EDIT_CODE : EDIT_UNDEFINE), rItem.ea, rItem.uSize);
+}
+
+// Compare the segment against the snapshot and list the differences as edits
+static void BuildEdits(tEDITLIST &rList)
+{
+	// Functions gone, or that became a tail of another
+	for(ADDRMAP::Slot *pSlot = s_Funcs.GetFirst(); pSlot; pSlot = s_Funcs.GetNext(pSlot))
+	{
+		if(pSlot->m_Key == pSlot->m_Value)
+		{
+			func_t *pChunk = get_fchunk(pSlot->m_Key);
+			if(!pChunk || (pChunk->startEA != pSlot->m_Key) || (pChunk->flags & FUNC_TAIL))
+				EDL_Add(rList, EDIT_DELFUNC, pSlot->m_Key, 0);
+		}
+	}
+
+	// New functions and tails
+	for(func_t *pChunk = FirstChunk(s_eaStart); pChunk && (pChunk->startEA < s_eaEnd); pChunk = get_next_fchunk(pChunk->startEA))
+	{
+		if(pChunk->startEA < s_eaStart)
+			continue;
+		ea_t eaOwner = ((pChunk->flags & FUNC_TAIL) ? pChunk->owner : pChunk->startEA);
+		const ea_t *pOwner = s_Funcs.Find(pChunk->startEA);
+		if(pOwner && (*pOwner == eaOwner))
+			continue;
+
+		if(pChunk->flags & FUNC_TAIL)
+			EDL_Add(rList, EDIT_TAIL, pChunk->startEA, pChunk->size(), eaOwner);
+		else
+			EDL_Add(rList, EDIT_FUNC, pChunk->startEA, pChunk->size());
+	}
+
+	// Data items, both lists are in address order
+	size_t uBefore = 0;
+	for(ea_t ea = NextData(s_eaStart, s_eaEnd); ea != BADADDR; ea = NextData(get_item_end(ea), s_eaEnd))
+	{
+		UINT uSize = (UINT) get_item_size(ea);
+		flags_t Flags = getFlags(ea);
+
+		while((uBefore < s_Data.size()) && (s_Data[uBefore].ea < ea))
+			AddGoneEdit(rList, s_Data[uBefore++]);
+
+		if((uBefore < s_Data.size()) && (s_Data[uBefore].ea == ea))
+		{
+			const tDATAITEM &rItem = s_Data[uBefore++];
+			if((rItem.Flags == Flags) && (rItem.uSize == uSize))
+				continue;
+		}
+		AddDataEdit(rList, ea, uSize, Flags);
+	}
+	while(uBefore < s_Data.size())
+		AddGoneEdit(rList, s_Data[uBefore++]);
+}
+
+static void FreeSnapshot()
+{
+	s_Funcs.Clear();
+	s_Data.clear();
+	MemTrackVector(MEM_CACHE, s_Data, s_uDataMem);
+	s_szFile[0] = 0;
+}
+
+
+// ****************************************************************************
+// Func: CCH_Begin()
+// Desc: Look up the segment in the cache. On a hit the cached edits are replayed
+//       and TRUE is returned, the passes can be skipped.
+//       On a miss, or a replay canceled part way, the segment state is recorded
+//       for CCH_Store().
+// ****************************************************************************
+BOOL CCH_Begin(ea_t eaStart, ea_t eaEnd, UINT uOptions)
+{
+	BOOL bResult = FALSE;
+	tEDITLIST List;
+	EDL_Init(List);
+	FreeSnapshot();
+
+	try
+	{
+		// The snapshot is both the state part of the key and, on a miss, what CCH_Store() compares to
+		TIMESTAMP StartTime = GetTimeStamp();
+		s_eaStart = eaStart;
+		s_eaEnd   = eaEnd;
+		UINT64 uKey = 0;
+		if(!SegmentKey(eaStart, eaEnd, uOptions, TakeSnapshot(), uKey))
+		{
+			msg("** Can't hash the segment bytes, cache skipped! **\n");
+			FreeSnapshot();
+		}
+		else
+		if(MakeFileName(uKey, s_szFile, sizeof(s_szFile)))
+		{
+			if(qfileexist(s_szFile) && EDL_Load(s_szFile, List))
+			{
+				msg("===== Cache hit =====\n");
+				adiff_t Delta = (adiff_t) (get_imagebase() - (ea_t) List.uImageBase);
+				UINT uFailed = 0;
+				size_t uDone = IMP_ApplyEdits(List, Delta, uFailed);
+				s_ReplayTime += (GetTimeStamp() - StartTime);
+				msg("Replayed: %u edits, skipped: %u, time: %.2f seconds.\n\n", (UINT) uDone, uFailed, (GetTimeStamp() - StartTime));
+				if(uDone < List.uCount)
+				{
+					// Canceled part way, the passes finish the job and the result is saved again
+					msg("Partial replay, %u of %u edits, running the steps.\n\n", (UINT) uDone, (UINT) List.uCount);
+					s_uMisses++;
+				}
+				else
+				{
+					FreeSnapshot();
+					s_uHits++;
+					bResult = TRUE;
+				}
+			}
+			else
+				s_uMisses++;
+		}
+		else
+			FreeSnapshot();
+	}
+	CATCH()
+
+	EDL_Free(List);
+	return(bResult);
+}
+
+// ****************************************************************************
+// Func: CCH_Store()
+// Desc: Save the edits of the segment processed since the CCH_Begin() miss.
+// ****************************************************************************
+void CCH_Store()
+{
+	tEDITLIST List;
+	EDL_Init(List);
+
+	try
+	{
+		if(s_szFile[0])
+		{
+			List.uImageBase = get_imagebase();
+			BuildEdits(List);
+			if(EDL_Save(s_szFile, List))
+				s_uStored++;
+			else
+				msg("** Failed to save cache file \"%s\"! **\n", s_szFile);
+		}
+	}
+	CATCH()
+
+	EDL_Free(List);
+	FreeSnapshot();
+}
+
+// Drop a pending snapshot, i.e. when the run is canceled
+void CCH_Abandon()
+{
+	FreeSnapshot();
+}
+
+// Drop the kept hash of the segment containing "ea", or all of them for BADADDR
+void CCH_Invalidate(ea_t ea)
+{
+	for(size_t i = s_SegHashes.size(); i > 0; i--)
+	{
+		if((ea == BADADDR) || ((ea >= s_SegHashes[i - 1].eaStart) && (ea < s_SegHashes[i - 1].eaEnd)))
+			s_SegHashes.erase(s_SegHashes.begin() + (i - 1));
+	}
+	if(s_SegHashes.empty())
+	{
+		s_SegHashes.clear();
+		MemTrackVector(MEM_CACHE, s_SegHashes, s_uSegHashesMem);
+	}
+}
+
+void CCH_ResetStats()
+{
+	s_uHits = s_uMisses = s_uStored = 0;
+	s_ReplayTime = 0;
+}
+
+void CCH_GetStats(UINT &ruHits, UINT &ruMisses, TIMESTAMP &rReplayTime)
+{
+	ruHits = s_uHits;
+	ruMisses = s_uMisses;
+	rReplayTime = s_ReplayTime;
+}
@@ -0,0 +1,280 @@
+// ****************************************************************************
+// File: Chunks.cpp
+// Desc: Function chunk map. Every function chunk in the run's ranges by start
+//       address, with its end and owner function, so the passes can ask who
+//       owns an address without going into the kernel's function tree.
+//
+//       Built once at the start of a run, then kept in step with the kernel
+//       through the function change notifications. Chunk bound changes are
+//       only announced before they happen, so those chunks are read back from
+//       the kernel on the next lookup. Addresses outside of the run's ranges
+//       are passed on to the kernel.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "ContainersInl.h"
+
+typedef Container::TreeEng<ea_t, ea_t, size_t> CHUNKENG;
+
+// A chunk, keyed by its start address
+struct tCHUNKNODE : public CHUNKENG::Node, public Container::InhPoolAlloc<tCHUNKNODE, 1024, MemTagAlloc<MEM_CHUNKS> >
+{
+	ea_t endEA;
+	ea_t eaOwner;	// Entry chunks own themselves
+};
+
+static Container::TreeEx<CHUNKENG, tCHUNKNODE> s_Chunks;
+static qvector<area_t> s_Ranges;	// Ranges covered
+static qvector<ea_t> s_Resync;		// Chunk starts to read back from the kernel, old and new
+static BOOL s_bActive = FALSE;
+
+void CHK_End();
+
+// Returns TRUE if the range touches one of the covered ones, there are only a few
+static BOOL Covered(ea_t eaStart, ea_t eaEnd)
+{
+	for(size_t i = 0; i < s_Ranges.size(); i++)
+	{
+		if((eaStart < s_Ranges[i].endEA) && (eaEnd > s_Ranges[i].startEA))
+			return(TRUE);
+	}
+	return(FALSE);
+}
+
+// Add or update a chunk
+static void SetChunk(ea_t eaStart, ea_t eaEnd, ea_t eaOwner)
+{
+	if(!Covered(eaStart, eaEnd))
+		return;
+	tCHUNKNODE *pNode = s_Chunks.Find(eaStart);
+	if(!pNode)
+	{
+		if(MemOverBudget(sizeof(tCHUNKNODE)))
+		{
+			msg("Over the memory budget, function chunk owners looked up from here on.\n");
+			CHK_End();
+			return;
+		}
+		if(!(pNode = new tCHUNKNODE()))
+		{
+			// Can't keep up, let the kernel answer from here on
+			msg("** Out of memory for the function chunk map! **\n");
+			CHK_End();
+			return;
+		}
+		s_Chunks.Insert(*pNode, eaStart);
+	}
+	pNode->endEA   = eaEnd;
+	pNode->eaOwner = eaOwner;
+}
+
+static void RemoveChunk(ea_t eaStart)
+{
+	if(tCHUNKNODE *pNode = s_Chunks.Find(eaStart))
+	{
+		s_Chunks.Remove(*pNode);
+		delete pNode;
+	}
+}
+
+// Read the changed chunks back from the kernel, after it made (or refused) the changes
+static void Resync()
+{
+	for(size_t i = 0; s_bActive && (i < s_Resync.size()); i++)
+	{
+		ea_t ea = s_Resync[i];
+		RemoveChunk(ea);
+		func_t *pChunk = get_fchunk(ea);
+		if(!pChunk || (pChunk->startEA != ea))
+			continue;
+		if(pChunk->flags & FUNC_TAIL)
+			SetChunk(pChunk->startEA, pChunk->endEA, pChunk->owner);
+		else
+		{
+			// An entry chunk that moved takes its tails along
+			SetChunk(pChunk->startEA, pChunk->endEA, pChunk->startEA);
+			for(int j = 0; s_bActive && (j < pChunk->tailqty); j++)
+				SetChunk(pChunk->tails[j].startEA, pChunk->tails[j].endEA, pChunk->startEA);
+		}
+	}
+	s_Resync.clear();
+}
+
+// Processor notifications, functions added and deleted, chunk bounds changed
+static int idaapi IdpCallback(void *pUserData, int iNotificationCode, va_list va)
+{
+	switch(iNotificationCode)
+	{
+		case processor_t::add_func:
+		{
+			func_t *pFunc = va_arg(va, func_t *);
+			SetChunk(pFunc->startEA, pFunc->endEA, pFunc->startEA);
+		}
+		break;
+
+		case processor_t::del_func:
+		{
+			func_t *pFunc = va_arg(va, func_t *);
+			for(int i = 0; i < pFunc->tailqty; i++)
+				RemoveChunk(pFunc->tails[i].startEA);
+			RemoveChunk(pFunc->startEA);
+		}
+		break;
+
+		// About to change, IDA goes ahead unless the processor module objects
+		// Read back on the next lookup, by then it's done or not
+		case processor_t::set_func_start:
+		{
+			func_t *pChunk = va_arg(va, func_t *);
+			ea_t eaNewStart = va_arg(va, ea_t);
+			if(s_Chunks.Find(pChunk->startEA))
+			{
+				s_Resync.push_back(pChunk->startEA);
+				s_Resync.push_back(eaNewStart);
+			}
+		}
+		break;
+
+		case processor_t::set_func_end:
+		{
+			func_t *pChunk = va_arg(va, func_t *);
+			if(s_Chunks.Find(pChunk->startEA))
+				s_Resync.push_back(pChunk->startEA);
+		}
+		break;
+	};
+
+	return(0);
+}
+
+// Database notifications, tails appended, removed and moved to another owner
+static int idaapi IdbCallback(void *pUserData, int iNotificationCode, va_list va)
+{
+	switch(iNotificationCode)
+	{
+		case idb_event::func_tail_appended:
+		{
+			func_t *pFunc = va_arg(va, func_t *);
+			func_t *pTail = va_arg(va, func_t *);
+			SetChunk(pTail->startEA, pTail->endEA, pFunc->startEA);
+		}
+		break;
+
+		case idb_event::func_tail_removed:
+		{
+			va_arg(va, func_t *);
+			RemoveChunk(va_arg(va, ea_t));
+		}
+		break;
+
+		case idb_event::tail_owner_changed:
+		{
+			func_t *pTail = va_arg(va, func_t *);
+			ea_t eaOwner = va_arg(va, ea_t);
+			if(tCHUNKNODE *pNode = s_Chunks.Find(pTail->startEA))
+				pNode->eaOwner = eaOwner;
+		}
+		break;
+	};
+
+	return(0);
+}
+
+
+// ****************************************************************************
+// Func: CHK_Build()
+// Desc: Map the function chunks of the ranges and start following the changes.
+// ****************************************************************************
+void CHK_Build(const qvector<area_t> &rRanges)
+{
+	try
+	{
+		CHK_End();
+		s_Ranges = rRanges;
+		s_bActive = TRUE;
+		for(size_t i = 0; i < s_Ranges.size(); i++)
+		{
+			// Including one that starts before the range and runs into it
+			func_t *pChunk = get_fchunk(s_Ranges[i].startEA);
+			if(!pChunk)
+				pChunk = get_next_fchunk(s_Ranges[i].startEA);
+			for(; pChunk && (pChunk->startEA < s_Ranges[i].endEA); pChunk = get_next_fchunk(pChunk->startEA))
+			{
+				SetChunk(pChunk->startEA, pChunk->endEA, ((pChunk->flags & FUNC_TAIL) ? pChunk->owner : pChunk->startEA));
+				if(!s_bActive)
+					return;
+			}
+		}
+		hook_to_notification_point(HT_IDP, IdpCallback, NULL);
+		hook_to_notification_point(HT_IDB, IdbCallback, NULL);
+	}
+	CATCH()
+}
+
+// Done with the map
+void CHK_End()
+{
+	if(s_bActive)
+	{
+		unhook_from_notification_point(HT_IDP, IdpCallback, NULL);
+		unhook_from_notification_point(HT_IDB, IdbCallback, NULL);
+		s_bActive = FALSE;
+	}
+	s_Chunks.Reset();
+	tCHUNKNODE::GetPool().Clear();
+	s_Ranges.clear();
+	s_Resync.clear();
+}
+
+// ****************************************************************************
+// Func: CHK_Owner()
+// Desc: Returns the start of the function owning "ea", or BADADDR if it's not in
+//       one. Optionally the end of the chunk it's in.
+// ****************************************************************************
+ea_t CHK_Owner(ea_t ea, ea_t *peaChunkEnd)
+{
+	if(!s_Resync.empty())
+		Resync();
+	if(!s_bActive || !Covered(ea, (ea + 1)))
+	{
+		if(func_t *pChunk = get_fchunk(ea))
+		{
+			if(peaChunkEnd)
+				*peaChunkEnd = pChunk->endEA;
+			return((pChunk->flags & FUNC_TAIL) ? pChunk->owner : pChunk->startEA);
+		}
+		return(BADADDR);
+	}
+
+	// Last chunk starting at or before it
+	tCHUNKNODE *pNode = s_Chunks.FindExactSmaller(ea);
+	if(pNode && (ea < pNode->endEA))
+	{
+		if(peaChunkEnd)
+			*peaChunkEnd = pNode->endEA;
+		return(pNode->eaOwner);
+	}
+	return(BADADDR);
+}
+
+// Start of the first chunk after "ea", or BADADDR if there's none
+ea_t CHK_NextChunk(ea_t ea)
+{
+	if(!s_Resync.empty())
+		Resync();
+
+	// From the map while it's in the same range, past it the kernel knows
+	for(size_t i = 0; s_bActive && (i < s_Ranges.size()); i++)
+	{
+		if((ea >= s_Ranges[i].startEA) && (ea < s_Ranges[i].endEA))
+		{
+			tCHUNKNODE *pNode = s_Chunks.FindBigger(ea);
+			if(pNode && (pNode->m_Key < s_Ranges[i].endEA))
+				return(pNode->m_Key);
+			break;
+		}
+	}
+
+	func_t *pChunk = get_next_fchunk(ea);
+	return(pChunk ? pChunk->startEA : BADADDR);
+}
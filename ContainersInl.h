@@ -514,6 +514,135 @@ namespace Container
 		__declspec(property(get=GetPrev)) const CastNode *_Prev;
 	};
 
+	//////////////////////////////////////////////////////////////////////
+	// Allocation policy
+	// Where the pools and the flat containers get their memory. A policy has static Alloc(),
+	// Realloc() and Free(), they're given the sizes so one can keep count.
+	// The default goes straight to IDA's heap.
+	struct QAlloc
+	{
+		static void *Alloc(size_t nSize) { return qalloc(nSize); }
+		static void *Realloc(void *p, size_t nOldSize, size_t nNewSize) { return qrealloc(p, nNewSize); }
+		static void Free(void *p, size_t nSize) { qfree(p); }
+	};
+
+	//////////////////////////////////////////////////////////////////////
+	// Node pool
+	// Fixed size items carved out of large blocks. Freed items go on a free list for reuse,
+	// Reset() drops them all at once keeping one block for the next round.
+	// Reset() doesn't run destructors, for plain data nodes only.
+	template <class T, size_t nBlockItems = 1024, class Allocator = QAlloc>
+	class Pool
+	{
+		union Item
+		{
+			Item *m_pNext;
+			UINT64 m_Align;
+			BYTE m_Data[sizeof(T)];
+		};
+		struct Block
+		{
+			Block *m_pNext;
+			Item m_Items[nBlockItems];
+		};
+
+		Block *m_pBlocks;	// Newest first
+		Item *m_pFree;
+		size_t m_nUsed;		// Items taken from the newest block
+		size_t m_nLive;
+
+		// disable copy constructor and assignment
+		Pool(const Pool&);
+		void operator = (const Pool&);
+
+	public:
+		Pool() : m_pBlocks(NULL), m_pFree(NULL), m_nUsed(nBlockItems), m_nLive(0) {}
+		~Pool() { Clear(); }
+
+		void *Alloc()
+		{
+			Item *pItem = m_pFree;
+			if (pItem)
+				m_pFree = pItem->m_pNext;
+			else
+			{
+				if (m_nUsed >= nBlockItems)
+				{
+					Block *pBlock = (Block *) Allocator::Alloc(sizeof(Block));
+					if (!pBlock)
+						return NULL;
+					pBlock->m_pNext = m_pBlocks;
+					m_pBlocks = pBlock;
+					m_nUsed = 0;
+				}
+				pItem = &m_pBlocks->m_Items[m_nUsed++];
+			}
+			m_nLive++;
+			return pItem;
+		}
+
+		void Free(void *p)
+		{
+			if (p)
+			{
+				_ASSERT(m_nLive > 0);
+				Item *pItem = (Item *) p;
+				pItem->m_pNext = m_pFree;
+				m_pFree = pItem;
+				m_nLive--;
+			}
+		}
+
+		// Drop all items, keeps the newest block
+		void Reset()
+		{
+			if (Block *pBlock = m_pBlocks)
+			{
+				while (Block *pOld = pBlock->m_pNext)
+				{
+					pBlock->m_pNext = pOld->m_pNext;
+					Allocator::Free(pOld, sizeof(Block));
+				}
+				m_nUsed = 0;
+			}
+			m_pFree = NULL;
+			m_nLive = 0;
+		}
+
+		// Drop all items and free the blocks
+		void Clear()
+		{
+			while (Block *pBlock = m_pBlocks)
+			{
+				m_pBlocks = pBlock->m_pNext;
+				Allocator::Free(pBlock, sizeof(Block));
+			}
+			m_pFree = NULL;
+			m_nUsed = nBlockItems;
+			m_nLive = 0;
+		}
+
+		size_t GetCount() const { return m_nLive; }
+		__declspec(property(get=GetCount)) size_t _Count;
+	};
+
+	// Node allocation policy, the node type's new/delete go to one pool for the type.
+	// Inherit it along with NodeEx, then the container's nodes can all be let go with GetPool().Reset()
+	// after a Reset() of the container.
+	template <class CastNode, size_t nBlockItems = 1024, class Allocator = QAlloc>
+	struct InhPoolAlloc
+	{
+		typedef Pool<CastNode, nBlockItems, Allocator> NodePool;
+		static NodePool &GetPool()
+		{
+			static NodePool s_Pool;
+			return s_Pool;
+		}
+
+		static void *operator new(size_t size) { _ASSERT(size == sizeof(CastNode)); return GetPool().Alloc(); }
+		static void operator delete(void *p) { GetPool().Free(p); }
+	};
+
 	//////////////////////////////////////////////////////////////////////
 	// Hash Table
 
@@ -717,6 +846,271 @@ namespace Container
 	typedef HashEng<ULONG, ULONG, void> HashOrd;	// integer key.
 	typedef HashEng<ULONG, ULONG, size_t> HashOrdC;	// same, counted.
 
+	//////////////////////////////////////////////////////////////////////
+	// Flat hash
+	// Open addressing with linear probing. The keys, and values for the map, are kept in one
+	// power of two sized table that grows when 3/4 full. No nodes, so no allocation per item
+	// and a lookup is usually one cache line. For integer keys, like ea_t, one key value is
+	// reserved to mark the empty slots (i.e. BADADDR for addresses).
+	// The values are copied around when the table grows, keep them plain data.
+	namespace Impl
+	{
+		// Fibonacci hashing, the high bits of the product are the table index
+		template <size_t nKeySize> struct FlatMixer;
+		template <> struct FlatMixer<4>
+		{
+			enum { BITS = 32 };
+			static size_t Index(UINT32 nKey, UINT nShift) { return (size_t) ((UINT32) (nKey * 0x9E3779B9U) >> nShift); }
+		};
+		template <> struct FlatMixer<8>
+		{
+			enum { BITS = 64 };
+			static size_t Index(UINT64 nKey, UINT nShift) { return (size_t) ((nKey * 0x9E3779B97F4A7C15ULL) >> nShift); }
+		};
+
+		// Set slot, just the key.
+		template <class KEY> struct FlatSlotKey
+		{
+			KEY m_Key;
+		};
+		// Map slot, the key and it's value.
+		template <class KEY, class VALUE> struct FlatSlotPair
+		{
+			KEY m_Key;
+			VALUE m_Value;
+		};
+
+		// Base flat hash engine
+		template <class KEY, class Slot, KEY EMPTY, class Allocator>
+		class FlatHashEng
+		{
+			typedef FlatMixer<sizeof(KEY)> Mixer;
+			enum { MIN_CAPACITY = 16 };
+
+			// disable copy constructor and assignment
+			FlatHashEng(const FlatHashEng&);
+			void operator = (const FlatHashEng&);
+
+		protected:
+			Slot *m_pSlots;
+			size_t m_nMask;		// Capacity - 1
+			size_t m_nCount;
+			UINT m_nShift;		// Key bits less the capacity bits
+
+			FlatHashEng() : m_pSlots(NULL), m_nMask(0), m_nCount(0), m_nShift(0) {}
+			~FlatHashEng() { Clear(); }
+
+			size_t zIndex(KEY Key) const
+			{
+				return Mixer::Index(Key, m_nShift);
+			}
+
+			Slot *zFind(KEY Key) const
+			{
+				_ASSERT(Key != EMPTY);
+				if (!m_pSlots)
+					return NULL;
+				for (size_t nIndex = zIndex(Key); ; nIndex = ((nIndex + 1) & m_nMask))
+				{
+					Slot *pSlot = &m_pSlots[nIndex];
+					if (pSlot->m_Key == Key)
+						return pSlot;
+					if (pSlot->m_Key == EMPTY)
+						return NULL;
+				}
+				// unreachable
+			}
+
+			// Slot of the key, a new one if it's not in the table yet. NULL if out of memory.
+			Slot *zInsert(KEY Key, BOOL &rbNew)
+			{
+				_ASSERT(Key != EMPTY);
+				rbNew = FALSE;
+				if (((m_nCount + 1) * 4) > ((m_nMask + 1) * 3))
+				{
+					// Can still go on if the table can't grow while there's room
+					if (!zResize(m_pSlots ? ((m_nMask + 1) * 2) : MIN_CAPACITY) && (!m_pSlots || ((m_nCount + 1) > m_nMask)))
+						return NULL;
+				}
+
+				size_t nIndex = zIndex(Key);
+				for (; m_pSlots[nIndex].m_Key != EMPTY; nIndex = ((nIndex + 1) & m_nMask))
+				{
+					if (m_pSlots[nIndex].m_Key == Key)
+						return &m_pSlots[nIndex];
+				}
+				m_pSlots[nIndex].m_Key = Key;
+				m_nCount++;
+				rbNew = TRUE;
+				return &m_pSlots[nIndex];
+			}
+
+			// Move to a table of "nCapacity" slots, a power of two
+			BOOL zResize(size_t nCapacity)
+			{
+				_ASSERT(nCapacity && !(nCapacity & (nCapacity - 1)) && (nCapacity > m_nCount));
+				Slot *pSlots = (Slot *) Allocator::Alloc(nCapacity * sizeof(Slot));
+				if (!pSlots)
+					return FALSE;
+				for (size_t i = 0; i < nCapacity; i++)
+					pSlots[i].m_Key = EMPTY;
+
+				Slot *pOld = m_pSlots;
+				size_t nOldCapacity = (pOld ? (m_nMask + 1) : 0);
+				m_pSlots = pSlots;
+				m_nMask = (nCapacity - 1);
+				m_nShift = Mixer::BITS;
+				for (size_t n = nCapacity; n > 1; n >>= 1)
+					m_nShift--;
+
+				for (size_t i = 0; i < nOldCapacity; i++)
+				{
+					if (pOld[i].m_Key != EMPTY)
+					{
+						size_t nIndex = zIndex(pOld[i].m_Key);
+						while (m_pSlots[nIndex].m_Key != EMPTY)
+							nIndex = ((nIndex + 1) & m_nMask);
+						m_pSlots[nIndex] = pOld[i];
+					}
+				}
+				if (pOld)
+					Allocator::Free(pOld, (nOldCapacity * sizeof(Slot)));
+				return TRUE;
+			}
+
+		public:
+			size_t GetCount() const { return m_nCount; }
+			__declspec(property(get=GetCount)) size_t _Count;
+			BOOL IsEmpty() const { return (m_nCount == 0); }
+			__declspec(property(get=IsEmpty)) BOOL _Empty;
+
+			// Make room for "nCount" items up front, returns FALSE if out of memory
+			BOOL Reserve(size_t nCount)
+			{
+				size_t nCapacity = MIN_CAPACITY;
+				while ((nCount * 4) > (nCapacity * 3))
+					nCapacity *= 2;
+				if (m_pSlots && (nCapacity <= (m_nMask + 1)))
+					return TRUE;
+				return zResize(nCapacity);
+			}
+
+			// Remove the key, returns FALSE if it wasn't there.
+			// The entries after it are shifted back into the gap, no tombstones.
+			BOOL Remove(KEY Key)
+			{
+				Slot *pSlot = zFind(Key);
+				if (!pSlot)
+					return FALSE;
+
+				size_t nHole = (size_t) (pSlot - m_pSlots);
+				for (size_t nIndex = ((nHole + 1) & m_nMask); m_pSlots[nIndex].m_Key != EMPTY; nIndex = ((nIndex + 1) & m_nMask))
+				{
+					// Can move back if the hole is not before it's home slot
+					size_t nHome = zIndex(m_pSlots[nIndex].m_Key);
+					if (((nIndex - nHome) & m_nMask) >= ((nIndex - nHole) & m_nMask))
+					{
+						m_pSlots[nHole] = m_pSlots[nIndex];
+						nHole = nIndex;
+					}
+				}
+				m_pSlots[nHole].m_Key = EMPTY;
+				m_nCount--;
+				return TRUE;
+			}
+
+			// Empty it, keeping the table for reuse
+			void Reset()
+			{
+				for (size_t i = 0; m_pSlots && (i <= m_nMask); i++)
+					m_pSlots[i].m_Key = EMPTY;
+				m_nCount = 0;
+			}
+
+			// Empty it and free the table
+			void Clear()
+			{
+				if (m_pSlots)
+				{
+					Allocator::Free(m_pSlots, ((m_nMask + 1) * sizeof(Slot)));
+					m_pSlots = NULL;
+				}
+				m_nMask = m_nCount = 0;
+				m_nShift = 0;
+			}
+
+			// For walking through the entries, in no particular order
+			Slot *GetFirst() { return zWalk(0); }
+			Slot *GetNext(Slot *pSlot) { _ASSERT(pSlot); return zWalk((size_t) (pSlot - m_pSlots) + 1); }
+			const Slot *GetFirst() const { return ((FlatHashEng*) this)->GetFirst(); }
+			const Slot *GetNext(const Slot *pSlot) const { return ((FlatHashEng*) this)->GetNext((Slot *) pSlot); }
+
+		private:
+			Slot *zWalk(size_t nIndex)
+			{
+				for (; m_pSlots && (nIndex <= m_nMask); nIndex++)
+				{
+					if (m_pSlots[nIndex].m_Key != EMPTY)
+						return &m_pSlots[nIndex];
+				}
+				return NULL;
+			}
+		};
+
+	}; // namespace Impl
+
+	// Flat hash set
+	template <class KEY, KEY EMPTY = (KEY) -1, class Allocator = QAlloc>
+	class FlatSet : public Impl::FlatHashEng<KEY, Impl::FlatSlotKey<KEY>, EMPTY, Allocator>
+	{
+	public:
+		typedef Impl::FlatSlotKey<KEY> Slot;
+
+		BOOL Find(KEY Key) const { return (zFind(Key) != NULL); }
+
+		// Returns TRUE if the key was added, FALSE if it was already there or out of memory
+		BOOL Insert(KEY Key)
+		{
+			BOOL bNew;
+			zInsert(Key, bNew);
+			return bNew;
+		}
+	};
+
+	// Flat hash map
+	template <class KEY, class VALUE, KEY EMPTY = (KEY) -1, class Allocator = QAlloc>
+	class FlatMap : public Impl::FlatHashEng<KEY, Impl::FlatSlotPair<KEY, VALUE>, EMPTY, Allocator>
+	{
+	public:
+		typedef Impl::FlatSlotPair<KEY, VALUE> Slot;
+
+		VALUE *Find(KEY Key)
+		{
+			Slot *pSlot = zFind(Key);
+			return (pSlot ? &pSlot->m_Value : NULL);
+		}
+		const VALUE *Find(KEY Key) const
+		{
+			return ((FlatMap*) this)->Find(Key);
+		}
+
+		// Add or replace, returns FALSE if out of memory
+		BOOL Insert(KEY Key, const VALUE &Value)
+		{
+			BOOL bNew;
+			if (Slot *pSlot = zInsert(Key, bNew))
+			{
+				pSlot->m_Value = Value;
+				return TRUE;
+			}
+			return FALSE;
+		}
+	};
+
+	// Common flat hash types
+	typedef FlatSet<ULONG> FlatSetOrd;			// integer key, -1 empty.
+	typedef FlatMap<ULONG, ULONG> FlatMapOrd;	// same, integer value.
+
 
 	//////////////////////////////////////////////////////////////////////
 	// Tree
@@ -1231,6 +1625,128 @@ namespace Container
 	typedef TreeEng<ULONG, ULONG, void> TreeOrd;	// integer key.
 	typedef TreeEng<ULONG, ULONG, size_t> TreeOrdC;	// same, counted.
 
+	//////////////////////////////////////////////////////////////////////
+	// Sorted map
+	// For data built once then only looked up, i.e. address indexes made at the start of a
+	// run. The keys are in one sorted array and the values in another, a lookup is a binary
+	// search touching just the keys and a range scan walks both arrays in order.
+	// Loaded from input that is already sorted, plain data keys and values only.
+	template <class KEY, class VALUE, class Allocator = QAlloc>
+	class SortedMap
+	{
+		KEY *m_pKeys;
+		VALUE *m_pValues;
+		size_t m_nCount, m_nSize;
+
+		// disable copy constructor and assignment
+		SortedMap(const SortedMap&);
+		void operator = (const SortedMap&);
+
+	public:
+		SortedMap() : m_pKeys(NULL), m_pValues(NULL), m_nCount(0), m_nSize(0) {}
+		~SortedMap() { Clear(); }
+
+		size_t GetCount() const { return m_nCount; }
+		__declspec(property(get=GetCount)) size_t _Count;
+
+		// Room for "nCount" entries, returns FALSE if out of memory
+		BOOL Reserve(size_t nCount)
+		{
+			if (nCount <= m_nSize)
+				return TRUE;
+			KEY *pKeys = (KEY *) Allocator::Realloc(m_pKeys, (m_nSize * sizeof(KEY)), (nCount * sizeof(KEY)));
+			if (!pKeys)
+				return FALSE;
+			m_pKeys = pKeys;
+			VALUE *pValues = (VALUE *) Allocator::Realloc(m_pValues, (m_nSize * sizeof(VALUE)), (nCount * sizeof(VALUE)));
+			if (!pValues)
+			{
+				// Keys back to the old size so the two agree
+				if (!m_nSize)
+				{
+					Allocator::Free(m_pKeys, (nCount * sizeof(KEY)));
+					m_pKeys = NULL;
+				}
+				else
+				if (KEY *pOldKeys = (KEY *) Allocator::Realloc(m_pKeys, (nCount * sizeof(KEY)), (m_nSize * sizeof(KEY))))
+					m_pKeys = pOldKeys;
+				return FALSE;
+			}
+			m_pValues = pValues;
+			m_nSize = nCount;
+			return TRUE;
+		}
+
+		// Bulk load, the entries must come in key order. Returns FALSE if out of memory.
+		BOOL Append(KEY Key, const VALUE &Value)
+		{
+			_ASSERT(!m_nCount || (m_pKeys[m_nCount - 1] < Key));
+			if ((m_nCount == m_nSize) && !Reserve(m_nSize ? (m_nSize * 2) : 64))
+				return FALSE;
+			m_pKeys[m_nCount] = Key;
+			m_pValues[m_nCount] = Value;
+			m_nCount++;
+			return TRUE;
+		}
+
+		// Index of the first key not less than "Key", GetCount() if there's none
+		size_t LowerBound(KEY Key) const
+		{
+			size_t nLow = 0;
+			for (size_t nLen = m_nCount; nLen > 0; )
+			{
+				size_t nHalf = (nLen >> 1);
+				if (m_pKeys[nLow + nHalf] < Key)
+				{
+					nLow += (nHalf + 1);
+					nLen -= (nHalf + 1);
+				}
+				else
+					nLen = nHalf;
+			}
+			return nLow;
+		}
+
+		// Index of the key, or of the last one before it. -1 if there's none
+		size_t FindExactSmaller(KEY Key) const
+		{
+			size_t nIndex = LowerBound(Key);
+			if ((nIndex < m_nCount) && (m_pKeys[nIndex] == Key))
+				return nIndex;
+			return (nIndex - 1);
+		}
+
+		// Index of the key, -1 if it's not there
+		size_t Find(KEY Key) const
+		{
+			size_t nIndex = LowerBound(Key);
+			return (((nIndex < m_nCount) && (m_pKeys[nIndex] == Key)) ? nIndex : (size_t) -1);
+		}
+
+		KEY GetKey(size_t nIndex) const { _ASSERT(nIndex < m_nCount); return m_pKeys[nIndex]; }
+		VALUE &GetValue(size_t nIndex) { _ASSERT(nIndex < m_nCount); return m_pValues[nIndex]; }
+		const VALUE &GetValue(size_t nIndex) const { _ASSERT(nIndex < m_nCount); return m_pValues[nIndex]; }
+
+		// Empty it, keeping the arrays for the next load
+		void Reset() { m_nCount = 0; }
+
+		// Empty it and free the arrays
+		void Clear()
+		{
+			if (m_pKeys)
+			{
+				Allocator::Free(m_pKeys, (m_nSize * sizeof(KEY)));
+				m_pKeys = NULL;
+			}
+			if (m_pValues)
+			{
+				Allocator::Free(m_pValues, (m_nSize * sizeof(VALUE)));
+				m_pValues = NULL;
+			}
+			m_nCount = m_nSize = 0;
+		}
+	};
+
 }; // namespace Container
 
 #pragma warning (pop) // Restore warnings level.
@@ -8,22 +8,33 @@
 #include "ContainersInl.h"
 #include <WaitBoxEx.h>
 #include <SegSelect.h>
-#include <IdaOgg.h>
+#include "Engine/EditList.h"
 
-#include "complete_ogg.h"
-
-#include <hash_set>
-typedef stdext::hash_set<ea_t> ADDRSET;
+typedef Container::FlatSet<ea_t, BADADDR, MemTagAlloc<MEM_ADDRSETS> > ADDRSET;
 
 // Preprocessor line backup
 // WIN32;NDEBUG;_WINDOWS;_USRDLL;_WINDLL;__NT__;__IDP__;__VC__;NO_OBSOLETE_FUNCS;BUILD_QWINDOW=1;QT_DLL;QT_GUI_LIB;QT_XML_LIB;QT_CORE_LIB;QT_NAMESPACE=QT;QT_THREAD_SUPPORT;_CRT_SECURE_NO_WARNINGS;%(PreprocessorDefinitions)
 
-//#define VBDEV
-//#define LOG_FILE
-
 // Count of eSTATE_PASS_1 unknown byte gather passes
 #define UNKNOWN_PASSES 8
 
+// Minimum time between run state checkpoints
+#define CHECKPOINT_PERIOD (30 * SECOND)
+
+// Wait box update period in milliseconds, and of its label with the rates and time left
+#define PROGRESS_PERIOD 100
+#define LABEL_PERIOD    (1 * SECOND)
+// Time over which the step rate is smoothed
+#define RATE_SMOOTHING  (5 * SECOND)
+
+// Background mode timer period in milliseconds, and the time it may take each tick
+#define BACKGROUND_PERIOD 100
+#define BACKGROUND_SLICE  (0.004 * SECOND)
+
+// Bytes around a changed range that are looked at with it
+#define DIRTY_MARGIN 32
+#define CHECKPOINT_VERSION 2
+
 // x86 hack for speed in alignment value searching
 // Defs from IDA headers, not supposed to be exported but need to because some cases not covered
 // by SDK accessors, etc.
@@ -68,6 +79,7 @@ enum eSTATES
     eSTATE_PASS_1,	// Find unknown data in code space
     eSTATE_PASS_2,	// Find missing "align" blocks
 	eSTATE_PASS_3,	// Find lost code instructions
+	eSTATE_PASS_FUSED, // Passes 1 to 3 in one sweep
 	eSTATE_PASS_4,  // Find missing functions part 1
 	eSTATE_PASS_5,  // Find bad function blocks
 
@@ -86,22 +98,63 @@ const static WORD OPT_ALIGNBLOCKS = BitF.Next();
 const static WORD OPT_MISSINGCODE = BitF.Next();
 const static WORD OPT_MISSINGFUNC = BitF.Next();
 const static WORD OPT_BADBLOCKS   = BitF.Next();
+const static WORD OPT_VFTABLES    = BitF.Next();
+
+// Address range
+struct tRANGE
+{
+	ea_t startEA, endEA;
+};
+
+// Segment relocation bitmap, kept between runs while the plug-in is resident
+struct tRELOCMAP
+{
+	ea_t startEA, endEA;
+	BYTE *pMap;			// NULL if the segment has no relocations
+	UINT uCount;
+};
+
+// Run state checkpoint, kept in the IDB so an interrupted run can be resumed
+static const char CHECKPOINT_NODE[] = "$ ExtraPass checkpoint";
+#define CHECKPOINT_GAPS      'G' // Blob, the function gap list as built
+#define CHECKPOINT_SEGMENTS  'S' // Blob, start addresses of the planned segments still to do
+#define CHECKPOINT_RANGES    'R' // Blob, the run's ranges, for the single pass 5
+#define CHECKPOINT_FOLLOWUP  'F' // Blob, fused sweep follow up ranges
+#define CHECKPOINT_FOLLOWUP2 'N' // Blob, fused sweep next round ranges
+
+struct tCHECKPOINT
+{
+	UINT uVersion;
+	UINT uState;
+	ea_t eaSegStart, eaSegEnd;
+	ea_t eaCurrentAddress, eaLastAddress;
+	int  iStartFuncCount, iProgressSteps, iProgressStep, iPass1Loops;
+	UINT uStep5Func, uGapsDone, uFollowUpIndex;
+	UINT uUnknowns, uAligns, uBlocksFixed, uRelocTables, uVftFuncs, uSwitchTables, uStubFuncs;
+	UINT64 uRunBytes, uRunBytesDone;
+	WORD wOptionFlags, wAudioAlertWhenDone, wFusedSweep, wUseCache, wVftDone;
+	TIMESTAMP RunTime, StepTime, Steps13Time; // Elapsed times
+};
 
 // Function info container
-struct tFUNCNODE : public Container::NodeEx<Container::ListHT, tFUNCNODE>
+// The nodes come from a pool in blocks of IDA allocs
+struct tFUNCNODE : public Container::NodeEx<Container::ListHT, tFUNCNODE>, public Container::InhPoolAlloc<tFUNCNODE, 1024, MemTagAlloc<MEM_FUNCLIST> >
 {
 	ea_t uAddress;
 	UINT uSize;
-
-	// Use IDA allocs
-	static PVOID operator new(size_t size){	return(qalloc(size)); };
-	static void operator delete(PVOID _Ptr){ return(qfree(_Ptr)); }
 };
 
 
 // === Function Prototypes ===
 static void ShowEndStats();
 static BOOL CheckBreak();
+static void StartStepProgress();
+static void EndStepProgress(BOOL bFinished);
+static void TallyProgress();
+static void GetStepInfo(int iState, LPCSTR &rpszName, LPCSTR &rpszItems);
+static double StepItems(int iState, double fItems);
+static void ShowProgress();
+static void HideProgress();
 static void NextState();
 static LPCTSTR GetDisasmText(ea_t ea);
 static LPCTSTR TimeString(TIMESTAMP Time);
@@ -113,17 +166,72 @@ static bool idaapi IsData(flags_t flags, void *ud);
 static BOOL InCode(ea_t eaAddress);
 static BOOL IsBadFuncStart(func_t *pFunc);
 static int  FixFuncBlock(ea_t eaBlock);
+static void BuildRelocMap(BOOL bQuiet = FALSE);
+static void FlushRelocMap();
+static void FreeRelocMaps();
+static int idaapi IdbCallback(void *pUserData, int iNotificationCode, va_list va);
+static void ToggleBackground();
+static void StopBackground();
+static segment_t *GetQuickRange();
+static BOOL PlanRun();
+static void NextPlanSegment();
+static void IndexRunRanges();
+static BOOL InRunRanges(ea_t ea);
+static void GetRunAreas(qvector<area_t> &rAreas);
+static UINT FirstStep5Func();
+static BOOL IsRelocTable(ea_t eaStart, ea_t eaEnd);
+static BOOL FixDataItem(ea_t eaStart, ea_t eaEnd, flags_t Flags, BOOL bWait);
+static ea_t FixAlignRun(ea_t eaStartAddress, ea_t endEA, BOOL *pbDeferred);
+static ea_t FusedStep(ea_t ea, ea_t eaLimit, BOOL bDefer);
+static bool idaapi IsFusedItem(flags_t flags, void *ud);
+static BOOL SaveCheckpoint();
+static BOOL ResumeCheckpoint();
+static BOOL HasCheckpoint();
+static void KillCheckpoint();
+extern UINT VFT_SeedFunctions(const qvector<area_t> &rCode);
+extern void SWI_Begin();
+extern BOOL SWI_IsKnownTable(ea_t ea);
+extern BOOL SWI_DecodeSwitch(ea_t eaRef, ea_t eaSegStart, ea_t eaSegEnd);
+extern UINT STB_CreateStubRuns(ea_t eaStart, ea_t eaEnd, ea_t eaSegStart, ea_t eaSegEnd);
+extern void IMP_ApplyEditList();
+extern BOOL CCH_Begin(ea_t eaStart, ea_t eaEnd, UINT uOptions);
+extern void CCH_Store();
+extern void CCH_Abandon();
+extern void CCH_ResetStats();
+extern void CCH_GetStats(UINT &ruHits, UINT &ruMisses, TIMESTAMP &rReplayTime);
+extern BOOL PLN_IsActive();
+extern void PLN_Begin();
+extern void PLN_Add(UINT uKind, ea_t ea, asize_t Size, ea_t eaOwner = 0);
+extern UINT PLN_Count();
+extern void PLN_Save();
+extern void PLN_End();
+extern void JRN_BeginRun(BOOL bContinue);
+extern void JRN_Flush();
+extern void JRN_EndRun();
+extern void JRN_Range(ea_t ea, asize_t Size);
+extern void JRN_AddFunc(ea_t ea);
+extern void JRN_DelFunc(ea_t ea);
+extern void JRN_Tail(ea_t eaOwner, ea_t eaStart, ea_t eaEnd);
+extern void JRN_Name(ea_t ea);
+extern void JRN_GetStats(UINT &ruRecords, UINT64 &ruBytes, TIMESTAMP &rTime);
+extern BOOL JRN_Rollback();
+extern void VFT_Invalidate();
+extern void CCH_Invalidate(ea_t ea);
+extern void CHK_Build(const qvector<area_t> &rRanges);
+extern void CHK_End();
+extern ea_t CHK_Owner(ea_t ea, ea_t *peaChunkEnd = NULL);
+extern void SND_PlayDone();
+extern void SND_Exit();
 
 // === Data ===
 static TIMESTAMP  s_StartTime = 0, s_StepTime = 0;
 static segment_t  *s_thisSeg  = NULL;
 static ea_t s_eaSegStart       = NULL;
 static ea_t s_eaSegEnd         = NULL;
+static ea_t s_eaCodeStart      = NULL; // Bounds of the segment being processed, the range above can be a part of it
+static ea_t s_eaCodeEnd        = NULL;
 static ea_t s_eaCurrentAddress = NULL;
 static ea_t s_eaLastAddress    = NULL;
-#ifdef LOG_FILE
-static FILE *s_hLogFile       = NULL;
-#endif
 static BOOL s_bStepStop       = TRUE;
 static eSTATES s_eState       = eSTATE_INIT;
 static int  s_iStartFuncCount = 0;
@@ -131,10 +239,40 @@ static int  s_iProgressSteps  = 0;
 static int  s_iProgressStep   = 0;
 static int  s_iPass1Loops     = 0;
 static UINT s_uStep5Func      = 0;
+static UINT s_uGapsTotal      = 0;
+
+// Progress the passes publish for the wait box update, a step's items go from first to end.
+// Addresses for the sweeps, gaps for step 4 and function numbers for step 5.
+struct tPROGRESS
+{
+	volatile LONG lFirst, lEnd;
+	volatile LONG lDone;
+	volatile LONG lUiDue;  // Set by the timer when the wait box is due an update
+	volatile LONG lCancel; // Set by the update on a cancel
+};
+static tPROGRESS s_Progress   = { 0 };
+static MMRESULT s_uProgressTimer = 0;
+// The items of each step over the run, and the time taken, for the rates
+struct tSTEPRATE
+{
+	UINT64 uItems;
+	TIMESTAMP Time;
+};
+static tSTEPRATE s_aStepRates[eSTATE_FINISH];
+static BOOL s_bStepOpen       = FALSE;  // A step's progress is being tallied
+static TIMESTAMP s_StepStart  = 0;
+static UINT s_uTallyDone      = 0;      // Done at the last tally
+static TIMESTAMP s_TallyTime  = 0;
+static double s_fStepRate     = 0.0;    // Smoothed items per second of the step
+static TIMESTAMP s_NextLabel  = 0;
 //
 static UINT s_uUnknowns       = 0;
 static UINT s_uAligns         = 0;
 static UINT s_uBlocksFixed    = 0;
+static UINT s_uRelocTables    = 0;
+static UINT s_uVftFuncs       = 0;
+static UINT s_uSwitchTables   = 0;
+static UINT s_uStubFuncs      = 0;
 //static UINT s_uAlignFails     = 0;
 //static UINT s_uCodeFixes      = 0;
 //static UINT s_uCodeFixFails   = 0;
@@ -144,8 +282,46 @@ static BOOL s_bDoAlignBlocks  = TRUE;
 static BOOL s_bDoMissingCode  = TRUE;
 static BOOL s_bDoMissingFunc  = TRUE;
 static BOOL s_bDoBadBlocks    = TRUE;
+static BOOL s_bDoVftables     = TRUE;
 static WORD s_wAudioAlertWhenDone = 1;
+static WORD s_wFusedSweep     = 0;
+static WORD s_wUseCache       = 1;
+static WORD s_wDryRun         = 0;
+static WORD s_wQuickPass      = 0;
+static sval_t s_QuickKB       = 16;
+static sval_t s_LogLevel      = LOGL_OFF;
+static sval_t s_MemBudgetMB   = 0;     // Zero for none
+static WORD s_wLogFlags       = (LOGC_ALL | LOGT_FILE); // Categories and where to
+static TIMESTAMP s_DryRunTime = 0;
+static UINT64 s_uDryRunBytes  = 0;
+static TIMESTAMP s_Steps13Time = 0;
+static qvector<tRANGE> s_FollowUp, s_FollowUpNext; // Fused sweep ranges to look at again after analysis
+static size_t s_uFollowUpIndex = 0;
 static SegSelect::segments *chosen = NULL;
+static qvector<segment_t *> s_PlanSegs; // Segments still to do, by size so the largest is last and next
+static qvector<tRANGE> s_RunRanges;     // All of the run's ranges, address ordered
+static Container::SortedMap<ea_t, ea_t, MemTagAlloc<MEM_INDEXES> > s_RunIndex; // Same, start to end for the lookups
+static UINT64 s_uRunBytes     = 0;      // Their total size, and of the ones done, for the progress
+static UINT64 s_uRunBytesDone = 0;
+static BOOL s_bVftDone        = FALSE;  // Vftables seeded for the run
+static BYTE *s_pRelocMap      = NULL; // One bit per segment byte, set where a relocation starts
+static qvector<tRELOCMAP> s_RelocMaps; // Built maps, s_pRelocMap points into one
+static BOOL s_bRelocLookup    = FALSE; // No map for the memory budget, ask IDA for the fixups
+static UINT s_uGapsDone       = 0;    // Function gaps processed since the list was built
+static UINT s_uGapsSaved      = 0;    // How many were done when the rest were saved to the checkpoint
+static BOOL s_bGapsSaved      = FALSE; // The checkpoint has the list
+static TIMESTAMP s_NextCheckpoint = 0;
+static BOOL s_bBackground     = FALSE; // Background incremental mode on
+static BOOL s_bInSlice        = FALSE; // Background slice running, its own changes are not dirty
+static BOOL s_bBgDataToBytes  = TRUE;  // Steps 1 and 2 as chosen when background mode was turned on
+static BOOL s_bBgAlignBlocks  = TRUE;
+static qtimer_t s_hBgTimer    = NULL;
+static qvector<tRANGE> s_Dirty;        // Changed ranges to look at, address ordered and disjoint
+static size_t s_uDirtyMem     = 0;      // Its buffer as counted to MEM_BACKGROUND
+static tRANGE s_BgRange       = { 0, 0 }; // The one being processed
+static ea_t s_eaBgCurrent     = 0;
+static int  s_iBgPhase        = 0;
+static UINT s_uBgRanges = 0, s_uBgChanges = 0;
 static ALIGN(16) Container::ListEx<Container::ListHT, tFUNCNODE> s_FuncList;
 
 
@@ -163,12 +339,13 @@ static const char optionDialog[] =
 	"It can find tens of thousands missing functions and alignment blocks making\n"
 	"your IDB more complete and easier to reverse.\n\n"
 
-	"It actually does essentially five processing steps:\n"
+	"It actually does essentially six processing steps:\n"
 	"1. Convert stray code section values to \"unknown\".\n"
 	"2. Fix missing \"align\" blocks.\n"
 	"3. Fix missing code bytes.\n"
 	"4. Locate and fix missing/undefined functions.\n"
-	"5. Locate and fix bad function blocks.\n\n"
+	"5. Locate and fix bad function blocks.\n"
+	"6. Seed virtual methods from MSVC RTTI vftables.\n\n"
 
 	"It's intended for, and only tested on typical MSVC and Intel complied Windows\n"
 	"32bit binary executables but it might still be helpful on Delphi/Borland and\n"
@@ -204,10 +381,49 @@ static const char optionDialog[] =
 
 	// checkbox -> s_bDoBadBlocks
 	"<#Fix bad/unconnected function blocks. Bad blocks incorrectly placed as a function head block\n"
-	"when in actuality is a tail block, etc.#5 Fix bad function blocks.:C>>\n"
+	"when in actuality is a tail block, etc.#5 Fix bad function blocks.:C>\n"
+
+	// checkbox -> s_bDoVftables
+	"<#Walk MSVC RTTI vftables and create functions for the virtual methods\n"
+	"that are only reachable through them.#6 Seed vftable methods.:C>>\n"
 
 	// checkbox -> s_wAudioAlertWhenDone
 	"<#Play sound on completion.#Play sound on completion.                                     :C>>\n"
+
+	// checkbox -> s_wFusedSweep
+	"<#Do steps 1 to 3 in a single address ordered sweep of the segment instead of a sweep for each.\n"
+	"Decisions that need the auto-analysis to finish first are queued for a short follow up.#Fused steps 1-3 sweep.:C>>\n"
+
+	// checkbox -> s_wUseCache
+	"<#Save each segment's results keyed by a hash of its bytes, and replay them when the same\n"
+	"segment is processed again instead of running the steps. Kept in the IDA user folder.#Use result cache.:C>>\n"
+
+	// checkbox -> s_wDryRun
+	"<#Don't change the IDB, save the edits the steps would make as a plan file instead.\n"
+	"Apply it later with the plug-in argument 1 edit list import.#Dry run, save an edit plan.:C>>\n"
+
+	// checkbox -> s_wQuickPass
+	"<#Only process the screen selection, or when there is none the area around the cursor.\n"
+	"All the steps are kept to the range, for a fast clean up while working.#Quick pass, selection or cursor area.:C>>\n"
+
+	// number -> s_QuickKB
+	"<#KB either side of the cursor to process when there is no selection.#Cursor area KB:D:6:6::>\n"
+
+	// number -> s_MemBudgetMB
+	"<#Most memory the plug-in's own structures may take, 0 for no limit. Over it the relocation\n"
+	"maps and the function chunk map are dropped and IDA is asked instead, slower but no memory.#Memory budget MB:D:6:6::>\n"
+
+	// number -> s_LogLevel
+	"<#Detail to log, 0 off, 1 problems, 2 gaps and function tries, 3 every gap item.\n"
+	"Only the checked categories of the level and lower are logged.#Log level:D:6:6::>\n"
+
+	// checkbox -> s_wLogFlags, LOGC_* then LOGT_* bits
+	"<#Problem functions and walk range errors.#Log problems.:C>\n"
+	"<#The function gap list and each gap walked.#Log function gaps.:C>\n"
+	"<#Each function try and the result.#Log function tries.:C>\n"
+	"<#Every item of the gaps with its disassembly.#Log gap items.:C>\n"
+	"<#Log to a text file. Asked for once, it stays open for the following runs.#Log to a file.:C>\n"
+	"<#Log to IDA's output window, much slower than the file.#Log to the output window.:C>>\n"
 	"<#Choose the code segment(s) to process.\nElse will use the first CODE segment by default.\n#Choose Code Segments:B:1:8::>\n"
     "                      "
 };
@@ -216,6 +432,9 @@ static const char optionDialog[] =
 void CORE_Init()
 {
     s_eState = eSTATE_INIT;
+
+    // Resident, the derived caches stay warm between runs, IDB changes drop them
+    hook_to_notification_point(HT_IDB, IdbCallback, NULL);
 }
 
 // Un-initialize
@@ -223,21 +442,22 @@ void CORE_Exit()
 {
     try
     {
-        #ifdef LOG_FILE
-        if(s_hLogFile)
-        {
-            qfclose(s_hLogFile);
-            s_hLogFile = NULL;
-        }
-        #endif
+        LogClose();
 
         if (chosen)
         {
             SegSelect::free(chosen);
             chosen = NULL;
         }
+        StopBackground();
+        unhook_from_notification_point(HT_IDB, IdbCallback, NULL);
         FlushFunctionList();
-        OggPlay::endPlay();
+        tFUNCNODE::GetPool().Clear();
+        CHK_End();
+        FreeRelocMaps();
+        VFT_Invalidate();
+        CCH_Invalidate(BADADDR);
+        SND_Exit();
         set_user_defined_prefix(0, NULL);
     }
     CATCH()
@@ -274,6 +494,31 @@ void CORE_Process(int iArg)
 {
     try
     {
+        // Argument 1, apply an edit list from the standalone engine instead
+        if ((iArg == 1) && (s_eState == eSTATE_INIT))
+        {
+            JRN_BeginRun(FALSE);
+            IMP_ApplyEditList();
+            JRN_EndRun();
+            return;
+        }
+
+        // Argument 2, undo the last run from the change journal
+        if ((iArg == 2) && (s_eState == eSTATE_INIT))
+        {
+            // An interrupted run's checkpoint goes with it
+            if (JRN_Rollback())
+                KillCheckpoint();
+            return;
+        }
+
+        // Argument 3, background incremental mode on or off
+        if ((iArg == 3) && (s_eState == eSTATE_INIT))
+        {
+            ToggleBackground();
+            return;
+        }
+
         while (TRUE)
         {
             switch (s_eState)
@@ -284,8 +529,34 @@ void CORE_Process(int iArg)
                 msg("\n== ExtraPass plugin: v: %s, BD: %s, By Sirmabus ==\n", MY_VERSION, __DATE__);
                 WaitBox::processIdaEvents();
 
+                // Pick up an interrupted run?
+                if (HasCheckpoint())
+                {
+                    if (!autoIsOk())
+                    {
+                        msg("** Wait for IDA to finish processing before starting plugin! **\n*** Aborted ***\n\n");
+                        s_eState = eSTATE_EXIT;
+                        break;
+                    }
+
+                    int iAnswer = askyn_c(1, "An interrupted ExtraPass run was found in this IDB.\nResume it?");
+                    if (iAnswer == -1)
+                    {
+                        msg(" - Canceled -\n\n");
+                        s_eState = eSTATE_EXIT;
+                        break;
+                    }
+                    if ((iAnswer == 1) && ResumeCheckpoint())
+                    {
+                        ShowProgress();
+                        StartStepProgress();
+                        break;
+                    }
+                    KillCheckpoint();
+                }
+
                 // Do UI for process pass selection
-                s_bDoDataToBytes = s_bDoAlignBlocks = s_bDoMissingCode = s_bDoMissingFunc = s_bDoBadBlocks = TRUE;
+                s_bDoDataToBytes = s_bDoAlignBlocks = s_bDoMissingCode = s_bDoMissingFunc = s_bDoBadBlocks = s_bDoVftables = TRUE;
                 s_wAudioAlertWhenDone = TRUE;
 
                 WORD wOptionFlags = 0;
@@ -294,10 +565,11 @@ void CORE_Process(int iArg)
                 if (s_bDoMissingCode) wOptionFlags |= OPT_MISSINGCODE;
                 if (s_bDoMissingFunc) wOptionFlags |= OPT_MISSINGFUNC;
                 if (s_bDoBadBlocks)   wOptionFlags |= OPT_BADBLOCKS;
+                if (s_bDoVftables)    wOptionFlags |= OPT_VFTABLES;
 
                 {
                     // To add forum URL to help box
-                    int iUIResult = AskUsingForm_c(optionDialog, MY_VERSION, __DATE__, DoHyperlink, &wOptionFlags, &s_wAudioAlertWhenDone, ChooseBtnHandler);
+                    int iUIResult = AskUsingForm_c(optionDialog, MY_VERSION, __DATE__, DoHyperlink, &wOptionFlags, &s_wAudioAlertWhenDone, &s_wFusedSweep, &s_wUseCache, &s_wDryRun, &s_wQuickPass, &s_QuickKB, &s_MemBudgetMB, &s_LogLevel, &s_wLogFlags, ChooseBtnHandler);
                     if (!iUIResult || (wOptionFlags == 0))
                     {
                         // User canceled, or no options selected, bail out
@@ -312,30 +584,39 @@ void CORE_Process(int iArg)
                     s_bDoMissingCode = ((wOptionFlags & OPT_MISSINGCODE) != 0);
                     s_bDoMissingFunc = ((wOptionFlags & OPT_MISSINGFUNC) != 0);
                     s_bDoBadBlocks = ((wOptionFlags & OPT_BADBLOCKS) != 0);
+                    s_bDoVftables = ((wOptionFlags & OPT_VFTABLES) != 0);
                 }
 
                 // IDA must be IDLE
                 if (autoIsOk())
                 {
-                    // Ask for the log file name once
-                    #ifdef LOG_FILE
-                    if(!s_hLogFile)
+                    // Ask for the log file name once, it stays open for the following runs
+                    if((s_LogLevel > LOGL_OFF) && (s_wLogFlags & LOGT_FILE))
                     {
-                        if(char *szFileName = askfile_c(1, "*.txt", "Select a log file name:"))
+                        if(!LogIsOpen())
                         {
-                            // Open it for appending
-                            s_hLogFile = qfopen(szFileName, "ab");
+                            if(char *szFileName = askfile_c(1, "*.txt", "Select a log file name:"))
+                                LogOpen(szFileName);
+                        }
+                        if(!LogIsOpen())
+                        {
+                            msg("** Log file open failed! Aborted. **\n");
+                            s_eState = eSTATE_EXIT;
+                            break;
                         }
                     }
-                    if(!s_hLogFile)
-                    {
-                        msg("** Log file open failed! Aborted. **\n");
-                        return;
-                    }
-                    #endif
+                    LogSetMask((UINT) max(s_LogLevel, LOGL_OFF), s_wLogFlags);
+                    MemSetBudget((size_t) max(s_MemBudgetMB, 0) * (1024 * 1024));
+                    MemResetPeaks();
 
                     s_thisSeg = NULL;
                     s_uUnknowns = 0;
+                    s_uRelocTables = 0;
+                    s_uVftFuncs = 0;
+                    s_uSwitchTables = 0;
+                    s_uStubFuncs = 0;
+                    s_Steps13Time = 0;
+                    CCH_ResetStats();
                     s_iProgressStep = 0;
                     s_iPass1Loops = 0;
                     s_iStartFuncCount = get_func_qty();
@@ -361,39 +642,27 @@ void CORE_Process(int iArg)
                         }
                         */
 
-                        // First chosen seg
-                        if (chosen && !chosen->empty())
+                        // The segments, or quick pass range, to do
+                        if (PlanRun())
                         {
-                            s_thisSeg = chosen->back();
-                            chosen->pop_back();
-                        }
-                        else
-                        // Use the first CODE seg
-                        {
-                            int iSegCount = get_segm_qty();
-                            int iIndex = 0;
-                            for (; iIndex < iSegCount; iIndex++)
+                            if (s_wDryRun)
                             {
-                                if (s_thisSeg = getnseg(iIndex))
-                                {
-                                    char sclass[32];
-                                    if (get_segm_class(s_thisSeg, sclass, SIZESTR(sclass)) <= 0)
-                                        break;
-                                    else
-                                    if (strcmp(sclass, "CODE") == 0)
-                                        break;
-                                }
+                                PLN_Begin();
+                                s_DryRunTime = GetTimeStamp();
+                                s_uDryRunBytes = 0;
                             }
-
-                            if (iIndex >= iSegCount)
-                                s_thisSeg = NULL;
-                        }
-
-                        if (s_thisSeg)
-                        {
-                            WaitBox::show();
-                            s_eaSegStart = s_thisSeg->startEA;
-                            s_eaSegEnd   = s_thisSeg->endEA;
+                            else
+                                JRN_BeginRun(FALSE);
+                            s_StartTime = GetTimeStamp();
+                            s_NextCheckpoint = (s_StartTime + CHECKPOINT_PERIOD);
+
+                            // Function chunk owners, looked up all through the passes
+                            qvector<area_t> Areas;
+                            GetRunAreas(Areas);
+                            CHK_Build(Areas);
+                            SWI_Begin();
+                            ShowProgress();
+                            NextPlanSegment();
                             NextState();
                             break;
                         }
@@ -415,7 +684,12 @@ void CORE_Process(int iArg)
             case eSTATE_START:
             {
                 // Cheating on the fact: BOOL == (int) 1
-                s_iProgressSteps = ((s_bDoDataToBytes ? UNKNOWN_PASSES : 0) + (s_bDoAlignBlocks + s_bDoMissingCode + s_bDoMissingFunc + s_bDoBadBlocks));
+                // Pass 5 is once for the run, with the last segment
+                BOOL bDoBadBlocks = (s_bDoBadBlocks && s_PlanSegs.empty());
+                if (s_wFusedSweep)
+                    s_iProgressSteps = ((s_bDoDataToBytes || s_bDoAlignBlocks || s_bDoMissingCode) + (s_bDoMissingFunc + bDoBadBlocks));
+                else
+                    s_iProgressSteps = ((s_bDoDataToBytes ? UNKNOWN_PASSES : 0) + (s_bDoAlignBlocks + s_bDoMissingCode + s_bDoMissingFunc + bDoBadBlocks));
                 s_eaCurrentAddress = 0;
                 s_iProgressStep = 0;
 
@@ -425,10 +699,58 @@ void CORE_Process(int iArg)
                 char sclass[32];
                 if(get_segm_class(s_thisSeg, sclass, SIZESTR(sclass)) <= 0)
                     strcpy(sclass, "????");
-                msg("\nProcessing segment: \"%s\", type: %s, address: %08X-%08X, size: %08X\n\n", name, sclass, s_thisSeg->startEA, s_thisSeg->endEA, s_thisSeg->size());
+                if (s_wQuickPass)
+                    msg("\nProcessing range: %08X-%08X, size: %08X, of segment: \"%s\", type: %s\n\n", s_eaSegStart, s_eaSegEnd, (s_eaSegEnd - s_eaSegStart), name, sclass);
+                else
+                    msg("\nProcessing segment: \"%s\", type: %s, address: %08X-%08X, size: %08X\n\n", name, sclass, s_thisSeg->startEA, s_thisSeg->endEA, s_thisSeg->size());
+
+                // Seed virtual methods first so the following passes see them as code
+                // The vftables point all over the segment, so not for a quick pass
+                // One data segment scan for all of the run's segments, ahead of the cache as it
+                // reaches past the segment, its results are not part of the cached ones
+                if (s_bDoVftables && !s_wQuickPass && !s_bVftDone)
+                {
+                    msg("===== Vftable methods =====\n");
+                    WaitBox::processIdaEvents();
+                    TIMESTAMP VftTime = GetTimeStamp();
+                    qvector<area_t> Code;
+                    GetRunAreas(Code);
+                    s_uVftFuncs += VFT_SeedFunctions(Code);
+                    s_bVftDone = TRUE;
+                    msg("Time: %s.\n\n", TimeString(GetTimeStamp() - VftTime));
+                }
+
+                // Same segment bytes, analysis state and options processed before, replay the cached results instead
+                // Not for a quick pass, a range around the cursor hardly ever comes up again
+                if (s_wUseCache && !s_wDryRun && !s_wQuickPass)
+                {
+                    UINT uOptions = ((s_bDoDataToBytes ? OPT_DATATOBYTES : 0) | (s_bDoAlignBlocks ? OPT_ALIGNBLOCKS : 0) | (s_bDoMissingCode ? OPT_MISSINGCODE : 0) |
+                                     (s_bDoMissingFunc ? OPT_MISSINGFUNC : 0) | (s_bDoBadBlocks ? OPT_BADBLOCKS : 0) | (s_bDoVftables ? OPT_VFTABLES : 0) | (s_wFusedSweep << 16));
+                    if (CCH_Begin(s_eaSegStart, s_eaSegEnd, uOptions))
+                    {
+                        // Still the run's pass 5 if this is the last segment
+                        if (bDoBadBlocks)
+                        {
+                            msg("===== Bad function blocks =====\n");
+                            s_StepTime = GetTimeStamp();
+                            s_uStep5Func = FirstStep5Func();
+                            s_iProgressStep = s_iProgressSteps;
+                            s_eState = eSTATE_PASS_5;
+                            StartStepProgress();
+                        }
+                        else
+                            s_eState = eSTATE_FINISH;
+                        break;
+                    }
+                }
+
+                if (s_wDryRun)
+                    s_uDryRunBytes += (s_eaSegEnd - s_eaSegStart);
+
+                // Relocations are static for the run, gather them once per segment
+                BuildRelocMap();
 
                 // Move to first process state
-                s_StartTime = GetTimeStamp();
                 NextState();
             }
             break;
@@ -436,6 +758,8 @@ void CORE_Process(int iArg)
             // Find unknown data values in code
             case eSTATE_PASS_1:
             {
+                s_Progress.lDone = (LONG) s_eaCurrentAddress;
+
                 // nextthat next_head next_not_tail next_visea nextaddr
                 if (s_eaCurrentAddress < s_eaSegEnd)
                 {
@@ -455,89 +779,7 @@ void CORE_Process(int iArg)
                             break;
                         }
 
-                        // Skip if it has offset reference (most common occurance)
-                        BOOL bSkip = FALSE;
-                        if (Flags & FF_0OFF)
-                        {
-                            //msg("  skip offset.\n");
-                            bSkip = TRUE;
-                        }
-                        else
-                            // Has a reference?
-                            if (Flags & FF_REF)
-                            {
-                                ea_t eaDRef = get_first_dref_to(s_eaCurrentAddress);
-                                if (eaDRef != BADADDR)
-                                {
-                                    // Ref part an offset?
-                                    flags_t ValueRef = getFlags(eaDRef);
-                                    if (isCode(ValueRef) && isOff1(ValueRef))
-                                    {
-                                        // Decide instruction to global "cmd" struct
-                                        BOOL bIsByteAccess = FALSE;
-                                        if (decode_insn(eaDRef))
-                                        {
-                                            switch (cmd.itype)
-                                            {
-                                                // movxx style move a byte?
-                                            case NN_movzx:
-                                            case NN_movsx:
-                                            {
-                                                //msg("%08X movzx\n", s_eaCurrentAddress);
-                                                bIsByteAccess = TRUE;
-                                            }
-                                            break;
-
-                                            case NN_mov:
-                                            {
-                                                if ((cmd.Operands[0].type == o_reg) && (cmd.Operands[1].dtyp == dt_byte))
-                                                {
-                                                    //msg("%08X mov\n", s_eaCurrentAddress);
-                                                    /*
-                                                    msg(" [0] T: %d, D: %d, \n", cmd.Operands[0].type, cmd.Operands[0].dtyp);
-                                                    msg(" [1] T: %d, D: %d, \n", cmd.Operands[1].type, cmd.Operands[1].dtyp);
-                                                    msg(" [2] T: %d, D: %d, \n", cmd.Operands[2].type, cmd.Operands[2].dtyp);
-                                                    msg(" [3] T: %d, D: %d, \n", cmd.Operands[3].type, cmd.Operands[3].dtyp);
-                                                    */
-                                                    bIsByteAccess = TRUE;
-                                                }
-                                            }
-                                            break;
-                                            };
-                                        }
-
-                                        // If it's byte access, assume it's a byte switch table
-                                        if (bIsByteAccess)
-                                        {
-                                            //msg("%08X not byte\n", s_eaCurrentAddress);
-                                            autoWait();
-                                            do_unknown(s_eaCurrentAddress, DOUNK_SIMPLE);
-                                            auto_mark_range(s_eaCurrentAddress, eaEnd, AU_UNK);
-                                            autoWait();
-                                            // Step through making the array, and any bad size a byte
-                                            //for(ea_t i = s_eaCurrentAddress; i < eaEnd; i++){ doByte(i, 1); }
-                                            doByte(s_eaCurrentAddress, (eaEnd - s_eaCurrentAddress));
-                                            autoWait();
-                                            bSkip = TRUE;
-                                        }
-                                    }
-                                }
-                            }
-
-                        // Make it unknown bytes
-                        if (!bSkip)
-                        {
-                            //msg("%08X %08X %02X unknown\n", s_eaCurrentAddress, eaEnd, getFlags(s_eaCurrentAddress));
-                            autoWait();
-                            do_unknown(s_eaCurrentAddress, DOUNK_SIMPLE);
-                            for (ea_t i = (s_eaCurrentAddress + 1); i < eaEnd; i++){ do_unknown(i, DOUNK_SIMPLE); }
-                            autoWait();
-                            auto_mark_range(s_eaCurrentAddress, eaEnd, AU_UNK);
-                            s_uUnknowns++;
-                            autoWait();
-
-                            // Note: Might have triggered auto-analysis and a alignment or function could be here now
-                        }
+                        FixDataItem(s_eaCurrentAddress, eaEnd, Flags, TRUE);
 
                         // Advance to next data value, or the end which ever comes first
                         s_eaCurrentAddress = eaEnd;
@@ -555,10 +797,13 @@ void CORE_Process(int iArg)
                     }
                 }
 
-                if (++s_iPass1Loops < UNKNOWN_PASSES)
+                // A dry run changes nothing, so another loop would find the same
+                if ((++s_iPass1Loops < UNKNOWN_PASSES) && !s_wDryRun)
                 {
                     //msg("** Pass %d Unknowns: %u\n", s_iPass1Loops, s_uUnknowns);
                     s_eaCurrentAddress = s_eaLastAddress = s_eaSegStart;
+                    s_Progress.lDone = s_Progress.lEnd;
+                    TallyProgress();
                 }
                 else
                 {
@@ -571,6 +816,8 @@ void CORE_Process(int iArg)
             // Find missing align blocks
             case eSTATE_PASS_2:
             {
+                s_Progress.lDone = (LONG) s_eaCurrentAddress;
+
                 #define NEXT(_Here, _Limit) nextthat(_Here, _Limit, IsAlignByte, NULL)
 
                 // Still inside this code segment?
@@ -596,156 +843,8 @@ void CORE_Process(int iArg)
                         }
 
                         //msg("%08X Start.\n", eaStartAddress);
-                        //msg("%08X F: %08X.\n", eaStartAddress, getFlags(eaStartAddress));
                         s_eaLastAddress = s_eaCurrentAddress;
-
-                        // Get run count of this align byte
-                        UINT uAlignByteCount = 1;
-                        flags_t StartAlignValue = getFlags(eaStartAddress);
-
-                        while (TRUE)
-                        {
-                            // Next byte
-                            s_eaCurrentAddress = nextaddr(s_eaCurrentAddress);
-                            //msg("%08X  Next.\n", s_eaCurrentAddress);
-                            //msg("%08X  F: %08X.\n", s_eaCurrentAddress, getFlags(s_eaCurrentAddress));
-
-                            if (s_eaCurrentAddress < endEA)
-                            {
-                                // Catch when we get caught up in an array, etc.
-                                if (s_eaCurrentAddress <= s_eaLastAddress)
-                                {
-                                    msg("%08X F: %08X *** Align test in array #2 ***\n", eaStartAddress);
-                                    s_eaCurrentAddress = s_eaLastAddress = nextaddr(s_eaCurrentAddress);
-                                    break;
-                                }
-                                s_eaLastAddress = s_eaCurrentAddress;
-
-                                // Count if it' still the same byte
-                                if (getFlags(s_eaCurrentAddress) == StartAlignValue)
-                                    uAlignByteCount++;
-                                else
-                                    break;
-                            }
-                            else
-                                break;
-                        };
-
-                        // Do these bytes bring about at least a 16 (could be 32) align?
-                        // TODO: Must we consider other alignments such as 4 and 8?
-                        //       Probably a compiler option that is not normally used anymore.
-                        if (((eaStartAddress + uAlignByteCount) & (16 - 1)) == 0)
-                        {
-                            // If short count, only try alignment if the line above or a below us has n xref
-                            // We don't want to try to align odd code and switch table bytes, etc.
-                            if (uAlignByteCount <= 2)
-                            {
-                                BOOL bHasRef = FALSE;
-
-                                // Before us
-                                ea_t eaEndAddress = (eaStartAddress + uAlignByteCount);
-                                ea_t eaRef = get_first_cref_from(eaEndAddress);
-                                if (eaRef != BADADDR)
-                                {
-                                    //msg("%08X cref from end.\n", eaEndAddress);
-                                    bHasRef = TRUE;
-                                }
-                                else
-                                {
-                                    eaRef = get_first_cref_to(eaEndAddress);
-                                    if (eaRef != BADADDR)
-                                    {
-                                        //msg("%08X cref to end.\n", eaEndAddress);
-                                        bHasRef = TRUE;
-                                    }
-                                }
-
-                                // After us
-                                if (eaRef == BADADDR)
-                                {
-                                    ea_t eaForeAddress = (eaStartAddress - 1);
-                                    eaRef = get_first_cref_from(eaForeAddress);
-                                    if (eaRef != BADADDR)
-                                    {
-                                        //msg("%08X cref from start.\n", eaForeAddress);
-                                        bHasRef = TRUE;
-                                    }
-                                    else
-                                    {
-                                        eaRef = get_first_cref_to(eaForeAddress);
-                                        if (eaRef != BADADDR)
-                                        {
-                                            //msg("%08X cref to start.\n", eaForeAddress);
-                                            bHasRef = TRUE;
-                                        }
-                                    }
-                                }
-
-                                // No code ref, now look for a broken code ref
-                                if (eaRef == BADADDR)
-                                {
-                                    // This is still not complete as it could still be code, but pointing to a vftable
-                                    // entry in data.
-                                    // But should be fixed on more passes.
-                                    ea_t eaEndAddress = (eaStartAddress + uAlignByteCount);
-                                    eaRef = get_first_dref_from(eaEndAddress);
-                                    if (eaRef != BADADDR)
-                                    {
-                                        // If it the ref points to code assume code is just broken here
-                                        if (isCode(getFlags(eaRef)))
-                                        {
-                                            //msg("%08X dref from end %08X.\n", eaRef, eaEndAddress);
-                                            bHasRef = TRUE;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        eaRef = get_first_dref_to(eaEndAddress);
-                                        if (eaRef != BADADDR)
-                                        {
-                                            if (isCode(getFlags(eaRef)))
-                                            {
-                                                //msg("%08X dref to end %08X.\n", eaRef, eaEndAddress);
-                                                bHasRef = TRUE;
-                                            }
-                                        }
-                                    }
-
-                                    if (eaRef == BADADDR)
-                                    {
-                                        //msg("%08X NO REF.\n", eaStartAddress);
-                                    }
-                                }
-
-                                // Assume it's not an alignment byte(s) and bail out
-                                if (!bHasRef) break;
-                            }
-
-                            // Attempt to make it an align block
-                            bool bResult = doAlign(eaStartAddress, uAlignByteCount, 0);
-                            // IDA will some times fail on 32 aligns for some reason, give it another try
-                            if (!bResult)
-                            {
-                                // Try again with explicit limits
-                                bResult = doAlign(eaStartAddress, uAlignByteCount, 32);
-                                if (!bResult)
-                                    bResult = doAlign(eaStartAddress, uAlignByteCount, 16);
-                            }
-
-                            if (bResult)
-                            {
-                                //msg("%08X %d ALIGN.\n", eaStartAddress, uAlignByteCount);
-                                s_uAligns++;
-                            }
-                            else
-                            {
-                                // There are several times will IDA will fail even when the alignment block is obvious.
-                                // Usually when it's an ALIGN(32) and there is a run of 16 align bytes
-                                // Could at least do a code analize on it. Then IDA will at least make a mini array of it
-                                //msg("%08X %d ** align fail **\n", eaStartAddress, uAlignByteCount);
-                                //s_uAlignFails++;
-                            }
-                        }
+                        s_eaCurrentAddress = FixAlignRun(eaStartAddress, endEA, NULL);
                     }
 
                     break;
@@ -761,6 +860,8 @@ void CORE_Process(int iArg)
             // Find missing code
             case eSTATE_PASS_3:
             {
+                s_Progress.lDone = (LONG) s_eaCurrentAddress;
+
                 // Still inside segment?
                 if (s_eaCurrentAddress < s_eaSegEnd)
                 {
@@ -812,6 +913,45 @@ void CORE_Process(int iArg)
             }
             break;
 
+            // Passes 1 to 3 fused into one address ordered sweep
+            case eSTATE_PASS_FUSED:
+            {
+                s_Progress.lDone = (LONG) s_eaCurrentAddress;
+
+                // The main sweep
+                if (s_eaCurrentAddress < s_eaSegEnd)
+                {
+                    s_eaCurrentAddress = FusedStep(s_eaCurrentAddress, s_eaSegEnd, TRUE);
+                    break;
+                }
+
+                // Then the follow up queue, a range at the time
+                if (s_uFollowUpIndex < s_FollowUp.size())
+                {
+                    tRANGE Range = s_FollowUp[s_uFollowUpIndex++];
+                    for (ea_t ea = Range.startEA; ea < Range.endEA; )
+                        ea = FusedStep(ea, Range.endEA, FALSE);
+                    break;
+                }
+
+                // Another round for what changed in this one, after the auto-analysis catches up
+                if (!s_FollowUpNext.empty() && !s_wDryRun && (++s_iPass1Loops < UNKNOWN_PASSES))
+                {
+                    autoWait();
+                    s_FollowUp.swap(s_FollowUpNext);
+                    s_FollowUpNext.clear();
+                    s_uFollowUpIndex = 0;
+                    break;
+                }
+
+                s_FollowUp.clear();
+                s_FollowUpNext.clear();
+                s_eaCurrentAddress = s_eaSegEnd;
+                CheckBreak();
+                NextState();
+            }
+            break;
+
             // Discover missing functions part 1
             case eSTATE_PASS_4:
             {
@@ -824,6 +964,7 @@ void CORE_Process(int iArg)
                     // Remove function entry
                     s_FuncList.RemoveHead();
                     delete pHeadNode;
+                    s_Progress.lDone = (LONG) ++s_uGapsDone;
                 }
                 else
                 {
@@ -842,13 +983,17 @@ void CORE_Process(int iArg)
                 {
                     if (func_t *pFunc = getn_func(s_uStep5Func))
                     {
-                        if (IsBadFuncStart(pFunc))
+                        // Only the functions starting in the run's ranges
+                        if (pFunc->startEA >= s_RunRanges.back().endEA)
+                            s_uStep5Func = get_func_qty();
+                        else
+                        if (InRunRanges(pFunc->startEA) && IsBadFuncStart(pFunc))
                         {
                             s_uBlocksFixed += (UINT)(FixFuncBlock(pFunc->startEA) > 0);
                         }
                     }
 
-                    s_uStep5Func++;
+                    s_Progress.lDone = (LONG) ++s_uStep5Func;
                 }
                 else
                 {
@@ -884,7 +1029,11 @@ void CORE_Process(int iArg)
         };
 
         BailOut:;
-        WaitBox::hide();
+        // A cancel leaves the exit state, clean up now so the next invocation starts
+        // from INIT, the plug-in stays loaded
+        if (s_eState == eSTATE_EXIT)
+            NextState();
+        HideProgress();
     }
     CATCH()
 }
@@ -893,6 +1042,8 @@ void CORE_Process(int iArg)
 // Decide next state to take
 static void NextState()
 {
+	EndStepProgress(TRUE);
+
 	// Rewind
 	if(s_eState < eSTATE_FINISH)
 	{
@@ -902,6 +1053,9 @@ static void NextState()
 		autoWait();
 	}
 
+	// Pass 5 is once for the run, with the last segment
+	BOOL bDoBadBlocks = (s_bDoBadBlocks && s_PlanSegs.empty());
+
 	// Logic
 	switch(s_eState)
 	{
@@ -915,6 +1069,17 @@ static void NextState()
 		// Start
 		case eSTATE_START:
 		{
+			if(s_wFusedSweep && (s_bDoDataToBytes || s_bDoAlignBlocks || s_bDoMissingCode))
+			{
+				msg("===== Fused steps 1-3 =====\n");
+				s_StepTime = GetTimeStamp();
+				s_FollowUp.clear();
+				s_FollowUpNext.clear();
+				s_uFollowUpIndex = 0;
+				s_iPass1Loops = 0;
+				s_eState = eSTATE_PASS_FUSED;
+			}
+			else
 			if(s_bDoDataToBytes)
 			{
 				msg("===== Fixing bad code bytes =====\n");
@@ -947,11 +1112,11 @@ static void NextState()
 				s_eState = eSTATE_PASS_4;
 			}
 			else
-			if(s_bDoBadBlocks)
+			if(bDoBadBlocks)
 			{
 				msg("===== Bad function blocks =====\n");
 				s_StepTime = GetTimeStamp();
-				s_uStep5Func = 0;
+				s_uStep5Func = FirstStep5Func();
 				s_eState = eSTATE_PASS_5;
 			}
 			else
@@ -966,6 +1131,7 @@ static void NextState()
 		case eSTATE_PASS_1:
 		{
 			msg("Time: %s.\n\n", TimeString(GetTimeStamp() - s_StepTime));
+			s_Steps13Time += (GetTimeStamp() - s_StepTime);
 
 			if(s_bDoAlignBlocks)
 			{
@@ -990,11 +1156,11 @@ static void NextState()
 				s_eState = eSTATE_PASS_4;
 			}
 			else
-			if(s_bDoBadBlocks)
+			if(bDoBadBlocks)
 			{
 				msg("===== Bad function blocks =====\n");
 				s_StepTime = GetTimeStamp();
-				s_uStep5Func = 0;
+				s_uStep5Func = FirstStep5Func();
 				s_eState = eSTATE_PASS_5;
 			}
 			else
@@ -1010,6 +1176,7 @@ static void NextState()
 		case eSTATE_PASS_2:
 		{
 			msg("Time: %s.\n\n", TimeString(GetTimeStamp() - s_StepTime));
+			s_Steps13Time += (GetTimeStamp() - s_StepTime);
 
 			if(s_bDoMissingCode)
 			{
@@ -1027,11 +1194,11 @@ static void NextState()
 				s_eState = eSTATE_PASS_4;
 			}
 			else
-			if(s_bDoBadBlocks)
+			if(bDoBadBlocks)
 			{
 				msg("===== Bad function blocks =====\n");
 				s_StepTime = GetTimeStamp();
-				s_uStep5Func = 0;
+				s_uStep5Func = FirstStep5Func();
 				s_eState = eSTATE_PASS_5;
 			}
 			else
@@ -1042,10 +1209,12 @@ static void NextState()
 		}
 		break;
 
-		// From missing code pass
+		// From missing code pass, or the fused 1 to 3 sweep
 		case eSTATE_PASS_3:
+		case eSTATE_PASS_FUSED:
 		{
 			msg("Time: %s.\n\n", TimeString(GetTimeStamp() - s_StepTime));
+			s_Steps13Time += (GetTimeStamp() - s_StepTime);
 
 			if(s_bDoMissingFunc)
 			{
@@ -1056,11 +1225,11 @@ static void NextState()
 				s_eState = eSTATE_PASS_4;
 			}
 			else
-			if(s_bDoBadBlocks)
+			if(bDoBadBlocks)
 			{
 				msg("===== Bad function blocks =====\n");
 				s_StepTime = GetTimeStamp();
-				s_uStep5Func = 0;
+				s_uStep5Func = FirstStep5Func();
 				s_eState = eSTATE_PASS_5;
 			}
 			else
@@ -1076,11 +1245,11 @@ static void NextState()
 		{
 			msg("Time: %s.\n\n", TimeString(GetTimeStamp() - s_StepTime));
 
-			if(s_bDoBadBlocks)
+			if(bDoBadBlocks)
 			{
 				msg("===== Bad function blocks =====\n");
 				s_StepTime = GetTimeStamp();
-				s_uStep5Func = 0;
+				s_uStep5Func = FirstStep5Func();
 				s_eState = eSTATE_PASS_5;
 			}
 			else
@@ -1107,18 +1276,25 @@ static void NextState()
 		{
 			// If there are more code segments to process, do next
 			autoWait();
-            if (chosen && !chosen->empty())
+			if(s_wUseCache && !s_wDryRun)
+				CCH_Store();
+			if(!s_PlanSegs.empty())
 			{
-				s_thisSeg = chosen->back();
-                chosen->pop_back();
-				s_eaSegStart = s_thisSeg->startEA;
-				s_eaSegEnd   = s_thisSeg->endEA;
+				s_uRunBytesDone += (s_eaSegEnd - s_eaSegStart);
+				NextPlanSegment();
 				s_eState = eSTATE_START;
+				SaveCheckpoint();
 			}
 			else
 			{
 				msg("\n===== Done =====\n");
+				KillCheckpoint();
 				ShowEndStats();
+				if(s_wDryRun)
+				{
+					PLN_Save();
+					PLN_End();
+				}
                 refresh_idaview_anyway();
                 WaitBox::processIdaEvents();
 
@@ -1126,12 +1302,12 @@ static void NextState()
 				if(s_wAudioAlertWhenDone)
 				{
                     // Only if processing took at least a few seconds
+                    // Left playing on its own, IDA is free right away
                     if ((GetTimeStamp() - s_StartTime) > 2.2)
                     {
                         WaitBox::updateAndCancelCheck(100);
                         WaitBox::processIdaEvents();
-                        OggPlay::playFromMemory((const PVOID)complete_ogg, complete_ogg_len);
-                        OggPlay::endPlay();
+                        SND_PlayDone();
                     }
 				}
 
@@ -1146,15 +1322,25 @@ static void NextState()
 		{
 			// In case we aborted some place and list still exists..
 			FlushFunctionList();
+			FlushRelocMap();
+			CCH_Abandon();
+			PLN_End();
+			JRN_EndRun();
+			CHK_End();
             if (chosen)
             {
                 SegSelect::free(chosen);
                 chosen = NULL;
             }
+			s_PlanSegs.clear();
+			s_RunRanges.clear();
+			s_RunIndex.Clear();
 			s_eState = eSTATE_INIT;
 		}
 		break;
 	};
+
+	StartStepProgress();
 }
 
 
@@ -1162,9 +1348,64 @@ static void NextState()
 static void ShowEndStats()
 {
 	msg("  Total time: %s.\n", TimeString(GetTimeStamp() - s_StartTime));
+	msg("    Segments: %u\n", (UINT) s_RunRanges.size());
+	msg("   Steps 1-3: %s, %s.\n", TimeString(s_Steps13Time), (s_wFusedSweep ? "fused" : "separate")); // To compare the two modes
+	for(int i = eSTATE_PASS_1; i <= eSTATE_PASS_5; i++)
+	{
+		// Each step's throughput over the run, the same as shown while it ran
+		if(s_aStepRates[i].Time > 0)
+		{
+			LPCSTR pszName, pszItems;
+			GetStepInfo(i, pszName, pszItems);
+			double fItems = StepItems(i, (double) s_aStepRates[i].uItems);
+			msg("  %s: %.0f %s, %s, %.1f %s/s.\n", pszName, fItems, pszItems, TimeString(s_aStepRates[i].Time), (fItems / s_aStepRates[i].Time), pszItems);
+		}
+	}
 	msg("  Alignments: %u\n", s_uAligns);
 	msg("Blocks fixed: %u\n", s_uBlocksFixed);
+	msg("Reloc tables: %u\n", s_uRelocTables);
+	msg("    Switches: %u\n", s_uSwitchTables);
 	msg("   Functions: %d\n", ((int) get_func_qty() - s_iStartFuncCount)); // Can be negative
+	msg(" VFT methods: %u\n", s_uVftFuncs); // Part of the above count, not from the gap search
+	msg(" Stub thunks: %u\n", s_uStubFuncs); // Same
+	if(s_wDryRun)
+	{
+		// No auto-analysis in a dry run, so not comparable to the normal run times
+		TIMESTAMP Time = (GetTimeStamp() - s_DryRunTime);
+		msg("     Dry run: %u edits planned, %s, %.2f MB/s.\n", PLN_Count(), TimeString(Time), ((Time > 0) ? ((double) s_uDryRunBytes / (1024.0 * 1024.0) / Time) : 0.0));
+	}
+	else
+	if(s_wUseCache)
+	{
+		UINT uHits, uMisses;
+		TIMESTAMP ReplayTime;
+		CCH_GetStats(uHits, uMisses, ReplayTime);
+		msg("  Cache hits: %u, misses: %u, replay time: %s.\n", uHits, uMisses, TimeString(ReplayTime));
+	}
+
+	// The plug-in's own memory, peak over the run and what's still held for the next one
+	size_t uMemLive, uMemPeak;
+	MemGetTotals(uMemLive, uMemPeak);
+	msg("      Memory: %u KB peak, %u KB kept", (UINT) ((uMemPeak + 1023) / 1024), (UINT) ((uMemLive + 1023) / 1024));
+	if(s_MemBudgetMB > 0)
+		msg(", budget %u MB", (UINT) s_MemBudgetMB);
+	msg(".\n");
+	for(UINT i = 0; i < MEM_TAGS; i++)
+	{
+		MemGetStats(i, uMemLive, uMemPeak);
+		if(uMemPeak)
+			msg("%12s: %u KB peak, %u KB kept.\n", MemTagName(i), (UINT) ((uMemPeak + 1023) / 1024), (UINT) ((uMemLive + 1023) / 1024));
+	}
+
+	if(!s_wDryRun)
+	{
+		// Journal overhead, should stay a small part of the run
+		UINT uRecords;
+		UINT64 uBytes;
+		TIMESTAMP JournalTime, RunTime = (GetTimeStamp() - s_StartTime);
+		JRN_GetStats(uRecords, uBytes, JournalTime);
+		msg("     Journal: %u changes, %u KB, %s, %.1f%% of the run.\n", uRecords, (UINT) ((uBytes + 1023) / 1024), TimeString(JournalTime), ((RunTime > 0) ? ((JournalTime * 100.0) / RunTime) : 0.0));
+	}
 
 	//msg("Code fixes: %u\n", s_uCodeFixes);
 	//msg("Code fails: %u\n", s_uCodeFixFails);
@@ -1175,121 +1416,1212 @@ static void ShowEndStats()
 }
 
 
-// Checks and handles if break key pressed; returns TRUE on break.
-static BOOL CheckBreak()
+// Set the wait box update due, from the multimedia timer's thread
+static void CALLBACK ProgressTimer(UINT uTimerID, UINT uMsg, DWORD_PTR dwUser, DWORD_PTR dw1, DWORD_PTR dw2)
 {
-	// Calc approx progress
+    s_Progress.lUiDue = TRUE;
+}
 
-	// s_eaSegStart
-	// s_eaSegEnd
-	// s_eaCurrentAddress
+// Show the wait box and start its update timer
+static void ShowProgress()
+{
+    s_Progress.lUiDue = s_Progress.lCancel = FALSE;
+    memset(s_aStepRates, 0, sizeof(s_aStepRates));
+    s_bStepOpen = FALSE;
+    WaitBox::show();
+    if (!s_uProgressTimer)
+        s_uProgressTimer = timeSetEvent(PROGRESS_PERIOD, (PROGRESS_PERIOD / 4), ProgressTimer, 0, (TIME_PERIODIC | TIME_CALLBACK_FUNCTION));
+}
 
-    if (WaitBox::isUpdateTime())
+static void HideProgress()
+{
+    if (s_uProgressTimer)
     {
-        int iProgressPercent;
-        if (s_iProgressStep == 0)
-            iProgressPercent = 0;
-        else
-        if (s_iProgressStep > s_iProgressSteps)
-            iProgressPercent = 100;
-        else
-        {
-            double fPerStep = (1.0 / (double) s_iProgressSteps);
-            double fAcum    = (fPerStep * (double)(s_iProgressStep - 1));
+        timeKillEvent(s_uProgressTimer);
+        s_uProgressTimer = 0;
+    }
+    s_Progress.lUiDue = s_Progress.lCancel = FALSE;
+    WaitBox::hide();
+}
 
-            ea_t eaCurrent = s_eaCurrentAddress;
-            if (eaCurrent < s_eaSegStart)
-                eaCurrent = s_eaSegStart;
-            else
-            if (eaCurrent > s_eaSegEnd)
-                eaCurrent = s_eaSegEnd;
+// Set the item range of the step just started, and what of it is done for a resumed one
+static void StartStepProgress()
+{
+    switch (s_eState)
+    {
+        case eSTATE_PASS_4:
+        {
+            s_Progress.lFirst = 0;
+            s_Progress.lEnd   = (LONG) s_uGapsTotal;
+            s_Progress.lDone  = (LONG) s_uGapsDone;
+        }
+        break;
 
-            double fMyPos    = (((double)(eaCurrent - s_eaSegStart) / (double)(s_eaSegEnd - s_eaSegStart)) * fPerStep);
-            iProgressPercent = (int)((fAcum + fMyPos) * 100.0);
+        // The functions of the run's ranges
+        case eSTATE_PASS_5:
+        {
+            UINT uEnd = s_uStep5Func;
+            if (func_t *pFunc = get_prev_func(s_RunRanges.back().endEA))
+                uEnd = max(uEnd, (UINT) (get_func_num(pFunc->startEA) + 1));
+            s_Progress.lFirst = (LONG) min(FirstStep5Func(), s_uStep5Func);
+            s_Progress.lEnd   = (LONG) uEnd;
+            s_Progress.lDone  = (LONG) s_uStep5Func;
         }
+        break;
 
-        if (WaitBox::updateAndCancelCheck(iProgressPercent))
+        default:
         {
-            msg("\n*** Aborted ***\n\n");
+            s_Progress.lFirst = (LONG) s_eaSegStart;
+            s_Progress.lEnd   = (LONG) s_eaSegEnd;
+            s_Progress.lDone  = (LONG) s_eaCurrentAddress;
+        }
+        break;
+    };
+
+    // Tally the passes from here
+    s_bStepOpen   = ((s_eState >= eSTATE_PASS_1) && (s_eState <= eSTATE_PASS_5));
+    s_StepStart   = s_TallyTime = GetTimeStamp();
+    s_uTallyDone  = (UINT) s_Progress.lDone;
+    s_fStepRate   = 0.0;
+    s_NextLabel   = 0;
+}
 
-            // Show stats then directly to exit
-            autoWait();
-            ShowEndStats();
-            s_eState = eSTATE_EXIT;
-            return(TRUE);
+// Add the items done since the last tally to the step's, and update its smoothed rate
+static void TallyProgress()
+{
+    UINT uDone  = (UINT) s_Progress.lDone;
+    UINT uItems = ((uDone >= s_uTallyDone) ? (uDone - s_uTallyDone) : (uDone - (UINT) s_Progress.lFirst)); // Step 1 starts over a few times
+    s_uTallyDone = uDone;
+    s_aStepRates[s_eState].uItems += uItems;
+
+    TIMESTAMP Now = GetTimeStamp();
+    TIMESTAMP Delta = (Now - s_TallyTime);
+    if (Delta > 0)
+    {
+        s_TallyTime = Now;
+        double fRate = ((double) uItems / Delta);
+        if (s_fStepRate == 0.0)
+            s_fStepRate = fRate;
+        else
+        {
+            double fWeight = (1.0 - exp(-Delta / RATE_SMOOTHING));
+            s_fStepRate += ((fRate - s_fStepRate) * fWeight);
         }
     }
+}
 
-	return(FALSE);
+// Done with the step, or the run was canceled in it
+static void EndStepProgress(BOOL bFinished)
+{
+    if (s_bStepOpen)
+    {
+        // The sweeps don't publish their last stretch
+        if (bFinished && (s_eState != eSTATE_PASS_4) && (s_eState != eSTATE_PASS_5))
+            s_Progress.lDone = s_Progress.lEnd;
+        TallyProgress();
+        s_aStepRates[s_eState].Time += (GetTimeStamp() - s_StepStart);
+        s_bStepOpen = FALSE;
+    }
 }
 
+// Step name and what its items are
+static void GetStepInfo(int iState, LPCSTR &rpszName, LPCSTR &rpszItems)
+{
+    static const char *apszNames[] = { "Step 1, unknown data", "Step 2, align blocks", "Step 3, missing code", "Steps 1-3 fused", "Step 4, missing functions", "Step 5, bad function blocks" };
+    rpszName  = apszNames[iState - eSTATE_PASS_1];
+    rpszItems = ((iState == eSTATE_PASS_4) ? "gaps" : ((iState == eSTATE_PASS_5) ? "functions" : "KB"));
+}
 
-// Build local list of function gaps
-// There is a problem with IDA enumerating using get_next_func() after there is a change in between.
-// So we build a local list first then process it for missing functions.
-static BOOL BuildFuncionList()
+// Items for the text, the sweeps count bytes
+static double StepItems(int iState, double fItems)
 {
-	int iCount = 0;
-	FlushFunctionList();
+    return(((iState == eSTATE_PASS_4) || (iState == eSTATE_PASS_5)) ? fItems : (fItems / 1024.0));
+}
 
-	#ifdef LOG_FILE
-	Log(s_hLogFile, "\n====== Function gaps ======\n");
-	#endif
-	//msg("\n====== Function gaps ======\n");
+// Step rate and time left on the wait box label
+static void UpdateProgressLabel(double fRunDone)
+{
+    TIMESTAMP Now = GetTimeStamp();
+    if (!s_bStepOpen || (Now < s_NextLabel))
+        return;
+    s_NextLabel = (Now + LABEL_PERIOD);
+
+    LPCSTR pszName, pszItems;
+    GetStepInfo(s_eState, pszName, pszItems);
+    UINT uFirst = (UINT) s_Progress.lFirst, uEnd = (UINT) s_Progress.lEnd, uDone = (UINT) s_Progress.lDone;
+    uDone = min(max(uDone, uFirst), uEnd);
+
+    // Left of the step at its rate, step 1's sweep has its loops to go too
+    double fLeft = (double) (uEnd - uDone);
+    if ((s_eState == eSTATE_PASS_1) && !s_wDryRun)
+        fLeft += ((double) (UNKNOWN_PASSES - 1 - min(s_iPass1Loops, (UNKNOWN_PASSES - 1))) * (double) (uEnd - uFirst));
+
+    char szStepLeft[64], szRunLeft[64];
+    if (s_fStepRate > 0.0)
+        qstrncpy(szStepLeft, TimeString(fLeft / s_fStepRate), sizeof(szStepLeft));
+    else
+        qstrncpy(szStepLeft, "?", sizeof(szStepLeft));
 
-	if(func_t *pLastFunc = get_next_func(s_eaSegStart))
-	{
-		iCount++;
+    // The rest of the run going by how far along it is
+    TIMESTAMP RunTime = (Now - s_StartTime);
+    if (fRunDone >= 0.01)
+        qstrncpy(szRunLeft, TimeString((RunTime * (1.0 - fRunDone)) / fRunDone), sizeof(szRunLeft));
+    else
+        qstrncpy(szRunLeft, "?", sizeof(szRunLeft));
+
+    char szLabel[256];
+    _snprintf(szLabel, SIZESTR(szLabel), "%s\n%.0f of %.0f %s, %.1f %s/s\nStep left: %s, run left: about %s",
+              pszName, StepItems(s_eState, (double) (uDone - uFirst)), StepItems(s_eState, (double) (uEnd - uFirst)), pszItems,
+              StepItems(s_eState, s_fStepRate), pszItems, szStepLeft, szRunLeft);
+    szLabel[SIZESTR(szLabel)] = 0;
+    WaitBox::setLabelText(szLabel);
+}
 
-		while(func_t *pNextFunc = get_next_func(pLastFunc->startEA))
-		{
-			iCount++;
+// Update the wait box from the published progress, and see if it was canceled
+static void UpdateProgress()
+{
+    s_Progress.lUiDue = FALSE;
+    if (s_bStepOpen)
+        TallyProgress();
 
-			// A gap between the last function?
-			int iGap = ((int) pNextFunc->startEA - (int) pLastFunc->endEA);
-			if(iGap > 0)
-			{
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "%08X GAP[%06d] %d.\n", pLastFunc->endEA, iCount++, iGap);
-				#endif
-				//msg("%08X GAP[%06d] %d.\n", pLastFunc->endEA, iCount++, iGap);
+    int iProgressPercent;
+    if (s_iProgressStep == 0)
+        iProgressPercent = 0;
+    else
+    if (s_iProgressStep > s_iProgressSteps)
+        iProgressPercent = 100;
+    else
+    {
+        double fPerStep = (1.0 / (double) s_iProgressSteps);
+        double fAcum    = (fPerStep * (double)(s_iProgressStep - 1));
 
-				// Add it to the list
-				if(tFUNCNODE *pNode = new tFUNCNODE())
-				{
-					pNode->uAddress = pLastFunc->endEA;
-					pNode->uSize    = (UINT) iGap;
+        // How far into the step's items
+        UINT uFirst = (UINT) s_Progress.lFirst, uEnd = (UINT) s_Progress.lEnd, uDone = (UINT) s_Progress.lDone;
+        double fMyPos = 0.0;
+        if (uEnd > uFirst)
+        {
+            uDone  = min(max(uDone, uFirst), uEnd);
+            fMyPos = (((double) (uDone - uFirst) / (double) (uEnd - uFirst)) * fPerStep);
+        }
 
-					if(s_FuncList.IsEmpty())
-						s_FuncList.InsertHead(*pNode);
-					else
-						s_FuncList.InsertTail(*pNode);
-				}
-			}
+        // Over the whole run, the segment's share by size
+        double fSegment  = ((double) (s_eaSegEnd - s_eaSegStart) * (fAcum + fMyPos));
+        iProgressPercent = (int) (((((double) s_uRunBytesDone + fSegment) / (double) (s_uRunBytes ? s_uRunBytes : 1)) * 100.0));
+    }
+    UpdateProgressLabel((double) iProgressPercent / 100.0);
 
-			pLastFunc = pNextFunc;
-		};
-	}
-	//msg("Func count: %d %d.\n", iCount, get_func_qty());
+    if (WaitBox::updateAndCancelCheck(iProgressPercent))
+    {
+        msg("\n*** Aborted ***\n\n");
+        EndStepProgress(FALSE);
+        if (SaveCheckpoint())
+            msg("Progress saved, run the plug-in again to resume.\n");
+
+        // Show stats then directly to exit
+        autoWait();
+        ShowEndStats();
+        s_eState = eSTATE_EXIT;
+        s_Progress.lCancel = TRUE;
+        return;
+    }
 
-	#ifdef LOG_FILE
-	Log(s_hLogFile, "\n\n");
-	#endif
+    // Riding on the wait box update time keeps the time checks out of the pass loops
+    if (GetTimeStamp() >= s_NextCheckpoint)
+        SaveCheckpoint();
+}
 
-	return(!s_FuncList.IsEmpty());
+// Checks and handles if break key pressed; returns TRUE on break.
+// The timer only raises a flag, so between updates it's just the two loads.
+static BOOL CheckBreak()
+{
+    if (s_Progress.lUiDue)
+        UpdateProgress();
+    return(s_Progress.lCancel != FALSE);
 }
 
-// Free function list
-static void FlushFunctionList()
+
+// Quick pass range, the screen selection or the area around the cursor, kept to its segment
+// Sets the pass bounds and returns the segment, or NULL if there's none there.
+static segment_t *GetQuickRange()
 {
-	while(tFUNCNODE *pHeadNode = s_FuncList.GetHead())
+	ea_t eaStart, eaEnd;
+	if(!read_selection(&eaStart, &eaEnd))
 	{
-		s_FuncList.RemoveHead();
-		delete pHeadNode;
-	};
+		ea_t eaCursor = get_screen_ea();
+		ea_t Half = (ea_t) (max(1, s_QuickKB) * 1024);
+		eaStart = ((eaCursor > Half) ? (eaCursor - Half) : 0);
+		eaEnd   = (eaCursor + Half);
+	}
+
+	segment_t *pSeg = getseg(eaStart);
+	if(!pSeg)
+		pSeg = getseg(eaEnd - 1);
+	if(!pSeg)
+	{
+		msg("** No segment at the selection or cursor! **\n");
+		return(NULL);
+	}
+	s_eaSegStart = max(eaStart, pSeg->startEA);
+	s_eaSegEnd   = min(eaEnd, pSeg->endEA);
+	return(pSeg);
 }
 
-// Returns TRUE if flag byte is possibly a typical alignment byte
+// Sort compare, segments by size
+static int __cdecl CompareSegSize(const void *pA, const void *pB)
+{
+	asize_t A = (*((segment_t **) pA))->size(), B = (*((segment_t **) pB))->size();
+	return((A < B) ? -1 : ((A > B) ? 1 : 0));
+}
+
+// Sort compare, ranges by address
+static int __cdecl CompareRange(const void *pA, const void *pB)
+{
+	ea_t A = ((tRANGE *) pA)->startEA, B = ((tRANGE *) pB)->startEA;
+	return((A < B) ? -1 : ((A > B) ? 1 : 0));
+}
+
+// Plan the run: the quick pass range, the chosen segments, or else the first code segment.
+// The segments are done largest first so the progress estimate settles early, pass 5 and the
+// vftable scan are done once for all of them. Returns FALSE if there's nothing to do.
+static BOOL PlanRun()
+{
+	s_PlanSegs.clear();
+	s_RunRanges.clear();
+	s_uRunBytes = s_uRunBytesDone = 0;
+	s_bVftDone = FALSE;
+
+	if(s_wQuickPass)
+	{
+		if(segment_t *pSeg = GetQuickRange())
+		{
+			s_PlanSegs.push_back(pSeg);
+			tRANGE Range = { s_eaSegStart, s_eaSegEnd };
+			s_RunRanges.push_back(Range);
+		}
+	}
+	else
+	if(chosen && !chosen->empty())
+	{
+		for(SegSelect::segments::iterator it = chosen->begin(); it != chosen->end(); ++it)
+		{
+			// Once each
+			if(s_PlanSegs.find(*it) == s_PlanSegs.end())
+				s_PlanSegs.push_back(*it);
+		}
+	}
+	else
+	{
+		// Use the first CODE seg
+		int iSegCount = get_segm_qty();
+		for(int iIndex = 0; iIndex < iSegCount; iIndex++)
+		{
+			if(segment_t *pSeg = getnseg(iIndex))
+			{
+				char sclass[32];
+				if((get_segm_class(pSeg, sclass, SIZESTR(sclass)) <= 0) || (strcmp(sclass, "CODE") == 0))
+				{
+					s_PlanSegs.push_back(pSeg);
+					break;
+				}
+			}
+		}
+	}
+
+	// Taken into the plan
+	if(chosen)
+	{
+		SegSelect::free(chosen);
+		chosen = NULL;
+	}
+	if(s_PlanSegs.empty())
+		return(FALSE);
+
+	if(!s_wQuickPass)
+	{
+		qsort(&s_PlanSegs[0], s_PlanSegs.size(), sizeof(segment_t *), CompareSegSize);
+		for(size_t i = 0; i < s_PlanSegs.size(); i++)
+		{
+			tRANGE Range = { s_PlanSegs[i]->startEA, s_PlanSegs[i]->endEA };
+			s_RunRanges.push_back(Range);
+		}
+		qsort(&s_RunRanges[0], s_RunRanges.size(), sizeof(tRANGE), CompareRange);
+	}
+	for(size_t i = 0; i < s_RunRanges.size(); i++)
+		s_uRunBytes += (s_RunRanges[i].endEA - s_RunRanges[i].startEA);
+	IndexRunRanges();
+
+	if(s_PlanSegs.size() > 1)
+		msg("Planned %u segments, %u KB.\n", (UINT) s_PlanSegs.size(), (UINT) ((s_uRunBytes + 1023) / 1024));
+	return(TRUE);
+}
+
+// Take the next planned segment, the largest left
+static void NextPlanSegment()
+{
+	s_thisSeg = s_PlanSegs.back();
+	s_PlanSegs.pop_back();
+	s_eaCodeStart = s_thisSeg->startEA;
+	s_eaCodeEnd   = s_thisSeg->endEA;
+
+	// A quick pass keeps it's range in the segment
+	if(!s_wQuickPass)
+	{
+		s_eaSegStart = s_eaCodeStart;
+		s_eaSegEnd   = s_eaCodeEnd;
+	}
+}
+
+// Returns TRUE if the address is in one of the run's ranges
+static BOOL InRunRanges(ea_t ea)
+{
+	size_t uIndex = s_RunIndex.FindExactSmaller(ea);
+	return((uIndex != (size_t) -1) && (ea < s_RunIndex.GetValue(uIndex)));
+}
+
+// Build the lookup index of the run's ranges, once they're set
+static void IndexRunRanges()
+{
+	s_RunIndex.Reset();
+	s_RunIndex.Reserve(s_RunRanges.size());
+	for(size_t i = 0; i < s_RunRanges.size(); i++)
+		s_RunIndex.Append(s_RunRanges[i].startEA, s_RunRanges[i].endEA);
+}
+
+// The run's ranges as IDA areas
+static void GetRunAreas(qvector<area_t> &rAreas)
+{
+	rAreas.clear();
+	for(size_t i = 0; i < s_RunRanges.size(); i++)
+		rAreas.push_back(area_t(s_RunRanges[i].startEA, s_RunRanges[i].endEA));
+}
+
+// Index of the first function pass 5 looks at, the first one starting in the run's ranges
+static UINT FirstStep5Func()
+{
+	if(func_t *pFunc = get_next_func(s_RunRanges.front().startEA - 1))
+		return((UINT) get_func_num(pFunc->startEA));
+	return((UINT) get_func_qty());
+}
+
+
+// Build local list of function gaps
+// There is a problem with IDA enumerating using get_next_func() after there is a change in between.
+// So we build a local list first then process it for missing functions.
+static BOOL BuildFuncionList()
+{
+	int iCount = 0;
+	FlushFunctionList();
+
+	LOG(LOGC_GAPS, "\n====== Function gaps ======\n");
+	//msg("\n====== Function gaps ======\n");
+
+	if(func_t *pLastFunc = get_next_func(s_eaSegStart))
+	{
+		iCount++;
+
+		while(func_t *pNextFunc = get_next_func(pLastFunc->startEA))
+		{
+			iCount++;
+
+			// Done at the end of the range, the other segments get their own
+			if(pLastFunc->endEA >= s_eaSegEnd)
+				break;
+
+			// A gap between the last function? Kept to the range
+			int iGap = ((int) min(pNextFunc->startEA, s_eaSegEnd) - (int) pLastFunc->endEA);
+			if(iGap > 0)
+			{
+				LOG(LOGC_GAPS, "%08X GAP[%06d] %d.\n", pLastFunc->endEA, iCount++, iGap);
+				//msg("%08X GAP[%06d] %d.\n", pLastFunc->endEA, iCount++, iGap);
+
+				// Add it to the list
+				if(tFUNCNODE *pNode = new tFUNCNODE())
+				{
+					pNode->uAddress = pLastFunc->endEA;
+					pNode->uSize    = (UINT) iGap;
+
+					if(s_FuncList.IsEmpty())
+						s_FuncList.InsertHead(*pNode);
+					else
+						s_FuncList.InsertTail(*pNode);
+				}
+			}
+
+			pLastFunc = pNextFunc;
+		};
+	}
+	//msg("Func count: %d %d.\n", iCount, get_func_qty());
+
+	LOG(LOGC_GAPS, "\n\n");
+
+	// Saved with the first checkpoint, see SaveCheckpoint()
+	s_uGapsDone = 0;
+	s_uGapsTotal = 0;
+	s_bGapsSaved = FALSE;
+	for(tFUNCNODE *pNode = s_FuncList.GetHead(); pNode; pNode = pNode->GetNext())
+		s_uGapsTotal++;
+
+	return(!s_FuncList.IsEmpty());
+}
+
+// Free function list, the nodes all go back to their pool at once
+static void FlushFunctionList()
+{
+	s_FuncList.Reset();
+	tFUNCNODE::GetPool().Reset();
+}
+
+
+// Replace a checkpoint blob
+static void SetBlob(netnode &rNode, char cTag, const void *pData, size_t uSize)
+{
+	rNode.delblob(0, cTag);
+	if(uSize)
+		rNode.setblob(pData, uSize, 0, cTag);
+}
+
+static void GetRanges(netnode &rNode, char cTag, qvector<tRANGE> &rRanges)
+{
+	rRanges.clear();
+	size_t uSize = 0;
+	if(tRANGE *pRanges = (tRANGE *) rNode.getblob(NULL, &uSize, 0, cTag))
+	{
+		for(size_t i = 0; i < (uSize / sizeof(tRANGE)); i++)
+			rRanges.push_back(pRanges[i]);
+		qfree(pRanges);
+	}
+}
+
+// Save the run state to the IDB, returns TRUE if saved.
+// The gap list is big so it's saved once, with the first checkpoint of step 4, after
+// that it's just the count done since.
+static BOOL SaveCheckpoint()
+{
+	s_NextCheckpoint = (GetTimeStamp() + CHECKPOINT_PERIOD);
+
+	// Only mid run, and not dry runs, their plan is not in the IDB
+	// Quick passes are short, not worth it
+	if((s_eState < eSTATE_START) || (s_eState > eSTATE_PASS_5) || s_wDryRun || s_wQuickPass || !s_thisSeg)
+		return(FALSE);
+
+	tCHECKPOINT Cp;
+	ZeroMemory(&Cp, sizeof(Cp));
+	Cp.uVersion         = CHECKPOINT_VERSION;
+	Cp.uState           = s_eState;
+	Cp.eaSegStart       = s_eaSegStart;
+	Cp.eaSegEnd         = s_eaSegEnd;
+	Cp.eaCurrentAddress = s_eaCurrentAddress;
+	Cp.eaLastAddress    = s_eaLastAddress;
+	Cp.iStartFuncCount  = s_iStartFuncCount;
+	Cp.iProgressSteps   = s_iProgressSteps;
+	Cp.iProgressStep    = s_iProgressStep;
+	Cp.iPass1Loops      = s_iPass1Loops;
+	Cp.uStep5Func       = s_uStep5Func;
+	Cp.uGapsDone        = (s_uGapsDone - s_uGapsSaved);
+	Cp.uFollowUpIndex   = (UINT) s_uFollowUpIndex;
+	Cp.uUnknowns        = s_uUnknowns;
+	Cp.uAligns          = s_uAligns;
+	Cp.uBlocksFixed     = s_uBlocksFixed;
+	Cp.uRelocTables     = s_uRelocTables;
+	Cp.uVftFuncs        = s_uVftFuncs;
+	Cp.uSwitchTables    = s_uSwitchTables;
+	Cp.uStubFuncs       = s_uStubFuncs;
+	Cp.uRunBytes        = s_uRunBytes;
+	Cp.uRunBytesDone    = s_uRunBytesDone;
+	if (s_bDoDataToBytes) Cp.wOptionFlags |= OPT_DATATOBYTES;
+	if (s_bDoAlignBlocks) Cp.wOptionFlags |= OPT_ALIGNBLOCKS;
+	if (s_bDoMissingCode) Cp.wOptionFlags |= OPT_MISSINGCODE;
+	if (s_bDoMissingFunc) Cp.wOptionFlags |= OPT_MISSINGFUNC;
+	if (s_bDoBadBlocks)   Cp.wOptionFlags |= OPT_BADBLOCKS;
+	if (s_bDoVftables)    Cp.wOptionFlags |= OPT_VFTABLES;
+	Cp.wAudioAlertWhenDone = s_wAudioAlertWhenDone;
+	Cp.wFusedSweep      = s_wFusedSweep;
+	Cp.wUseCache        = s_wUseCache;
+	Cp.wVftDone         = (WORD) s_bVftDone;
+	TIMESTAMP Now = GetTimeStamp();
+	Cp.RunTime          = (Now - s_StartTime);
+	Cp.StepTime         = (Now - s_StepTime);
+	Cp.Steps13Time      = s_Steps13Time;
+
+	netnode Node(CHECKPOINT_NODE, 0, true);
+	if((s_eState == eSTATE_PASS_4) && !s_bGapsSaved)
+	{
+		// The ones left, the count done starts over from here
+		qvector<tRANGE> Gaps;
+		for(tFUNCNODE *pNode = s_FuncList.GetHead(); pNode; pNode = pNode->GetNext())
+		{
+			tRANGE Range = { pNode->uAddress, (pNode->uAddress + pNode->uSize) };
+			Gaps.push_back(Range);
+		}
+		SetBlob(Node, CHECKPOINT_GAPS, (Gaps.empty() ? NULL : &Gaps[0]), (Gaps.size() * sizeof(tRANGE)));
+		s_uGapsSaved = s_uGapsDone;
+		s_bGapsSaved = TRUE;
+		Cp.uGapsDone = 0;
+	}
+	Node.supset(0, &Cp, sizeof(Cp));
+
+	// The rest are small, rewritten each time
+	qvector<ea_t> Segments;
+	for(size_t i = 0; i < s_PlanSegs.size(); i++)
+		Segments.push_back(s_PlanSegs[i]->startEA);
+	SetBlob(Node, CHECKPOINT_SEGMENTS, (Segments.empty() ? NULL : &Segments[0]), (Segments.size() * sizeof(ea_t)));
+	SetBlob(Node, CHECKPOINT_RANGES, (s_RunRanges.empty() ? NULL : &s_RunRanges[0]), (s_RunRanges.size() * sizeof(tRANGE)));
+	SetBlob(Node, CHECKPOINT_FOLLOWUP, (s_FollowUp.empty() ? NULL : &s_FollowUp[0]), (s_FollowUp.size() * sizeof(tRANGE)));
+	SetBlob(Node, CHECKPOINT_FOLLOWUP2, (s_FollowUpNext.empty() ? NULL : &s_FollowUpNext[0]), (s_FollowUpNext.size() * sizeof(tRANGE)));
+
+	// The journal has to cover everything up to the checkpoint
+	JRN_Flush();
+	return(TRUE);
+}
+
+// Restore the run state from the IDB checkpoint, returns TRUE if it's ready to continue
+static BOOL ResumeCheckpoint()
+{
+	netnode Node(CHECKPOINT_NODE);
+	tCHECKPOINT Cp;
+	if((Node.supval(0, &Cp, sizeof(Cp)) != sizeof(Cp)) || (Cp.uVersion != CHECKPOINT_VERSION) || (Cp.uState < eSTATE_START) || (Cp.uState > eSTATE_PASS_5))
+	{
+		msg("** The checkpoint is not usable, starting over. **\n");
+		return(FALSE);
+	}
+	segment_t *pSeg = getseg(Cp.eaSegStart);
+	if(!pSeg || (pSeg->startEA != Cp.eaSegStart) || (pSeg->endEA != Cp.eaSegEnd))
+	{
+		msg("** The checkpoint segment is gone, starting over. **\n");
+		return(FALSE);
+	}
+
+	s_bDoDataToBytes = ((Cp.wOptionFlags & OPT_DATATOBYTES) != 0);
+	s_bDoAlignBlocks = ((Cp.wOptionFlags & OPT_ALIGNBLOCKS) != 0);
+	s_bDoMissingCode = ((Cp.wOptionFlags & OPT_MISSINGCODE) != 0);
+	s_bDoMissingFunc = ((Cp.wOptionFlags & OPT_MISSINGFUNC) != 0);
+	s_bDoBadBlocks   = ((Cp.wOptionFlags & OPT_BADBLOCKS) != 0);
+	s_bDoVftables    = ((Cp.wOptionFlags & OPT_VFTABLES) != 0);
+	s_wAudioAlertWhenDone = Cp.wAudioAlertWhenDone;
+	s_wFusedSweep    = Cp.wFusedSweep;
+	s_wUseCache      = Cp.wUseCache;
+	s_wDryRun        = 0;
+	s_wQuickPass     = 0;
+
+	s_thisSeg          = pSeg;
+	s_eaSegStart       = s_eaCodeStart = Cp.eaSegStart;
+	s_eaSegEnd         = s_eaCodeEnd   = Cp.eaSegEnd;
+	s_eaCurrentAddress = Cp.eaCurrentAddress;
+	s_eaLastAddress    = Cp.eaLastAddress;
+	s_iStartFuncCount  = Cp.iStartFuncCount;
+	s_iProgressSteps   = Cp.iProgressSteps;
+	s_iProgressStep    = Cp.iProgressStep;
+	s_iPass1Loops      = Cp.iPass1Loops;
+	s_uStep5Func       = Cp.uStep5Func;
+	s_uUnknowns        = Cp.uUnknowns;
+	s_uAligns          = Cp.uAligns;
+	s_uBlocksFixed     = Cp.uBlocksFixed;
+	s_uRelocTables     = Cp.uRelocTables;
+	s_uVftFuncs        = Cp.uVftFuncs;
+	s_uSwitchTables    = Cp.uSwitchTables;
+	s_uStubFuncs       = Cp.uStubFuncs;
+	s_uRunBytes        = Cp.uRunBytes;
+	s_uRunBytesDone    = Cp.uRunBytesDone;
+	s_bVftDone         = (BOOL) Cp.wVftDone;
+	TIMESTAMP Now = GetTimeStamp();
+	s_StartTime   = (Now - Cp.RunTime);
+	s_StepTime    = (Now - Cp.StepTime);
+	s_Steps13Time = Cp.Steps13Time;
+	CCH_ResetStats();
+
+	// Segments still to do, in the planned order
+	s_PlanSegs.clear();
+	size_t uSize = 0;
+	if(ea_t *pSegments = (ea_t *) Node.getblob(NULL, &uSize, 0, CHECKPOINT_SEGMENTS))
+	{
+		for(size_t i = 0; i < (uSize / sizeof(ea_t)); i++)
+		{
+			if(segment_t *pPlanned = getseg(pSegments[i]))
+				s_PlanSegs.push_back(pPlanned);
+		}
+		qfree(pSegments);
+	}
+	GetRanges(Node, CHECKPOINT_RANGES, s_RunRanges);
+	if(s_RunRanges.empty())
+	{
+		tRANGE Range = { s_eaSegStart, s_eaSegEnd };
+		s_RunRanges.push_back(Range);
+	}
+	IndexRunRanges();
+	qvector<area_t> Areas;
+	GetRunAreas(Areas);
+	CHK_Build(Areas);
+	SWI_Begin();
+
+	GetRanges(Node, CHECKPOINT_FOLLOWUP, s_FollowUp);
+	GetRanges(Node, CHECKPOINT_FOLLOWUP2, s_FollowUpNext);
+	s_uFollowUpIndex = min(Cp.uFollowUpIndex, s_FollowUp.size());
+
+	// Function gaps, less the ones done
+	FlushFunctionList();
+	s_uGapsDone = s_uGapsSaved = 0;
+	s_bGapsSaved = FALSE;
+	if(Cp.uState == eSTATE_PASS_4)
+	{
+		uSize = 0;
+		if(tRANGE *pGaps = (tRANGE *) Node.getblob(NULL, &uSize, 0, CHECKPOINT_GAPS))
+		{
+			s_uGapsTotal = (UINT) (uSize / sizeof(tRANGE));
+			for(size_t i = Cp.uGapsDone; i < s_uGapsTotal; i++)
+			{
+				if(tFUNCNODE *pNode = new tFUNCNODE())
+				{
+					pNode->uAddress = pGaps[i].startEA;
+					pNode->uSize    = (UINT) (pGaps[i].endEA - pGaps[i].startEA);
+
+					if(s_FuncList.IsEmpty())
+						s_FuncList.InsertHead(*pNode);
+					else
+						s_FuncList.InsertTail(*pNode);
+				}
+			}
+			qfree(pGaps);
+		}
+		s_uGapsDone = Cp.uGapsDone;
+		s_bGapsSaved = TRUE;
+	}
+
+	// The start state builds it
+	if(Cp.uState != eSTATE_START)
+		BuildRelocMap();
+
+	s_eState = (eSTATES) Cp.uState;
+	s_NextCheckpoint = (Now + CHECKPOINT_PERIOD);
+	JRN_BeginRun(TRUE); // Same run, rolled back as one
+	msg("Resuming segment %08X-%08X, state: %u, address: %08X.\n\n", s_eaSegStart, s_eaSegEnd, Cp.uState, s_eaCurrentAddress);
+	return(TRUE);
+}
+
+// Returns TRUE if the IDB has a checkpoint, the node alone can be left from a run
+// that stopped before the first save
+static BOOL HasCheckpoint()
+{
+	netnode Node(CHECKPOINT_NODE);
+	return((Node != BADNODE) && (Node.supval(0, NULL, 0) > 0));
+}
+
+// Remove the checkpoint, i.e. when the run finished
+static void KillCheckpoint()
+{
+	netnode Node(CHECKPOINT_NODE);
+	if(Node != BADNODE)
+		Node.kill();
+}
+
+// Pass 1, decide what to do with a data value in code space.
+// Returns TRUE if it was made unknown bytes.
+static BOOL FixDataItem(ea_t eaStart, ea_t eaEnd, flags_t Flags, BOOL bWait)
+{
+    // Skip if it has offset reference (most common occurance)
+    BOOL bSkip = FALSE;
+    ea_t eaDRef = ((Flags & FF_REF) ? get_first_dref_to(eaStart) : BADADDR);
+    if (Flags & FF_0OFF)
+    {
+        //msg("  skip offset.\n");
+        bSkip = TRUE;
+    }
+    else
+    // Switch table? Gets marked once, then left alone on following loops and runs
+    // Ahead of the relocation test, jump tables are relocated too
+    if ((Flags & FF_REF) && SWI_IsKnownTable(eaStart))
+        bSkip = TRUE;
+    else
+    if ((Flags & FF_REF) && (eaDRef != BADADDR) && isCode(getFlags(eaDRef)) && SWI_DecodeSwitch(eaDRef, s_eaCodeStart, s_eaCodeEnd))
+    {
+        //msg("%08X switch table.\n", eaStart);
+        s_uSwitchTables++;
+        bSkip = TRUE;
+    }
+    else
+    // Relocated at every dword, so absolute addresses (a pointer or a table)
+    if (IsRelocTable(eaStart, eaEnd))
+    {
+        // IDA missed making it an offset, fix it while we're here
+        if (isDwrd(Flags) && s_wDryRun)
+        {
+            PLN_Add(EDIT_OFFSETS, eaStart, (eaEnd - eaStart));
+            s_uRelocTables++;
+        }
+        else
+        if (isDwrd(Flags))
+        {
+            JRN_Range(eaStart, (eaEnd - eaStart));
+            if (op_offset(eaStart, 0, REF_OFF32))
+            {
+                //msg("%08X reloc offset.\n", eaStart);
+                s_uRelocTables++;
+            }
+        }
+        bSkip = TRUE;
+    }
+    else
+        // Has a reference?
+        if (Flags & FF_REF)
+        {
+            if (eaDRef != BADADDR)
+            {
+                // Ref part an offset?
+                flags_t ValueRef = getFlags(eaDRef);
+                if (isCode(ValueRef) && isOff1(ValueRef))
+                {
+                    // Decide instruction to global "cmd" struct
+                    BOOL bIsByteAccess = FALSE;
+                    if (decode_insn(eaDRef))
+                    {
+                        switch (cmd.itype)
+                        {
+                            // movxx style move a byte?
+                        case NN_movzx:
+                        case NN_movsx:
+                        {
+                            //msg("%08X movzx\n", eaStart);
+                            bIsByteAccess = TRUE;
+                        }
+                        break;
+
+                        case NN_mov:
+                        {
+                            if ((cmd.Operands[0].type == o_reg) && (cmd.Operands[1].dtyp == dt_byte))
+                            {
+                                //msg("%08X mov\n", eaStart);
+                                /*
+                                msg(" [0] T: %d, D: %d, \n", cmd.Operands[0].type, cmd.Operands[0].dtyp);
+                                msg(" [1] T: %d, D: %d, \n", cmd.Operands[1].type, cmd.Operands[1].dtyp);
+                                msg(" [2] T: %d, D: %d, \n", cmd.Operands[2].type, cmd.Operands[2].dtyp);
+                                msg(" [3] T: %d, D: %d, \n", cmd.Operands[3].type, cmd.Operands[3].dtyp);
+                                */
+                                bIsByteAccess = TRUE;
+                            }
+                        }
+                        break;
+                        };
+                    }
+
+                    // If it's byte access, assume it's a byte switch table
+                    if (bIsByteAccess && s_wDryRun)
+                    {
+                        PLN_Add(EDIT_BYTES, eaStart, (eaEnd - eaStart));
+                        bSkip = TRUE;
+                    }
+                    else
+                    if (bIsByteAccess)
+                    {
+                        //msg("%08X not byte\n", eaStart);
+                        if (bWait) autoWait();
+                        JRN_Range(eaStart, (eaEnd - eaStart));
+                        do_unknown(eaStart, DOUNK_SIMPLE);
+                        auto_mark_range(eaStart, eaEnd, AU_UNK);
+                        if (bWait) autoWait();
+                        // Step through making the array, and any bad size a byte
+                        //for(ea_t i = eaStart; i < eaEnd; i++){ doByte(i, 1); }
+                        doByte(eaStart, (eaEnd - eaStart));
+                        if (bWait) autoWait();
+                        bSkip = TRUE;
+                    }
+                }
+            }
+        }
+
+    // Make it unknown bytes
+    if (!bSkip && s_wDryRun)
+    {
+        PLN_Add(EDIT_UNDEFINE, eaStart, (eaEnd - eaStart));
+        s_uUnknowns++;
+        return(TRUE);
+    }
+    else
+    if (!bSkip)
+    {
+        //msg("%08X %08X %02X unknown\n", eaStart, eaEnd, getFlags(eaStart));
+        if (bWait) autoWait();
+        JRN_Range(eaStart, (eaEnd - eaStart));
+        do_unknown(eaStart, DOUNK_SIMPLE);
+        for (ea_t i = (eaStart + 1); i < eaEnd; i++){ do_unknown(i, DOUNK_SIMPLE); }
+        if (bWait) autoWait();
+        auto_mark_range(eaStart, eaEnd, AU_UNK);
+        s_uUnknowns++;
+        if (bWait) autoWait();
+
+        // Note: Might have triggered auto-analysis and a alignment or function could be here now
+        return(TRUE);
+    }
+
+    return(FALSE);
+}
+
+// Pass 2, try to make an align block from a run of align bytes.
+// Returns the address after the run.
+// If "pbDeferred" is given, short runs that need a code ref test are not tried, but flagged instead.
+static ea_t FixAlignRun(ea_t eaStartAddress, ea_t endEA, BOOL *pbDeferred)
+{
+    if (pbDeferred) *pbDeferred = FALSE;
+
+    // Get run count of this align byte
+    UINT uAlignByteCount = 1;
+    flags_t StartAlignValue = getFlags(eaStartAddress);
+    ea_t eaCurrent = eaStartAddress, eaLast = eaStartAddress;
+
+    while (TRUE)
+    {
+        // Next byte
+        eaCurrent = nextaddr(eaCurrent);
+        //msg("%08X  Next.\n", eaCurrent);
+        //msg("%08X  F: %08X.\n", eaCurrent, getFlags(eaCurrent));
+
+        if (eaCurrent < endEA)
+        {
+            // Catch when we get caught up in an array, etc.
+            if (eaCurrent <= eaLast)
+            {
+                msg("%08X F: %08X *** Align test in array #2 ***\n", eaStartAddress);
+                eaCurrent = eaLast = nextaddr(eaCurrent);
+                break;
+            }
+            eaLast = eaCurrent;
+
+            // Count if it' still the same byte
+            if (getFlags(eaCurrent) == StartAlignValue)
+                uAlignByteCount++;
+            else
+                break;
+        }
+        else
+            break;
+    };
+
+    // Do these bytes bring about at least a 16 (could be 32) align?
+    // TODO: Must we consider other alignments such as 4 and 8?
+    //       Probably a compiler option that is not normally used anymore.
+    if (((eaStartAddress + uAlignByteCount) & (16 - 1)) == 0)
+    {
+        // If short count, only try alignment if the line above or a below us has n xref
+        // We don't want to try to align odd code and switch table bytes, etc.
+        if (uAlignByteCount <= 2)
+        {
+            // Refs might not be there yet, let the caller try it again after the auto-analysis
+            if (pbDeferred)
+            {
+                *pbDeferred = TRUE;
+                return(eaCurrent);
+            }
+
+            BOOL bHasRef = FALSE;
+
+            // Before us
+            ea_t eaEndAddress = (eaStartAddress + uAlignByteCount);
+            ea_t eaRef = get_first_cref_from(eaEndAddress);
+            if (eaRef != BADADDR)
+            {
+                //msg("%08X cref from end.\n", eaEndAddress);
+                bHasRef = TRUE;
+            }
+            else
+            {
+                eaRef = get_first_cref_to(eaEndAddress);
+                if (eaRef != BADADDR)
+                {
+                    //msg("%08X cref to end.\n", eaEndAddress);
+                    bHasRef = TRUE;
+                }
+            }
+
+            // After us
+            if (eaRef == BADADDR)
+            {
+                ea_t eaForeAddress = (eaStartAddress - 1);
+                eaRef = get_first_cref_from(eaForeAddress);
+                if (eaRef != BADADDR)
+                {
+                    //msg("%08X cref from start.\n", eaForeAddress);
+                    bHasRef = TRUE;
+                }
+                else
+                {
+                    eaRef = get_first_cref_to(eaForeAddress);
+                    if (eaRef != BADADDR)
+                    {
+                        //msg("%08X cref to start.\n", eaForeAddress);
+                        bHasRef = TRUE;
+                    }
+                }
+            }
+
+            // No code ref, now look for a broken code ref
+            if (eaRef == BADADDR)
+            {
+                // This is still not complete as it could still be code, but pointing to a vftable
+                // entry in data.
+                // But should be fixed on more passes.
+                ea_t eaEndAddress = (eaStartAddress + uAlignByteCount);
+                eaRef = get_first_dref_from(eaEndAddress);
+                if (eaRef != BADADDR)
+                {
+                    // If it the ref points to code assume code is just broken here
+                    if (isCode(getFlags(eaRef)))
+                    {
+                        //msg("%08X dref from end %08X.\n", eaRef, eaEndAddress);
+                        bHasRef = TRUE;
+                    }
+                }
+                else
+                {
+                    eaRef = get_first_dref_to(eaEndAddress);
+                    if (eaRef != BADADDR)
+                    {
+                        if (isCode(getFlags(eaRef)))
+                        {
+                            //msg("%08X dref to end %08X.\n", eaRef, eaEndAddress);
+                            bHasRef = TRUE;
+                        }
+                    }
+                }
+
+                if (eaRef == BADADDR)
+                {
+                    //msg("%08X NO REF.\n", eaStartAddress);
+                }
+            }
+
+            // Assume it's not an alignment byte(s) and bail out
+            if (!bHasRef) return(eaCurrent);
+        }
+
+        // Attempt to make it an align block
+        if (s_wDryRun)
+        {
+            PLN_Add(EDIT_ALIGN, eaStartAddress, uAlignByteCount);
+            s_uAligns++;
+            return(eaCurrent);
+        }
+        JRN_Range(eaStartAddress, uAlignByteCount);
+        bool bResult = doAlign(eaStartAddress, uAlignByteCount, 0);
+        // IDA will some times fail on 32 aligns for some reason, give it another try
+        if (!bResult)
+        {
+            // Try again with explicit limits
+            bResult = doAlign(eaStartAddress, uAlignByteCount, 32);
+            if (!bResult)
+                bResult = doAlign(eaStartAddress, uAlignByteCount, 16);
+        }
+
+        if (bResult)
+        {
+            //msg("%08X %d ALIGN.\n", eaStartAddress, uAlignByteCount);
+            s_uAligns++;
+        }
+        else
+        {
+            // There are several times will IDA will fail even when the alignment block is obvious.
+            // Usually when it's an ALIGN(32) and there is a run of 16 align bytes
+            // Could at least do a code analize on it. Then IDA will at least make a mini array of it
+            //msg("%08X %d ** align fail **\n", eaStartAddress, uAlignByteCount);
+            //s_uAlignFails++;
+        }
+    }
+
+    return(eaCurrent);
+}
+
+// Queue a range to look at again in the next fused sweep round
+static void QueueFollowUp(ea_t startEA, ea_t endEA)
+{
+	// Mostly in address order, so merge with the last when they touch
+	if(!s_FollowUpNext.empty() && (startEA <= s_FollowUpNext.back().endEA) && (startEA >= s_FollowUpNext.back().startEA))
+	{
+		if(endEA > s_FollowUpNext.back().endEA)
+			s_FollowUpNext.back().endEA = endEA;
+	}
+	else
+	{
+		tRANGE Range = { startEA, endEA };
+		s_FollowUpNext.push_back(Range);
+	}
+}
+
+// One step of the fused pass 1 to 3 sweep, returns the next address to look at.
+// Changes that the auto-analysis will act on are queued for the follow up rounds instead of waiting on them.
+static ea_t FusedStep(ea_t ea, ea_t eaLimit, BOOL bDefer)
+{
+	flags_t Flags = getFlags(ea);
+
+	// Pass 1, stray data values
+	if(IsData(Flags, NULL))
+	{
+		ea_t eaEnd = next_head(ea, eaLimit);
+		if(eaEnd == BADADDR)
+			return(eaLimit);
+
+		if(s_bDoDataToBytes && FixDataItem(ea, eaEnd, Flags, FALSE))
+			QueueFollowUp(ea, eaEnd);
+		return(eaEnd);
+	}
+	else
+	// Pass 2, align byte runs
+	if(s_bDoAlignBlocks && IsAlignByte(Flags, NULL))
+	{
+		BOOL bDeferred = FALSE;
+		ea_t eaNext = FixAlignRun(ea, eaLimit, (bDefer ? &bDeferred : NULL));
+		if(bDeferred)
+			QueueFollowUp(ea, eaNext);
+		return(eaNext);
+	}
+
+	// Pass 3 is only a walk over the unknown bytes, nothing more to do for them here
+	return(nextthat(ea, eaLimit, IsFusedItem, NULL));
+}
+
+// Build the segment relocation bitmap
+// IDA's PE loader turns the ".reloc" directory into fixups, each one the location of an absolute address.
+// With it pass 1 can tell if a value is a pointer with a single bit test instead of looking at the refs.
+// The fixups don't change with the passes, so a map is kept for the following runs.
+static void BuildRelocMap(BOOL bQuiet)
+{
+	FlushRelocMap();
+
+	for(size_t i = 0; i < s_RelocMaps.size(); i++)
+	{
+		if((s_RelocMaps[i].startEA == s_eaCodeStart) && (s_RelocMaps[i].endEA == s_eaCodeEnd))
+		{
+			if((s_pRelocMap = s_RelocMaps[i].pMap) && !bQuiet)
+				msg("Relocations: %u (cached)\n", s_RelocMaps[i].uCount);
+			return;
+		}
+	}
+
+	// Over the memory budget the other segments' maps go first, then this one does without
+	UINT uMapSize = (UINT) (((s_eaCodeEnd - s_eaCodeStart) + 7) / 8);
+	if(MemOverBudget(uMapSize))
+		FreeRelocMaps();
+	if(MemOverBudget(uMapSize))
+	{
+		if(!bQuiet)
+			msg("Relocations: looked up, over the memory budget for a map.\n");
+		s_bRelocLookup = TRUE;
+		return;
+	}
+	BYTE *pMap = (BYTE *) MemAlloc(MEM_RELOCS, uMapSize);
+	if(!pMap)
+		return;
+	ZeroMemory(pMap, uMapSize);
+
+	UINT uCount = 0;
+	for(ea_t ea = get_next_fixup_ea(s_eaCodeStart - 1); (ea != BADADDR) && (ea < s_eaCodeEnd); ea = get_next_fixup_ea(ea))
+	{
+		fixup_data_t fd;
+		if((ea >= s_eaCodeStart) && get_fixup(ea, &fd) && ((fd.type & FIXUP_MASK) == FIXUP_OFF32))
+		{
+			UINT uIndex = (UINT) (ea - s_eaCodeStart);
+			pMap[uIndex >> 3] |= (BYTE) (1 << (uIndex & 7));
+			uCount++;
+		}
+	};
+
+	// Not a relocatable image, fall back to the flag tests
+	if(uCount == 0)
+	{
+		MemFree(MEM_RELOCS, pMap, uMapSize);
+		pMap = NULL;
+	}
+	else
+	if(!bQuiet)
+		msg("Relocations: %u\n", uCount);
+
+	tRELOCMAP Map = { s_eaCodeStart, s_eaCodeEnd, pMap, uCount };
+	s_RelocMaps.push_back(Map);
+	s_pRelocMap = pMap;
+}
+
+// Done with the segment's relocation bitmap, the map itself stays cached
+static void FlushRelocMap()
+{
+	s_pRelocMap = NULL;
+	s_bRelocLookup = FALSE;
+}
+
+// Free the cached relocation bitmaps
+static void FreeRelocMaps()
+{
+	FlushRelocMap();
+	for(size_t i = 0; i < s_RelocMaps.size(); i++)
+		MemFree(MEM_RELOCS, s_RelocMaps[i].pMap, (size_t) (((s_RelocMaps[i].endEA - s_RelocMaps[i].startEA) + 7) / 8));
+	s_RelocMaps.clear();
+}
+
+// IDB change notifications, drop what the change makes stale in the resident caches
+static int idaapi IdbCallback(void *pUserData, int iNotificationCode, va_list va)
+{
+	switch(iNotificationCode)
+	{
+		// Bytes changed, segment hashes and vftable scan results
+		case idb_event::byte_patched:
+		{
+			ea_t ea = va_arg(va, ea_t);
+			CCH_Invalidate(ea);
+			VFT_Invalidate();
+		}
+		break;
+
+		// Layout changed, everything
+		case idb_event::segm_added:
+		case idb_event::segm_deleted:
+		case idb_event::segm_start_changed:
+		case idb_event::segm_end_changed:
+		case idb_event::segm_moved:
+		case idb_event::allsegs_moved:
+		{
+			// Not in the middle of a run, it's using the current map
+			if(s_eState == eSTATE_INIT)
+				FreeRelocMaps();
+			CCH_Invalidate(BADADDR);
+			VFT_Invalidate();
+		}
+		break;
+	};
+
+	return(0);
+}
+
+// Returns TRUE if a 32 bit relocation starts at the address
+static BOOL RelocAt(ea_t ea)
+{
+	if(s_pRelocMap)
+	{
+		if((ea < s_eaCodeStart) || (ea >= s_eaCodeEnd))
+			return(FALSE);
+		UINT i = (UINT) (ea - s_eaCodeStart);
+		return((s_pRelocMap[i >> 3] & (1 << (i & 7))) != 0);
+	}
+	else
+	if(s_bRelocLookup)
+	{
+		// The same test through IDA's fixups
+		fixup_data_t fd;
+		return(get_fixup(ea, &fd) && ((fd.type & FIXUP_MASK) == FIXUP_OFF32));
+	}
+
+	return(FALSE);
+}
+
+// Returns TRUE if the range is all relocated dwords, a pointer or a table of them.
+// Code made into data has relocated operands here and there, those don't count.
+static BOOL IsRelocTable(ea_t eaStart, ea_t eaEnd)
+{
+	if((eaEnd <= eaStart) || ((eaEnd - eaStart) % 4) || (!s_pRelocMap && !s_bRelocLookup))
+		return(FALSE);
+	for(ea_t ea = eaStart; ea < eaEnd; ea += 4)
+	{
+		if(!RelocAt(ea))
+			return(FALSE);
+	}
+	return(TRUE);
+}
+
+// Returns TRUE if flag byte is possibly a typical alignment byte
 static bool idaapi IsAlignByte(flags_t flags, void *ud)
 {
 	if((flags == ALIGN_VALUE1) || (flags == ALIGN_VALUE2))
@@ -1304,6 +2636,12 @@ static bool idaapi IsData(flags_t flags, void *ud)
 	return(!isAlign(flags) && isData(flags));
 }
 
+// Return if flag is of interest to the fused sweep
+static bool idaapi IsFusedItem(flags_t flags, void *ud)
+{
+	return(IsData(flags, ud) || (s_bDoAlignBlocks && IsAlignByte(flags, ud)));
+}
+
 
 
 /*
@@ -1362,38 +2700,47 @@ static BOOL TryFunction(ea_t CodeStartEA, ea_t CodeEndEA, ea_t &rCurEA)
 	BOOL bResult = FALSE;
 
 	autoWait();
-	#ifdef LOG_FILE
-	Log(s_hLogFile, "%08X %08X Trying function.\n", CodeStartEA, rCurEA);
-	#endif
+	LOG(LOGC_FUNCS, "%08X %08X Trying function.\n", CodeStartEA, rCurEA);
 	//msg("%08X %08X Trying function.\n", CodeStartEA, rCurEA);
 
 	/// *** Don't use "get_func()" it has a bug, use "get_fchunk()" instead ***
 
 	// Could belong as a chunk to an existing function already or already a function here recovered already between steps.
-	if(func_t *pFunc = get_fchunk(CodeStartEA))
+	// The chunk map knows without a trip into the kernel.
+	ea_t eaChunkEnd;
+	ea_t eaOwner = CHK_Owner(CodeStartEA, &eaChunkEnd);
+	if(eaOwner != BADADDR)
 	{
-  		#ifdef LOG_FILE
-		Log(s_hLogFile, "  %08X %08X %08X F: %08X already function.\n", pFunc->endEA, pFunc->startEA, CodeStartEA, getFlags(CodeStartEA));
-		#endif
-		//msg("  %08X %08X %08X F: %08X already function.\n", pFunc->endEA, pFunc->startEA, CodeStartEA, getFlags(CodeStartEA));
-		rCurEA = prev_head(pFunc->endEA, CodeStartEA); // Advance to end of the function -1 location (for a follow up "next_head()")
+		LOG(LOGC_FUNCS, "  %08X %08X %08X F: %08X already function.\n", eaChunkEnd, eaOwner, CodeStartEA, getFlags(CodeStartEA));
+		//msg("  %08X %08X %08X F: %08X already function.\n", eaChunkEnd, eaOwner, CodeStartEA, getFlags(CodeStartEA));
+		rCurEA = prev_head(eaChunkEnd, CodeStartEA); // Advance to end of the function -1 location (for a follow up "next_head()")
 		bResult = TRUE;
 	}
 	else
+	if(s_wDryRun)
+	{
+		// Plan it if IDA can find the bounds without making anything, then skip over it the same way
+		func_t Func;
+		Func.startEA = CodeStartEA;
+		if(find_func_bounds(CodeStartEA, &Func, FIND_FUNC_NORMAL) == FIND_FUNC_OK)
+		{
+			PLN_Add(EDIT_FUNC, CodeStartEA, 0);
+			rCurEA = prev_head(Func.endEA, CodeStartEA);
+			bResult = TRUE;
+		}
+	}
+	else
 	{
 		// Try function here
 		if(add_func(CodeStartEA, BADADDR))
 		{
+			JRN_AddFunc(CodeStartEA);
+
 			// Wait till IDA is done possibly creating the function, then get it's info
 			autoWait();
 			if(func_t *pFunc = get_fchunk(CodeStartEA)) // get_func
 			{
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "  %08X function success.\n", CodeStartEA);
-				#endif
-				#ifdef VBDEV
-				msg("  %08X function success.\n", CodeStartEA);
-				#endif
+				LOG(LOGC_FUNCS, "  %08X function success.\n", CodeStartEA);
 
 				// Look at function tail instruction
 				autoWait();
@@ -1434,6 +2781,7 @@ static BOOL TryFunction(ea_t CodeStartEA, ea_t CodeEndEA, ea_t &rCurEA)
 							{
 								// Try to make it an align
 								autoWait();
+								JRN_Range(tailEA, 1);
 								do_unknown(tailEA, DOUNK_SIMPLE);
 								autoWait();
 								if(!doAlign(tailEA, 1, 0))
@@ -1503,10 +2851,8 @@ static BOOL TryFunction(ea_t CodeStartEA, ea_t CodeEndEA, ea_t &rCurEA)
 						msg("%08X \"%s\" problem? <click me>\n", tailEA, szName);
 						//msg("  T: %d\n", cmd.itype);
 
-						#ifdef LOG_FILE
-						Log(s_hLogFile, "%08X \"%s\" problem? <click me>\n", tailEA, szName);
-						//Log(s_hLogFile, "  T: %d\n", cmd.itype);
-						#endif
+						LOG(LOGC_ERRORS, "%08X \"%s\" problem? <click me>\n", tailEA, szName);
+						//LOG(LOGC_ERRORS, "  T: %d\n", cmd.itype);
 					}
 				}
 
@@ -1529,12 +2875,10 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 	ea_t endEA = (startEA + uSize);
 	ea_t CodeStartEA  = BADADDR;
 
-	#ifdef LOG_FILE
-	Log(s_hLogFile, "\nS: %08X, E: %08X ==== PFG START ====\n", startEA, endEA);
-	#endif
-	#ifdef VBDEV
-	msg("\n%08X %08X ==== Gap ====\n", startEA, endEA);
-	#endif
+	LOG(LOGC_GAPS, "\nS: %08X, E: %08X ==== PFG START ====\n", startEA, endEA);
+
+	// Runs of script bind stubs et al, all made in one batch
+	s_uStubFuncs += STB_CreateStubRuns(startEA, endEA, s_eaCodeStart, s_eaCodeEnd);
 
     // Traverse gap
 	autoWait();
@@ -1542,25 +2886,17 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
     {
 		// Info flags for this address
 		flags_t uFlags = getFlags(curEA);
-		#ifdef LOG_FILE
-		Log(s_hLogFile, "  C: %08X, F: %08X, \"%s\".\n", curEA, uFlags, GetDisasmText(curEA));
-		#endif
-		#ifdef VBDEV
-		msg(" C: %08X, F: %08X, \"%s\".\n", curEA, uFlags, GetDisasmText(curEA));
-		#endif
+		// The disassembly text is only made when the line is logged
+		LOG(LOGC_WALK, "  C: %08X, F: %08X, \"%s\".\n", curEA, uFlags, GetDisasmText(curEA));
 
 		if(curEA < startEA)
 		{
-			#ifdef LOG_FILE
-			Log(s_hLogFile, "**** Out of start range! %08X %08X %08X ****\n", curEA, startEA, endEA);
-			#endif
+			LOG(LOGC_ERRORS, "**** Out of start range! %08X %08X %08X ****\n", curEA, startEA, endEA);
 			return;
 		}
 		if(curEA > endEA)
 		{
-			#ifdef LOG_FILE
-			Log(s_hLogFile, "**** Out of end range! %08X %08X %08X ****\n", curEA, startEA, endEA);
-			#endif
+			LOG(LOGC_ERRORS, "**** Out of end range! %08X %08X %08X ****\n", curEA, startEA, endEA);
 			return;
 		}
 
@@ -1571,12 +2907,7 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 			// Function between code start?
 			if(CodeStartEA != BADADDR)
 			{
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "  %08X Trying function #1\n", CodeStartEA);
-				#endif
-				#ifdef VBDEV
-				msg("  %08X Trying function #1\n", CodeStartEA);
-				#endif
+				LOG(LOGC_FUNCS, "  %08X Trying function #1\n", CodeStartEA);
 				TryFunction(CodeStartEA, endEA, curEA);
 			}
 
@@ -1589,12 +2920,7 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 			// Function between code start?
 			if(CodeStartEA != BADADDR)
 			{
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "  %08X Trying function #2\n", CodeStartEA);
-				#endif
-				#ifdef VBDEV
-				msg("  %08X Trying function #2\n", CodeStartEA);
-				#endif
+				LOG(LOGC_FUNCS, "  %08X Trying function #2\n", CodeStartEA);
 				TryFunction(CodeStartEA, endEA, curEA);
 			}
 
@@ -1609,12 +2935,7 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 			{
 				CodeStartEA  = curEA;
 
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "  %08X Trying function #3, assumed func start\n", CodeStartEA);
-				#endif
-				#ifdef VBDEV
-				msg("  %08X Trying function #3, assumed func start\n", CodeStartEA);
-				#endif
+				LOG(LOGC_FUNCS, "  %08X Trying function #3, assumed func start\n", CodeStartEA);
 				if(TryFunction(CodeStartEA, endEA, curEA))
 					CodeStartEA = BADADDR;
 			}
@@ -1624,22 +2945,12 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 		// Usually 0xCC align bytes
 		if(isUnknown(uFlags))
 		{
-			#ifdef LOG_FILE
-			Log(s_hLogFile, "  C: %08X, Unknown type.\n", curEA);
-			#endif
-			#ifdef VBDEV
-			msg("  C: %08X, Unknown type.\n", curEA);
-			#endif
+			LOG(LOGC_WALK, "  C: %08X, Unknown type.\n", curEA);
 			CodeStartEA = BADADDR;
 		}
 		else
 		{
-			#ifdef LOG_FILE
-			Log(s_hLogFile, "  %08X ** unknown data type! **\n", curEA);
-			#endif
-			#ifdef VBDEV
-			msg("  %08X ** unknown data type! **\n", curEA);
-			#endif
+			LOG(LOGC_ERRORS, "  %08X ** unknown data type! **\n", curEA);
 			CodeStartEA = BADADDR;
 		}
 
@@ -1658,22 +2969,12 @@ static void ProcessFuncGap(ea_t startEA, UINT uSize)
 			// If have code and at the end, try a function from the start
 			if(CodeStartEA != BADADDR)
 			{
-				#ifdef LOG_FILE
-				Log(s_hLogFile, "  %08X Trying function #4\n", CodeStartEA);
-				#endif
-				#ifdef VBDEV
-				msg("  %08X Trying function #4\n", CodeStartEA);
-				#endif
+				LOG(LOGC_FUNCS, "  %08X Trying function #4\n", CodeStartEA);
 				TryFunction(CodeStartEA, endEA, curEA);
 				autoWait();
 			}
 
-			#ifdef LOG_FILE
-			Log(s_hLogFile, " Gap end: %08X.\n", curEA);
-			#endif
-			#ifdef VBDEV
-			msg(" Gap end: %08X.\n", curEA);
-			#endif
+			LOG(LOGC_GAPS, " Gap end: %08X.\n", curEA);
 
             break;
 		}
@@ -1787,12 +3088,19 @@ static int FixFuncBlock(ea_t eaBlock)
 
 	// Remove possible function assumption for the block
 	autoWait();
-	if(del_func(eaBlock))
-		autoWait();
+	if(s_wDryRun)
+		PLN_Add(EDIT_DELFUNC, eaBlock, 0);
+	else
+	{
+		JRN_DelFunc(eaBlock);
+		if(del_func(eaBlock))
+			autoWait();
 
-	// Remove possible function to let IDA auto-name as it a branch label
-	if(set_name(eaBlock, "", SN_AUTO))
-		autoWait();
+		// Remove possible function to let IDA auto-name as it a branch label
+		JRN_Name(eaBlock);
+		if(set_name(eaBlock, "", SN_AUTO))
+			autoWait();
+	}
 
 	// Locate the owner function(s) to the block
 	// Almost always one ref, typically only small percent will have more then one ref
@@ -1803,25 +3111,39 @@ static int FixFuncBlock(ea_t eaBlock)
 	ea_t eaBlockRef = get_first_cref_to(eaBlock);
 	while(eaBlockRef != BADADDR)
 	{
-		if(func_t *pOwnerFunc = get_func(eaBlockRef))
+		ea_t eaOwner = CHK_Owner(eaBlockRef);
+		if(eaOwner != BADADDR)
 		{
 			iOwners++;
 
 			// Ignore if we've seen handled this function already
-			ea_t eaOwner = pOwnerFunc->startEA;
-			if(KnownSet.find(eaOwner) == KnownSet.end())
+			if(!KnownSet.Find(eaOwner))
 			{
-				KnownSet.insert(eaOwner);
-				if(append_func_tail(pOwnerFunc, eaBlock, eaBlockEnd))
+				KnownSet.Insert(eaOwner);
+				if(s_wDryRun)
 				{
-					//msg("%08X Owner append.\n", eaOwner);
-					iFixCount++;
-					autoWait();
+					// The block is still its own function here
+					if(eaOwner != eaBlock)
+					{
+						PLN_Add(EDIT_TAIL, eaBlock, (eaBlockEnd - eaBlock), eaOwner);
+						iFixCount++;
+					}
 				}
 				else
+				if(func_t *pOwnerFunc = get_func(eaOwner))
 				{
-					// Fails simply because the block is probably already connected to the function
-					//msg("  ** Failed to append tail block %08X to function %08X! **\n", eaBlock, eaOwner);
+					if(append_func_tail(pOwnerFunc, eaBlock, eaBlockEnd))
+					{
+						//msg("%08X Owner append.\n", eaOwner);
+						JRN_Tail(eaOwner, eaBlock, eaBlockEnd);
+						iFixCount++;
+						autoWait();
+					}
+					else
+					{
+						// Fails simply because the block is probably already connected to the function
+						//msg("  ** Failed to append tail block %08X to function %08X! **\n", eaBlock, eaOwner);
+					}
 				}
 			}
 		}
@@ -1834,3 +3156,258 @@ static int FixFuncBlock(ea_t eaBlock)
 
 	return(iFixCount);
 }
+
+
+// =========================================================================================================
+// Background incremental mode
+// Changes made by hand after a run are collected as dirty ranges, then looked at with the step 1 to 3
+// heuristics and a light missing function check while IDA is idle, a few milliseconds per timer tick.
+// No waits on the auto-analysis here, it catches up between the ticks.
+// =========================================================================================================
+
+// Add a changed range to the dirty set, merged with the ones it touches
+static void AddDirty(ea_t startEA, ea_t endEA)
+{
+	if(s_bInSlice || (s_eState != eSTATE_INIT))
+		return;
+	segment_t *pSeg = getseg(startEA);
+	if(!pSeg || (pSeg->type != SEG_CODE))
+		return;
+	startEA = (((startEA - pSeg->startEA) > DIRTY_MARGIN) ? (startEA - DIRTY_MARGIN) : pSeg->startEA);
+	endEA   = min(pSeg->endEA, (max(endEA, (startEA + 1)) + DIRTY_MARGIN));
+
+	// First range that ends at or after the start
+	size_t uLow = 0, uHigh = s_Dirty.size();
+	while(uLow < uHigh)
+	{
+		size_t uMid = ((uLow + uHigh) / 2);
+		if(s_Dirty[uMid].endEA < startEA)
+			uLow = (uMid + 1);
+		else
+			uHigh = uMid;
+	};
+
+	size_t uLast = uLow;
+	while((uLast < s_Dirty.size()) && (s_Dirty[uLast].startEA <= endEA))
+	{
+		startEA = min(startEA, s_Dirty[uLast].startEA);
+		endEA   = max(endEA, s_Dirty[uLast].endEA);
+		uLast++;
+	};
+
+	tRANGE Range = { startEA, endEA };
+	if(uLast > uLow)
+	{
+		s_Dirty[uLow] = Range;
+		s_Dirty.erase((s_Dirty.begin() + (uLow + 1)), (s_Dirty.begin() + uLast));
+	}
+	else
+	{
+		s_Dirty.insert((s_Dirty.begin() + uLow), Range);
+		MemTrackVector(MEM_BACKGROUND, s_Dirty, s_uDirtyMem);
+	}
+}
+
+// Processor notifications for the changes that can open new gaps
+static int idaapi IdpCallback(void *pUserData, int iNotificationCode, va_list va)
+{
+	switch(iNotificationCode)
+	{
+		case processor_t::add_func:
+		case processor_t::del_func:
+		{
+			func_t *pFunc = va_arg(va, func_t *);
+			AddDirty(pFunc->startEA, pFunc->endEA);
+		}
+		break;
+
+		case processor_t::undefine:
+		{
+			ea_t ea = va_arg(va, ea_t);
+			AddDirty(ea, get_item_end(ea));
+		}
+		break;
+
+		case processor_t::make_code:
+		{
+			ea_t ea = va_arg(va, ea_t);
+			asize_t Size = va_arg(va, asize_t);
+			AddDirty(ea, (ea + Size));
+		}
+		break;
+	};
+
+	return(0);
+}
+
+// Set the segment bounds and relocation map the steps use for "ea", returns FALSE if it's not in one
+static BOOL UseSegmentOf(ea_t ea)
+{
+	segment_t *pSeg = getseg(ea);
+	if(!pSeg)
+		return(FALSE);
+	if((pSeg->startEA != s_eaCodeStart) || (pSeg->endEA != s_eaCodeEnd) || (!s_pRelocMap && !s_bRelocLookup))
+	{
+		s_eaSegStart = s_eaCodeStart = pSeg->startEA;
+		s_eaSegEnd   = s_eaCodeEnd   = pSeg->endEA;
+		BuildRelocMap(TRUE);
+	}
+	return(TRUE);
+}
+
+// Returns TRUE if there's background work left
+static BOOL BackgroundPending()
+{
+	return(!s_Dirty.empty() || (s_eaBgCurrent < s_BgRange.endEA) || (s_iBgPhase == 0));
+}
+
+// Work on the dirty ranges for up to a time slice
+static void BackgroundSlice()
+{
+	// The steps as they were when background mode went on, and never a dry run
+	// The shared step code looks at these, they're put back after
+	BOOL bDoDataToBytes = s_bDoDataToBytes, bDoAlignBlocks = s_bDoAlignBlocks;
+	WORD wDryRun = s_wDryRun;
+	s_bDoDataToBytes = s_bBgDataToBytes;
+	s_bDoAlignBlocks = s_bBgAlignBlocks;
+	s_wDryRun = 0;
+
+	s_bInSlice = TRUE;
+	JRN_BeginRun(TRUE);
+	SWI_Begin();
+	int iStartFuncCount = get_func_qty();
+	UINT uStartFixes = (s_uUnknowns + s_uAligns + s_uRelocTables + s_uSwitchTables);
+	TIMESTAMP EndTime = (GetTimeStamp() + BACKGROUND_SLICE);
+
+	// A run in between may have left other segment bounds
+	if((s_eaBgCurrent < s_BgRange.endEA) && !UseSegmentOf(s_BgRange.startEA))
+		s_eaBgCurrent = s_BgRange.endEA;
+
+	do
+	{
+		// Next range
+		if(s_eaBgCurrent >= s_BgRange.endEA)
+		{
+			if(s_iBgPhase == 0)
+			{
+				// Then the function check over the same range
+				s_iBgPhase = 1;
+				s_eaBgCurrent = s_BgRange.startEA;
+				continue;
+			}
+			if(s_Dirty.empty())
+				break;
+
+			s_BgRange = s_Dirty.front();
+			s_Dirty.erase(s_Dirty.begin());
+			s_eaBgCurrent = s_BgRange.startEA;
+			s_iBgPhase = 0;
+			s_uBgRanges++;
+			if(!UseSegmentOf(s_BgRange.startEA))
+			{
+				s_eaBgCurrent = s_BgRange.endEA;
+				s_iBgPhase = 1;
+				continue;
+			}
+		}
+
+		if(s_iBgPhase == 0)
+			s_eaBgCurrent = FusedStep(s_eaBgCurrent, s_BgRange.endEA, FALSE);
+		else
+		{
+			// Code no flow reaches that's not in a function, the start of a missing one
+			flags_t Flags = getFlags(s_eaBgCurrent);
+			BOOL bAdded = FALSE;
+			if(isCode(Flags) && !isFlow(Flags) && !get_func(s_eaBgCurrent) && add_func(s_eaBgCurrent, BADADDR))
+			{
+				JRN_AddFunc(s_eaBgCurrent);
+				bAdded = TRUE;
+			}
+
+			ea_t eaNext = next_head(s_eaBgCurrent, s_BgRange.endEA);
+			s_eaBgCurrent = ((eaNext != BADADDR) ? eaNext : s_BgRange.endEA);
+
+			// A new function is the slow part, and it queues analysis that should run
+			// before the next slice, so it's one per slice at most
+			if(bAdded)
+				break;
+		}
+	} while(GetTimeStamp() < EndTime);
+
+	// Nothing uses the follow up queue outside a run
+	s_FollowUpNext.clear();
+	s_uBgChanges += (((s_uUnknowns + s_uAligns + s_uRelocTables + s_uSwitchTables) - uStartFixes) + max(0, (get_func_qty() - iStartFuncCount)));
+	JRN_EndRun();
+	s_bInSlice = FALSE;
+	s_bDoDataToBytes = bDoDataToBytes;
+	s_bDoAlignBlocks = bDoAlignBlocks;
+	s_wDryRun = wDryRun;
+
+	// Caught up, say what was done
+	if(!BackgroundPending())
+	{
+		if(s_uBgChanges)
+			msg("ExtraPass background: %u changed ranges, %u fixes.\n", s_uBgRanges, s_uBgChanges);
+		s_uBgRanges = s_uBgChanges = 0;
+		FlushRelocMap();
+	}
+}
+
+static int idaapi BackgroundTimer(void *pUserData)
+{
+	// Only between runs, and when the auto-analysis is idle
+	if((s_eState == eSTATE_INIT) && !s_bInSlice && autoIsOk() && BackgroundPending())
+	{
+		try
+		{
+			BackgroundSlice();
+		}
+		CATCH()
+	}
+	return(BACKGROUND_PERIOD);
+}
+
+// Turn background mode on or off
+static void ToggleBackground()
+{
+	if(s_bBackground)
+	{
+		StopBackground();
+		msg("ExtraPass background mode off.\n");
+	}
+	else
+	if(s_hBgTimer = register_timer(BACKGROUND_PERIOD, BackgroundTimer, NULL))
+	{
+		hook_to_notification_point(HT_IDP, IdpCallback, NULL);
+		s_bBackground = TRUE;
+		s_bBgDataToBytes = s_bDoDataToBytes;
+		s_bBgAlignBlocks = s_bDoAlignBlocks;
+		s_Dirty.clear();
+		MemTrackVector(MEM_BACKGROUND, s_Dirty, s_uDirtyMem);
+		s_BgRange.startEA = s_BgRange.endEA = s_eaBgCurrent = 0;
+		s_iBgPhase = 1;
+		s_uBgRanges = s_uBgChanges = 0;
+
+		// A run marker, so a rollback undoes the background changes since now
+		JRN_BeginRun(FALSE);
+		JRN_EndRun();
+		msg("ExtraPass background mode on, code changes will be looked at while IDA is idle.\n");
+	}
+	else
+		msg("** Failed to start the background mode timer! **\n");
+}
+
+static void StopBackground()
+{
+	if(s_bBackground)
+	{
+		unhook_from_notification_point(HT_IDP, IdpCallback, NULL);
+		unregister_timer(s_hBgTimer);
+		s_hBgTimer = NULL;
+		s_bBackground = FALSE;
+		s_Dirty.clear();
+		MemTrackVector(MEM_BACKGROUND, s_Dirty, s_uDirtyMem);
+		s_BgRange.startEA = s_BgRange.endEA = s_eaBgCurrent = 0;
+		FlushRelocMap();
+	}
+}
@@ -0,0 +1,499 @@
+// ****************************************************************************
+// File: Batch.cpp
+// Desc: Parallel batch driver
+//
+// Jobs are sorted largest image first and fed to per worker deques through a
+// bounded window. Idle workers steal the largest waiting job from the busiest
+// deque. A memory budget, estimated from each image's size, limits how many
+// big samples run at the same time. A sample that fails or times out is
+// recorded and the batch goes on.
+//
+// ****************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <new>
+#include "Batch.h"
+
+// Memory estimate overhead per job, edit list and bookkeeping
+#define JOB_OVERHEAD (1024 * 1024)
+
+struct tJOB
+{
+	std::string Path;
+	uint64_t uFileSize;
+	uint64_t uImageSize;	// From the PE header, file size if it can't be read
+	uint64_t uMemory;		// Estimated peak memory
+};
+
+struct tWORKER
+{
+	std::mutex Lock;
+	std::deque<tJOB *> Jobs;
+	std::thread Thread;
+	uint32_t uDone, uStolen;
+};
+
+// Memory budget pool
+struct tBUDGET
+{
+	std::mutex Lock;
+	std::condition_variable Wake;
+	uint64_t uTotal, uAvailable;
+
+	// A job bigger than the whole budget waits for all of it, then runs alone
+	uint64_t Acquire(uint64_t uBytes)
+	{
+		if(uTotal == 0)
+			return(0);
+		if(uBytes > uTotal)
+			uBytes = uTotal;
+		std::unique_lock<std::mutex> Guard(Lock);
+		Wake.wait(Guard, [&]{ return(uAvailable >= uBytes); });
+		uAvailable -= uBytes;
+		return(uBytes);
+	}
+
+	void Release(uint64_t uBytes)
+	{
+		if(uBytes == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> Guard(Lock);
+			uAvailable += uBytes;
+		}
+		Wake.notify_all();
+	}
+};
+
+struct tBATCH
+{
+	const tBATCH_OPTIONS *pOpt;
+	std::vector<tJOB> Jobs;
+	tWORKER *pWorkers;
+	int iWorkers;
+
+	// Feed window
+	std::mutex FeedLock;
+	std::condition_variable FeedWake, WorkWake;
+	size_t uQueued;
+	bool bFeedDone;
+
+	tBUDGET Budget;
+
+	// Results
+	std::mutex OutLock;
+	FILE *fpOut;
+	std::atomic<uint32_t> uOk, uFailed, uTimedOut;
+	std::atomic<uint64_t> uBytes;
+};
+
+// Peek the PE header for the image size, the loader's biggest allocation
+static uint64_t PeekImageSize(const char *pszFile, uint64_t uFileSize)
+{
+	uint64_t uSize = uFileSize;
+	if(FILE *fp = fopen(pszFile, "rb"))
+	{
+		uint8_t abHeader[1024];
+		size_t uRead = fread(abHeader, 1, sizeof(abHeader), fp);
+		if((uRead >= 0x40) && (abHeader[0] == 'M') && (abHeader[1] == 'Z'))
+		{
+			uint32_t uNT = (abHeader[0x3C] | (abHeader[0x3D] << 8) | (abHeader[0x3E] << 16) | ((uint32_t) abHeader[0x3F] << 24));
+			if((uNT < uRead) && ((uNT + 24 + 60) <= uRead))
+			{
+				const uint8_t *p = &abHeader[uNT + 24 + 56];
+				uint32_t uImage = (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+				if(uImage > uSize)
+					uSize = uImage;
+			}
+		}
+		fclose(fp);
+	}
+	return(uSize);
+}
+
+// Collect the regular files under the directory
+static void ScanDir(const std::string &Dir, std::vector<tJOB> &rJobs)
+{
+	DIR *pDir = opendir(Dir.c_str());
+	if(!pDir)
+		return;
+
+	while(dirent *pEntry = readdir(pDir))
+	{
+		if(pEntry->d_name[0] == '.')
+			continue;
+		std::string Path = (Dir + "/" + pEntry->d_name);
+		struct stat st;
+		if(stat(Path.c_str(), &st) != 0)
+			continue;
+		if(S_ISDIR(st.st_mode))
+			ScanDir(Path, rJobs);
+		else
+		if(S_ISREG(st.st_mode) && (st.st_size > 0))
+		{
+			// Skip our own output
+			size_t uLen = Path.size();
+			if((uLen > 4) && ((Path.compare((uLen - 4), 4, ".epl") == 0) || (Path.compare((uLen - 4), 4, ".epb") == 0)))
+				continue;
+
+			tJOB Job;
+			Job.Path       = Path;
+			Job.uFileSize  = (uint64_t) st.st_size;
+			Job.uImageSize = PeekImageSize(Path.c_str(), Job.uFileSize);
+			// File buffer, image, reloc bitmap, section byte map
+			Job.uMemory    = (Job.uFileSize + (Job.uImageSize * 2) + (Job.uImageSize / 8) + JOB_OVERHEAD);
+			rJobs.push_back(Job);
+		}
+	};
+	closedir(pDir);
+}
+
+// Column name for a pass
+static const char *PassColumn(int iPass, char *pszBuffer, size_t uSize)
+{
+	snprintf(pszBuffer, uSize, "%s_s", ENG_PassName(iPass));
+	for(char *p = pszBuffer; *p; p++)
+	{
+		if((*p >= 'A') && (*p <= 'Z'))
+			*p += ('a' - 'A');
+	}
+	return(pszBuffer);
+}
+
+// Write a JSON string value
+static void JsonString(FILE *fp, const char *psz)
+{
+	fputc('"', fp);
+	for(; *psz; psz++)
+	{
+		if((*psz == '"') || (*psz == '\\')) fprintf(fp, "\\%c", *psz);
+		else
+		if((uint8_t) *psz < 0x20) fprintf(fp, "\\u%04X", (uint8_t) *psz);
+		else
+			fputc(*psz, fp);
+	}
+	fputc('"', fp);
+}
+
+// CSV field, quoted when needed
+static void CsvString(FILE *fp, const char *psz)
+{
+	if(!strpbrk(psz, ",\"\r\n"))
+	{
+		fputs(psz, fp);
+		return;
+	}
+	fputc('"', fp);
+	for(; *psz; psz++)
+	{
+		if(*psz == '"') fputc('"', fp);
+		fputc(*psz, fp);
+	}
+	fputc('"', fp);
+}
+
+static void WriteHeader(tBATCH &rBatch)
+{
+	if(!rBatch.pOpt->bJsonl)
+	{
+		fprintf(rBatch.fpOut, "file,status,file_size,image_size,load_s");
+		char szColumn[32];
+		for(int i = 0; i < PASS_COUNT; i++)
+			fprintf(rBatch.fpOut, ",%s", PassColumn(i, szColumn, sizeof(szColumn)));
+		fprintf(rBatch.fpOut, ",total_s,functions,aligns,edits,worker,error\n");
+	}
+}
+
+static void WriteRow(tBATCH &rBatch, const tJOB &rJob, const char *pszStatus, const char *pszError, double dLoad, double dTotal, const tENGINE_RESULT &rResult, int iWorker)
+{
+	std::lock_guard<std::mutex> Guard(rBatch.OutLock);
+	FILE *fp = rBatch.fpOut;
+
+	if(rBatch.pOpt->bJsonl)
+	{
+		fprintf(fp, "{\"file\":");
+		JsonString(fp, rJob.Path.c_str());
+		fprintf(fp, ",\"status\":\"%s\",\"file_size\":%llu,\"image_size\":%llu,\"load_s\":%.6f", pszStatus, (unsigned long long) rJob.uFileSize, (unsigned long long) rJob.uImageSize, dLoad);
+		char szColumn[32];
+		for(int i = 0; i < PASS_COUNT; i++)
+			fprintf(fp, ",\"%s\":%.6f", PassColumn(i, szColumn, sizeof(szColumn)), rResult.aPass[i].dSeconds);
+		fprintf(fp, ",\"total_s\":%.6f,\"functions\":%u,\"aligns\":%u,\"edits\":%llu,\"worker\":%d,\"error\":", dTotal, rResult.uFunctions, rResult.uAligns, (unsigned long long) rResult.Edits.uCount, iWorker);
+		JsonString(fp, pszError);
+		fprintf(fp, "}\n");
+	}
+	else
+	{
+		CsvString(fp, rJob.Path.c_str());
+		fprintf(fp, ",%s,%llu,%llu,%.6f", pszStatus, (unsigned long long) rJob.uFileSize, (unsigned long long) rJob.uImageSize, dLoad);
+		for(int i = 0; i < PASS_COUNT; i++)
+			fprintf(fp, ",%.6f", rResult.aPass[i].dSeconds);
+		fprintf(fp, ",%.6f,%u,%u,%llu,%d,", dTotal, rResult.uFunctions, rResult.uAligns, (unsigned long long) rResult.Edits.uCount, iWorker);
+		CsvString(fp, pszError);
+		fputc('\n', fp);
+	}
+	fflush(fp);
+}
+
+// Run one sample, everything that can go wrong is caught and recorded here
+static void RunJob(tBATCH &rBatch, tJOB &rJob, int iWorker)
+{
+	const tBATCH_OPTIONS &rOpt = *rBatch.pOpt;
+	double dStart = ENG_GetTime(), dLoad = 0.0;
+	const char *pszStatus = "ok";
+	char szError[128] = "";
+
+	tENGINE_RESULT Result;
+	memset(&Result, 0, sizeof(Result));
+	tPEIMAGE PE;
+	memset(&PE, 0, sizeof(PE));
+	uint64_t uHeld = rBatch.Budget.Acquire(rJob.uMemory);
+
+	try
+	{
+		if(!PE_Load(rJob.Path.c_str(), PE, szError, sizeof(szError)))
+			pszStatus = "error";
+		else
+		{
+			dLoad = (ENG_GetTime() - dStart);
+			tENGINE_OPTIONS Options = rOpt.Engine;
+			Options.dDeadline = ((rOpt.dTimeout > 0.0) ? (dStart + rOpt.dTimeout) : 0.0);
+
+			if(!ENG_Process(PE, Options, Result))
+			{
+				if(Result.bTimedOut)
+				{
+					pszStatus = "timeout";
+					snprintf(szError, sizeof(szError), "Timed out after %.1f seconds", rOpt.dTimeout);
+				}
+				else
+				{
+					pszStatus = "error";
+					snprintf(szError, sizeof(szError), "No code section to process");
+				}
+			}
+			else
+			if(rOpt.pszOutDir)
+			{
+				const char *pszName = strrchr(rJob.Path.c_str(), '/');
+				std::string Output = (std::string(rOpt.pszOutDir) + "/" + (pszName ? (pszName + 1) : rJob.Path.c_str()) + ".epl");
+				if(!EDL_Save(Output.c_str(), Result.Edits))
+				{
+					pszStatus = "error";
+					snprintf(szError, sizeof(szError), "Failed to write the edit list");
+				}
+			}
+		}
+	}
+	catch(std::bad_alloc &)
+	{
+		pszStatus = "error";
+		snprintf(szError, sizeof(szError), "Out of memory");
+	}
+	catch(...)
+	{
+		pszStatus = "error";
+		snprintf(szError, sizeof(szError), "Exception");
+	}
+
+	// Keep the counts for the row, the edits themselves aren't needed anymore
+	size_t uEdits = Result.Edits.uCount;
+	ENG_FreeResult(Result);
+	Result.Edits.uCount = uEdits;
+	PE_Free(PE);
+	rBatch.Budget.Release(uHeld);
+
+	if(strcmp(pszStatus, "ok") == 0)
+	{
+		rBatch.uOk++;
+		rBatch.uBytes += rJob.uFileSize;
+	}
+	else
+	if(strcmp(pszStatus, "timeout") == 0)
+		rBatch.uTimedOut++;
+	else
+		rBatch.uFailed++;
+
+	WriteRow(rBatch, rJob, pszStatus, szError, dLoad, (ENG_GetTime() - dStart), Result, iWorker);
+}
+
+// Take the next job, own deque first, else steal the largest waiting job from the busiest one
+static tJOB *NextJob(tBATCH &rBatch, int iWorker)
+{
+	tWORKER &rSelf = rBatch.pWorkers[iWorker];
+	tJOB *pJob = NULL;
+	{
+		std::lock_guard<std::mutex> Guard(rSelf.Lock);
+		if(!rSelf.Jobs.empty())
+		{
+			pJob = rSelf.Jobs.front();
+			rSelf.Jobs.pop_front();
+		}
+	}
+
+	if(!pJob)
+	{
+		int iVictim = -1;
+		size_t uMost = 0;
+		for(int i = 0; i < rBatch.iWorkers; i++)
+		{
+			if(i == iWorker)
+				continue;
+			std::lock_guard<std::mutex> Guard(rBatch.pWorkers[i].Lock);
+			if(rBatch.pWorkers[i].Jobs.size() > uMost)
+			{
+				uMost   = rBatch.pWorkers[i].Jobs.size();
+				iVictim = i;
+			}
+		}
+
+		if(iVictim >= 0)
+		{
+			std::lock_guard<std::mutex> Guard(rBatch.pWorkers[iVictim].Lock);
+			if(!rBatch.pWorkers[iVictim].Jobs.empty())
+			{
+				pJob = rBatch.pWorkers[iVictim].Jobs.front();
+				rBatch.pWorkers[iVictim].Jobs.pop_front();
+				rSelf.uStolen++;
+			}
+		}
+	}
+
+	if(pJob)
+	{
+		{
+			std::lock_guard<std::mutex> Guard(rBatch.FeedLock);
+			rBatch.uQueued--;
+		}
+		rBatch.FeedWake.notify_one();
+	}
+	return(pJob);
+}
+
+static void WorkerThread(tBATCH *pBatch, int iWorker)
+{
+	tBATCH &rBatch = *pBatch;
+	while(true)
+	{
+		if(tJOB *pJob = NextJob(rBatch, iWorker))
+		{
+			RunJob(rBatch, *pJob, iWorker);
+			rBatch.pWorkers[iWorker].uDone++;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> Guard(rBatch.FeedLock);
+		if(rBatch.bFeedDone && (rBatch.uQueued == 0))
+			break;
+		rBatch.WorkWake.wait(Guard, [&]{ return((rBatch.uQueued > 0) || rBatch.bFeedDone); });
+	};
+}
+
+void BAT_DefaultOptions(tBATCH_OPTIONS &rOptions)
+{
+	memset(&rOptions, 0, sizeof(rOptions));
+	ENG_DefaultOptions(rOptions.Engine);
+}
+
+
+// ****************************************************************************
+// Func: BAT_Run()
+// Desc: Process all the samples under a directory in parallel
+// ****************************************************************************
+int BAT_Run(const char *pszDir, const tBATCH_OPTIONS &rOptions)
+{
+	tBATCH Batch;
+	Batch.pOpt      = &rOptions;
+	Batch.uQueued   = 0;
+	Batch.bFeedDone = false;
+	Batch.uOk = Batch.uFailed = Batch.uTimedOut = 0;
+	Batch.uBytes    = 0;
+	Batch.Budget.uTotal = Batch.Budget.uAvailable = rOptions.uMemoryBudget;
+
+	double dStart = ENG_GetTime();
+	ScanDir(pszDir, Batch.Jobs);
+	if(Batch.Jobs.empty())
+	{
+		fprintf(stderr, "%s: No files to process\n", pszDir);
+		return(1);
+	}
+
+	// Largest first, the long jobs start early instead of being the tail
+	std::sort(Batch.Jobs.begin(), Batch.Jobs.end(), [](const tJOB &a, const tJOB &b){ return(a.uImageSize > b.uImageSize); });
+
+	Batch.fpOut = (rOptions.pszResults ? fopen(rOptions.pszResults, "wb") : stdout);
+	if(!Batch.fpOut)
+	{
+		fprintf(stderr, "%s: Can't open results file\n", rOptions.pszResults);
+		return(1);
+	}
+	WriteHeader(Batch);
+
+	Batch.iWorkers = rOptions.iThreads;
+	if(Batch.iWorkers <= 0)
+		Batch.iWorkers = (int) std::thread::hardware_concurrency();
+	if(Batch.iWorkers <= 0)
+		Batch.iWorkers = 1;
+	size_t uQueueLimit = (rOptions.uQueueLimit ? rOptions.uQueueLimit : (size_t) (Batch.iWorkers * 4));
+
+	Batch.pWorkers = new tWORKER[Batch.iWorkers];
+	for(int i = 0; i < Batch.iWorkers; i++)
+	{
+		Batch.pWorkers[i].uDone = Batch.pWorkers[i].uStolen = 0;
+		Batch.pWorkers[i].Thread = std::thread(WorkerThread, &Batch, i);
+	}
+
+	// Feed round robin through the bounded window
+	for(size_t i = 0; i < Batch.Jobs.size(); i++)
+	{
+		{
+			std::unique_lock<std::mutex> Guard(Batch.FeedLock);
+			Batch.FeedWake.wait(Guard, [&]{ return(Batch.uQueued < uQueueLimit); });
+			Batch.uQueued++;
+		}
+		{
+			tWORKER &rWorker = Batch.pWorkers[i % Batch.iWorkers];
+			std::lock_guard<std::mutex> Guard(rWorker.Lock);
+			rWorker.Jobs.push_back(&Batch.Jobs[i]);
+		}
+		Batch.WorkWake.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> Guard(Batch.FeedLock);
+		Batch.bFeedDone = true;
+	}
+	Batch.WorkWake.notify_all();
+
+	uint32_t uStolen = 0;
+	for(int i = 0; i < Batch.iWorkers; i++)
+	{
+		Batch.pWorkers[i].Thread.join();
+		uStolen += Batch.pWorkers[i].uStolen;
+	}
+
+	if(Batch.fpOut != stdout)
+		fclose(Batch.fpOut);
+
+	double dElapsed = (ENG_GetTime() - dStart);
+	if(!rOptions.bQuiet)
+	{
+		size_t uTotal = Batch.Jobs.size();
+		fprintf(stderr, "Samples: %u, ok: %u, failed: %u, timed out: %u\n", (unsigned int) uTotal, (unsigned int) Batch.uOk, (unsigned int) Batch.uFailed, (unsigned int) Batch.uTimedOut);
+		fprintf(stderr, "Workers: %d, steals: %u\n", Batch.iWorkers, uStolen);
+		fprintf(stderr, "   Time: %.2f seconds, %.1f samples/minute, %.2f MB/s\n", dElapsed, ((dElapsed > 0.0) ? ((uTotal * 60.0) / dElapsed) : 0.0),
+				((dElapsed > 0.0) ? (((double) Batch.uBytes / (1024.0 * 1024.0)) / dElapsed) : 0.0));
+	}
+
+	delete [] Batch.pWorkers;
+	return(((Batch.uFailed + Batch.uTimedOut) == 0) ? 0 : 3);
+}
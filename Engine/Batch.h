@@ -0,0 +1,25 @@
+// ****************************************************************************
+// File: Batch.h
+// Desc: Parallel batch driver, runs the engine over a directory of samples.
+//
+// ****************************************************************************
+#pragma once
+#include "Engine.h"
+
+struct tBATCH_OPTIONS
+{
+	tENGINE_OPTIONS Engine;
+	int      iThreads;			// Worker count, 0 for the core count
+	uint64_t uMemoryBudget;		// Total bytes all running jobs may use, 0 for no limit
+	size_t   uQueueLimit;		// Jobs queued ahead of the workers, 0 for 4 per worker
+	double   dTimeout;			// Per sample seconds, 0 for none
+	const char *pszOutDir;		// Where to write the edit lists, NULL for none
+	const char *pszResults;		// Per sample results file, NULL for stdout
+	bool     bJsonl;			// Results as JSON lines, else CSV
+	bool     bQuiet;
+};
+
+void BAT_DefaultOptions(tBATCH_OPTIONS &rOptions);
+
+// Process every file under the directory, returns the process exit code
+int BAT_Run(const char *pszDir, const tBATCH_OPTIONS &rOptions);
@@ -0,0 +1,170 @@
+// ****************************************************************************
+// File: Cli.cpp
+// Desc: ExtraPass standalone engine command line
+//
+// ****************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Engine.h"
+#include "Batch.h"
+
+static void Usage()
+{
+	printf("Usage: extrapass [options] <file.exe|file.dll>\n"
+		   "       extrapass -b [options] [batch options] <directory>\n"
+		   "  -s <steps>  Processing steps to do, default \"1246\":\n"
+		   "              1 stray data to unknown, 2 align blocks, 4 missing functions, 6 vftable methods.\n"
+		   "  -a          Process all code sections, else the first only.\n"
+		   "  -o <file>   Edit list output file, default is the input file name + \".epl\".\n"
+		   "              A \".epb\" name writes a binary plan, \".json\" a JSON dump.\n"
+		   "  -q          Quiet, errors only.\n"
+		   "Batch options, every file under the directory is processed in parallel:\n"
+		   "  -j <count>  Worker threads, default is the core count.\n"
+		   "  -m <MB>     Memory budget for all running samples, default no limit.\n"
+		   "  -t <secs>   Per sample time limit, default none.\n"
+		   "  -f <csv|jsonl> Per sample results format, default \"csv\".\n"
+		   "  -r <file>   Results file, default is stdout.\n"
+		   "  -O <dir>    Write the edit lists here, default none.\n");
+}
+
+// Bytes per second as a short string
+static const char *RateString(uint64_t uBytes, double dSeconds, char *pszBuffer, size_t uSize)
+{
+	if(dSeconds <= 0.0)
+		snprintf(pszBuffer, uSize, "-");
+	else
+	{
+		double dRate = ((double) uBytes / dSeconds);
+		if(dRate >= (1024.0 * 1024.0 * 1024.0))
+			snprintf(pszBuffer, uSize, "%.2f GB/s", (dRate / (1024.0 * 1024.0 * 1024.0)));
+		else
+		if(dRate >= (1024.0 * 1024.0))
+			snprintf(pszBuffer, uSize, "%.2f MB/s", (dRate / (1024.0 * 1024.0)));
+		else
+			snprintf(pszBuffer, uSize, "%.2f KB/s", (dRate / 1024.0));
+	}
+	return(pszBuffer);
+}
+
+int main(int argc, char *argv[])
+{
+	tBATCH_OPTIONS Batch;
+	BAT_DefaultOptions(Batch);
+	tENGINE_OPTIONS &Options = Batch.Engine;
+	const char *pszInput = NULL, *pszOutput = NULL;
+	bool bQuiet = false, bBatch = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc))
+		{
+			const char *pszSteps = argv[++i];
+			Options.bDataToBytes = (strchr(pszSteps, '1') != NULL);
+			Options.bAlignBlocks = (strchr(pszSteps, '2') != NULL);
+			Options.bMissingFunc = (strchr(pszSteps, '4') != NULL);
+			Options.bVftables    = (strchr(pszSteps, '6') != NULL);
+		}
+		else
+		if(strcmp(argv[i], "-a") == 0)
+			Options.bAllCode = true;
+		else
+		if((strcmp(argv[i], "-o") == 0) && ((i + 1) < argc))
+			pszOutput = argv[++i];
+		else
+		if(strcmp(argv[i], "-q") == 0)
+			bQuiet = Batch.bQuiet = true;
+		else
+		if(strcmp(argv[i], "-b") == 0)
+			bBatch = true;
+		else
+		if((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc))
+			Batch.iThreads = atoi(argv[++i]);
+		else
+		if((strcmp(argv[i], "-m") == 0) && ((i + 1) < argc))
+			Batch.uMemoryBudget = ((uint64_t) strtoull(argv[++i], NULL, 10) << 20);
+		else
+		if((strcmp(argv[i], "-t") == 0) && ((i + 1) < argc))
+			Batch.dTimeout = atof(argv[++i]);
+		else
+		if((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc))
+			Batch.bJsonl = (strcmp(argv[++i], "jsonl") == 0);
+		else
+		if((strcmp(argv[i], "-r") == 0) && ((i + 1) < argc))
+			Batch.pszResults = argv[++i];
+		else
+		if((strcmp(argv[i], "-O") == 0) && ((i + 1) < argc))
+			Batch.pszOutDir = argv[++i];
+		else
+		if((argv[i][0] != '-') && !pszInput)
+			pszInput = argv[i];
+		else
+		{
+			Usage();
+			return(2);
+		}
+	}
+	if(!pszInput)
+	{
+		Usage();
+		return(2);
+	}
+
+	if(bBatch)
+		return(BAT_Run(pszInput, Batch));
+
+	std::string Output = (pszOutput ? pszOutput : (std::string(pszInput) + ".epl"));
+
+	double dStart = ENG_GetTime();
+	tPEIMAGE PE;
+	char szError[128];
+	if(!PE_Load(pszInput, PE, szError, sizeof(szError)))
+	{
+		fprintf(stderr, "%s: %s\n", pszInput, szError);
+		return(1);
+	}
+	double dLoad = (ENG_GetTime() - dStart);
+
+	tENGINE_RESULT Result;
+	if(!ENG_Process(PE, Options, Result))
+	{
+		fprintf(stderr, "%s: %s\n", pszInput, (Result.bTimedOut ? "Timed out" : "No code section to process"));
+		ENG_FreeResult(Result);
+		PE_Free(PE);
+		return(1);
+	}
+
+	int iResult = 0;
+	if(!EDL_SaveAs(Output.c_str(), Result.Edits))
+	{
+		fprintf(stderr, "%s: Failed to write the edit list\n", Output.c_str());
+		iResult = 1;
+	}
+
+	if(!bQuiet)
+	{
+		char szRate[32];
+		printf("%s: base %08X, %u relocations, %u exports.\n", pszInput, PE.uImageBase, PE.uRelocs, PE.uExports);
+		printf("%-10s %10s %12s %14s\n", "Pass", "Seconds", "Bytes", "Throughput");
+		printf("%-10s %10.4f %12llu %14s\n", "Load", dLoad, (unsigned long long) PE.uFileSize, RateString(PE.uFileSize, dLoad, szRate, sizeof(szRate)));
+		for(int i = 0; i < PASS_COUNT; i++)
+		{
+			const tPASS_STAT &rStat = Result.aPass[i];
+			if(rStat.uBytes)
+				printf("%-10s %10.4f %12llu %14s\n", ENG_PassName(i), rStat.dSeconds, (unsigned long long) rStat.uBytes, RateString(rStat.uBytes, rStat.dSeconds, szRate, sizeof(szRate)));
+		}
+		printf("\n");
+		printf("   Functions: %u (%u from gaps, %u data seeds)\n", Result.uFunctions, Result.uGapFunctions, Result.uDataSeeds);
+		printf("  Alignments: %u\n", Result.uAligns);
+		printf("    Unknowns: %u\n", Result.uUnknowns);
+		printf("Reloc tables: %u\n", Result.uTables);
+		printf("    Switches: %u\n", Result.uSwitches);
+		printf("       Edits: %u -> \"%s\"\n", (unsigned int) Result.Edits.uCount, Output.c_str());
+		printf("  Total time: %.4f seconds\n", (ENG_GetTime() - dStart));
+	}
+
+	ENG_FreeResult(Result);
+	PE_Free(PE);
+	return(iResult);
+}
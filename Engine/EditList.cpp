@@ -0,0 +1,311 @@
+// ****************************************************************************
+// File: EditList.cpp
+// Desc: ExtraPass edit list
+//
+// Text format, one edit per line, hex values:
+//   ; ExtraPass edit list <version>
+//   BASE <image base>
+//   <KIND> <address> <size> [<owner>]
+//
+// The binary plan format is described in EditList.h.
+//
+// ****************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "EditList.h"
+
+static const char PLAN_MAGIC[4] = { 'E', 'P', 'L', 'N' };
+
+static const char *s_apszKinds[EDIT_KINDS] = { "DELFUNC", "UNDEF", "BYTES", "OFFSETS", "ALIGN", "CODE", "FUNC", "TAIL" };
+
+const char *EDL_KindName(uint32_t uKind)
+{
+	return((uKind < EDIT_KINDS) ? s_apszKinds[uKind] : "?");
+}
+
+void EDL_Init(tEDITLIST &rList)
+{
+	memset(&rList, 0, sizeof(rList));
+}
+
+void EDL_Free(tEDITLIST &rList)
+{
+	free(rList.pEdits);
+	EDL_Init(rList);
+}
+
+bool EDL_Add(tEDITLIST &rList, uint32_t uKind, uint64_t uEA, uint64_t uSize, uint64_t uOwner)
+{
+	if(rList.uCount >= rList.uCapacity)
+	{
+		size_t uCapacity = (rList.uCapacity ? (rList.uCapacity * 2) : 1024);
+		tEDIT *pEdits = (tEDIT *) realloc(rList.pEdits, (uCapacity * sizeof(tEDIT)));
+		if(!pEdits)
+			return(false);
+		rList.pEdits    = pEdits;
+		rList.uCapacity = uCapacity;
+	}
+
+	tEDIT &rEdit = rList.pEdits[rList.uCount++];
+	rEdit.uKind  = uKind;
+	rEdit.uEA    = uEA;
+	rEdit.uSize  = uSize;
+	rEdit.uOwner = uOwner;
+	return(true);
+}
+
+static int CompareEdit(const void *p1, const void *p2)
+{
+	const tEDIT *pE1 = (const tEDIT *) p1, *pE2 = (const tEDIT *) p2;
+	if(pE1->uKind != pE2->uKind)
+		return((pE1->uKind < pE2->uKind) ? -1 : 1);
+	return((pE1->uEA < pE2->uEA) ? -1 : ((pE1->uEA > pE2->uEA) ? 1 : 0));
+}
+
+void EDL_Sort(tEDITLIST &rList)
+{
+	if(rList.uCount)
+		qsort(rList.pEdits, rList.uCount, sizeof(tEDIT), CompareEdit);
+}
+
+void EDL_Unique(tEDITLIST &rList)
+{
+	size_t uCount = 0;
+	for(size_t i = 0; i < rList.uCount; i++)
+	{
+		if(uCount && (memcmp(&rList.pEdits[uCount - 1], &rList.pEdits[i], sizeof(tEDIT)) == 0))
+			continue;
+		rList.pEdits[uCount++] = rList.pEdits[i];
+	}
+	rList.uCount = uCount;
+}
+
+bool EDL_Save(const char *pszFile, const tEDITLIST &rList)
+{
+	FILE *fp = fopen(pszFile, "wb");
+	if(!fp)
+		return(false);
+
+	fprintf(fp, "; ExtraPass edit list %d\n", EDL_VERSION);
+	fprintf(fp, "BASE %llX\n", (unsigned long long) rList.uImageBase);
+	for(size_t i = 0; i < rList.uCount; i++)
+	{
+		const tEDIT &rEdit = rList.pEdits[i];
+		if(rEdit.uKind == EDIT_TAIL)
+			fprintf(fp, "%s %llX %llX %llX\n", EDL_KindName(rEdit.uKind), (unsigned long long) rEdit.uEA, (unsigned long long) rEdit.uSize, (unsigned long long) rEdit.uOwner);
+		else
+			fprintf(fp, "%s %llX %llX\n", EDL_KindName(rEdit.uKind), (unsigned long long) rEdit.uEA, (unsigned long long) rEdit.uSize);
+	}
+
+	bool bResult = (ferror(fp) == 0);
+	fclose(fp);
+	return(bResult);
+}
+
+static void PutLong(FILE *fp, uint64_t uValue, int iBytes)
+{
+	for(int i = 0; i < iBytes; i++)
+		fputc((int) ((uValue >> (i * 8)) & 0xFF), fp);
+}
+
+static bool GetLong(FILE *fp, uint64_t &ruValue, int iBytes)
+{
+	ruValue = 0;
+	for(int i = 0; i < iBytes; i++)
+	{
+		int c = fgetc(fp);
+		if(c == EOF)
+			return(false);
+		ruValue |= ((uint64_t) c << (i * 8));
+	}
+	return(true);
+}
+
+static void PutVarint(FILE *fp, uint64_t uValue)
+{
+	while(uValue >= 0x80)
+	{
+		fputc((int) ((uValue & 0x7F) | 0x80), fp);
+		uValue >>= 7;
+	};
+	fputc((int) uValue, fp);
+}
+
+static bool GetVarint(FILE *fp, uint64_t &ruValue)
+{
+	ruValue = 0;
+	for(int iShift = 0; iShift < 64; iShift += 7)
+	{
+		int c = fgetc(fp);
+		if(c == EOF)
+			return(false);
+		ruValue |= ((uint64_t) (c & 0x7F) << iShift);
+		if(!(c & 0x80))
+			return(true);
+	}
+	return(false);
+}
+
+bool EDL_SavePlan(const char *pszFile, tEDITLIST &rList)
+{
+	EDL_Sort(rList);
+	EDL_Unique(rList);
+
+	FILE *fp = fopen(pszFile, "wb");
+	if(!fp)
+		return(false);
+
+	fwrite(PLAN_MAGIC, sizeof(PLAN_MAGIC), 1, fp);
+	PutLong(fp, EDL_PLAN_VERSION, 4);
+	PutLong(fp, rList.uImageBase, 8);
+	PutLong(fp, rList.uCount, 8);
+
+	uint32_t uKind = EDIT_KINDS;
+	uint64_t uLastEA = 0;
+	for(size_t i = 0; i < rList.uCount; i++)
+	{
+		const tEDIT &rEdit = rList.pEdits[i];
+		if(rEdit.uKind != uKind)
+		{
+			uKind = rEdit.uKind;
+			uLastEA = 0;
+		}
+		fputc((int) rEdit.uKind, fp);
+		PutVarint(fp, (rEdit.uEA - uLastEA));
+		PutVarint(fp, rEdit.uSize);
+		if(rEdit.uKind == EDIT_TAIL)
+			PutVarint(fp, rEdit.uOwner);
+		uLastEA = rEdit.uEA;
+	}
+
+	bool bResult = (ferror(fp) == 0);
+	fclose(fp);
+	return(bResult);
+}
+
+// Binary plan body, after the magic
+static bool LoadPlan(FILE *fp, tEDITLIST &rList)
+{
+	uint64_t uVersion, uBase, uCount;
+	if(!GetLong(fp, uVersion, 4) || (uVersion != EDL_PLAN_VERSION) || !GetLong(fp, uBase, 8) || !GetLong(fp, uCount, 8))
+		return(false);
+	rList.uImageBase = uBase;
+
+	uint32_t uKind = EDIT_KINDS;
+	uint64_t uLastEA = 0;
+	for(uint64_t i = 0; i < uCount; i++)
+	{
+		int c = fgetc(fp);
+		if((c == EOF) || (c >= EDIT_KINDS))
+			return(false);
+		if((uint32_t) c != uKind)
+		{
+			uKind = (uint32_t) c;
+			uLastEA = 0;
+		}
+
+		uint64_t uDelta, uSize, uOwner = 0;
+		if(!GetVarint(fp, uDelta) || !GetVarint(fp, uSize) || ((uKind == EDIT_TAIL) && !GetVarint(fp, uOwner)))
+			return(false);
+		uLastEA += uDelta;
+		if(!EDL_Add(rList, uKind, uLastEA, uSize, uOwner))
+			return(false);
+	}
+	return(true);
+}
+
+bool EDL_SaveJson(const char *pszFile, const tEDITLIST &rList)
+{
+	FILE *fp = fopen(pszFile, "wb");
+	if(!fp)
+		return(false);
+
+	fprintf(fp, "{\"version\": %d, \"base\": \"0x%llX\", \"edits\": [\n", EDL_PLAN_VERSION, (unsigned long long) rList.uImageBase);
+	for(size_t i = 0; i < rList.uCount; i++)
+	{
+		const tEDIT &rEdit = rList.pEdits[i];
+		fprintf(fp, "  {\"kind\": \"%s\", \"ea\": \"0x%llX\", \"size\": %llu", EDL_KindName(rEdit.uKind), (unsigned long long) rEdit.uEA, (unsigned long long) rEdit.uSize);
+		if(rEdit.uKind == EDIT_TAIL)
+			fprintf(fp, ", \"owner\": \"0x%llX\"", (unsigned long long) rEdit.uOwner);
+		fprintf(fp, "}%s\n", (((i + 1) < rList.uCount) ? "," : ""));
+	}
+	fprintf(fp, "]}\n");
+
+	bool bResult = (ferror(fp) == 0);
+	fclose(fp);
+	return(bResult);
+}
+
+// Case insensitive file extension test
+static bool HasExtension(const char *pszFile, const char *pszExt)
+{
+	size_t uFile = strlen(pszFile), uExt = strlen(pszExt);
+	if(uFile < uExt)
+		return(false);
+	for(size_t i = 0; i < uExt; i++)
+	{
+		if(tolower((unsigned char) pszFile[uFile - uExt + i]) != tolower((unsigned char) pszExt[i]))
+			return(false);
+	}
+	return(true);
+}
+
+bool EDL_SaveAs(const char *pszFile, tEDITLIST &rList)
+{
+	if(HasExtension(pszFile, ".epb"))
+		return(EDL_SavePlan(pszFile, rList));
+	if(HasExtension(pszFile, ".json"))
+		return(EDL_SaveJson(pszFile, rList));
+	return(EDL_Save(pszFile, rList));
+}
+
+bool EDL_Load(const char *pszFile, tEDITLIST &rList)
+{
+	FILE *fp = fopen(pszFile, "rb");
+	if(!fp)
+		return(false);
+
+	// Binary plan?
+	char acMagic[sizeof(PLAN_MAGIC)];
+	if((fread(acMagic, sizeof(acMagic), 1, fp) == 1) && (memcmp(acMagic, PLAN_MAGIC, sizeof(PLAN_MAGIC)) == 0))
+	{
+		bool bResult = LoadPlan(fp, rList);
+		fclose(fp);
+		return(bResult);
+	}
+	rewind(fp);
+
+	bool bResult = false;
+	char szLine[256];
+	if(fgets(szLine, sizeof(szLine), fp) && (strncmp(szLine, "; ExtraPass edit list ", 22) == 0) && (atoi(szLine + 22) == EDL_VERSION))
+	{
+		bResult = true;
+		while(bResult && fgets(szLine, sizeof(szLine), fp))
+		{
+			if((szLine[0] == ';') || (szLine[0] == '\r') || (szLine[0] == '\n'))
+				continue;
+
+			char szKind[16];
+			unsigned long long uEA = 0, uSize = 0, uOwner = 0;
+			int iFields = sscanf(szLine, "%15s %llX %llX %llX", szKind, &uEA, &uSize, &uOwner);
+			if((iFields >= 2) && (strcmp(szKind, "BASE") == 0))
+			{
+				rList.uImageBase = uEA;
+				continue;
+			}
+
+			uint32_t uKind = 0;
+			while((uKind < EDIT_KINDS) && (strcmp(szKind, s_apszKinds[uKind]) != 0))
+				uKind++;
+			if((uKind >= EDIT_KINDS) || (iFields < 3) || ((uKind == EDIT_TAIL) && (iFields < 4)))
+				bResult = false;
+			else
+				bResult = EDL_Add(rList, uKind, uEA, uSize, uOwner);
+		};
+	}
+
+	fclose(fp);
+	return(bResult);
+}
@@ -0,0 +1,70 @@
+// ****************************************************************************
+// File: EditList.h
+// Desc: ExtraPass edit list, the decisions of a pass as a flat list of IDB edits.
+//       Shared by the standalone engine (writer) and the plugin importer (reader),
+//       so it's plain C/C++ with no IDA or Windows dependencies.
+//
+// ****************************************************************************
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Edit kinds, in the order they are applied
+enum eEDIT
+{
+	EDIT_DELFUNC,	// Delete the function at "uEA"
+	EDIT_UNDEFINE,	// Make "uSize" bytes unknown
+	EDIT_BYTES,		// Make a byte array, i.e. a switch index table
+	EDIT_OFFSETS,	// Make a dword offset array, i.e. a switch jump table
+	EDIT_ALIGN,		// Make an "align" block
+	EDIT_CODE,		// Make an instruction at "uEA" where "uSize" bytes of data were
+	EDIT_FUNC,		// Add a function, "uSize" 0 to let IDA find the end
+	EDIT_TAIL,		// Append "uEA" to "uSize" as a tail of function "uOwner"
+
+	EDIT_KINDS
+};
+
+struct tEDIT
+{
+	uint32_t uKind;
+	uint64_t uEA;
+	uint64_t uSize;
+	uint64_t uOwner;
+};
+
+struct tEDITLIST
+{
+	tEDIT  *pEdits;
+	size_t uCount;
+	size_t uCapacity;
+	uint64_t uImageBase;	// Image base the addresses are for
+};
+
+// Text edit list format version
+#define EDL_VERSION 1
+
+// Binary edit plan format version.
+// Little endian: "EPLN" magic, u32 version, u64 image base, u64 count, then per edit
+// a u8 kind and LEB128 varints of the address delta from the previous edit of the same kind,
+// the size, and the owner for tails. Edits are stored sorted, so the deltas are small.
+#define EDL_PLAN_VERSION 1
+
+void EDL_Init(tEDITLIST &rList);
+void EDL_Free(tEDITLIST &rList);
+bool EDL_Add(tEDITLIST &rList, uint32_t uKind, uint64_t uEA, uint64_t uSize, uint64_t uOwner = 0);
+
+// Sort into apply order, by kind then address
+void EDL_Sort(tEDITLIST &rList);
+// Remove duplicate edits, the list must be sorted
+void EDL_Unique(tEDITLIST &rList);
+
+// Save and load, the load appends to the list and takes either format. Return false on error.
+bool EDL_Save(const char *pszFile, const tEDITLIST &rList);
+bool EDL_SavePlan(const char *pszFile, tEDITLIST &rList);	// Binary, sorts the list
+bool EDL_SaveJson(const char *pszFile, const tEDITLIST &rList);
+bool EDL_Load(const char *pszFile, tEDITLIST &rList);
+
+// Save by file extension, ".epb" binary plan, ".json" JSON dump, else text
+bool EDL_SaveAs(const char *pszFile, tEDITLIST &rList);
+
+const char *EDL_KindName(uint32_t uKind);
@@ -0,0 +1,614 @@
+// ****************************************************************************
+// File: Engine.cpp
+// Desc: Standalone ExtraPass engine
+//
+// ****************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "Engine.h"
+#include "X86Decode.h"
+
+// Per byte state, low bits
+#define B_UNKNOWN 0
+#define B_HEAD    1		// Instruction start
+#define B_TAIL    2		// Instruction body
+#define B_ALIGN   3		// Align block
+#define B_TABLE   4		// Dword offset table
+#define B_INDEX   5		// Switch byte index table
+#define B_MASK    7
+
+// Per byte flags
+#define F_END      0x08	// Last byte of a no fall through instruction
+#define F_TARGET   0x10	// Branch or table target
+#define F_FUNC     0x20	// Function start
+#define F_DATASEED 0x40	// Function start from a code pointer in data
+
+// Sanity limit for the case count, same as the plugin
+#define MAX_CASES 2048
+
+// Gap function trial limits
+#define MAX_TRY_INSN 1024
+
+// Deadline check interval, in loop iterations
+#define DEADLINE_CHECK 4096
+
+// Per code section context
+struct tCONTEXT
+{
+	const tPEIMAGE        *pPE;
+	const tENGINE_OPTIONS *pOpt;
+	tENGINE_RESULT        *pResult;
+	uint32_t uStart, uEnd;		// Section RVA range
+	uint8_t *pMap;				// Byte state
+	std::vector<uint32_t> Work;	// Descent work list
+	uint32_t uTicks;			// Deadline check counter
+
+	inline uint8_t &At(uint32_t uRVA){ return(pMap[uRVA - uStart]); }
+	inline uint32_t State(uint32_t uRVA){ return(pMap[uRVA - uStart] & B_MASK); }
+	inline void SetState(uint32_t uRVA, uint32_t uState){ pMap[uRVA - uStart] = ((pMap[uRVA - uStart] & ~B_MASK) | uState); }
+	inline bool InSection(uint32_t uRVA){ return((uRVA >= uStart) && (uRVA < uEnd)); }
+	inline uint32_t ToRVA(uint32_t uVA){ return(uVA - pPE->uImageBase); }
+	inline uint64_t ToVA(uint32_t uRVA){ return((uint64_t) pPE->uImageBase + uRVA); }
+};
+
+static const char *s_apszPasses[PASS_COUNT] = { "Relocs", "Code", "Align", "Functions", "Data" };
+
+const char *ENG_PassName(int iPass)
+{
+	return(((iPass >= 0) && (iPass < PASS_COUNT)) ? s_apszPasses[iPass] : "?");
+}
+
+double ENG_GetTime()
+{
+	#ifdef _WIN32
+	return((double) clock() / CLOCKS_PER_SEC);
+	#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((double) ts.tv_sec + ((double) ts.tv_nsec / 1e9));
+	#endif
+}
+
+void ENG_DefaultOptions(tENGINE_OPTIONS &rOptions)
+{
+	rOptions.bDataToBytes = rOptions.bAlignBlocks = rOptions.bMissingFunc = rOptions.bVftables = true;
+	rOptions.bAllCode = false;
+	rOptions.dDeadline = 0.0;
+}
+
+void ENG_FreeResult(tENGINE_RESULT &rResult)
+{
+	EDL_Free(rResult.Edits);
+}
+
+static bool IsPadByte(uint8_t b){ return((b == 0xCC) || (b == 0x90)); }
+
+// Cooperative deadline, so one pathological sample can't hold up a batch
+static bool TimeUp(tCONTEXT &rCtx)
+{
+	if(rCtx.pResult->bTimedOut)
+		return(true);
+	if((rCtx.pOpt->dDeadline > 0.0) && (++rCtx.uTicks >= DEADLINE_CHECK))
+	{
+		rCtx.uTicks = 0;
+		if(ENG_GetTime() >= rCtx.pOpt->dDeadline)
+			rCtx.pResult->bTimedOut = true;
+	}
+	return(rCtx.pResult->bTimedOut);
+}
+
+// Queue a code address for the descent
+static void Queue(tCONTEXT &rCtx, uint32_t uRVA, uint8_t bFlags)
+{
+	if(!rCtx.InSection(uRVA))
+		return;
+	uint32_t uState = rCtx.State(uRVA);
+	if((uState == B_UNKNOWN) || (uState == B_HEAD))
+	{
+		rCtx.At(uRVA) |= bFlags;
+		if(uState == B_UNKNOWN)
+			rCtx.Work.push_back(uRVA);
+	}
+}
+
+// Returns true if the range is all unknown bytes
+static bool IsUnknown(tCONTEXT &rCtx, uint32_t uRVA, uint32_t uSize)
+{
+	if(!rCtx.InSection(uRVA) || (uSize > (rCtx.uEnd - uRVA)))
+		return(false);
+	for(uint32_t i = 0; i < uSize; i++)
+	{
+		if(rCtx.State(uRVA + i) != B_UNKNOWN)
+			return(false);
+	}
+	return(true);
+}
+
+static void MarkRange(tCONTEXT &rCtx, uint32_t uRVA, uint32_t uSize, uint32_t uState)
+{
+	for(uint32_t i = 0; i < uSize; i++)
+		rCtx.SetState((uRVA + i), uState);
+}
+
+// Look back from a table jump for the "cmp reg, imm / ja" bound and any "movzx reg, index[reg]"
+// "aHist" is the instructions before the jump, latest first.
+static uint32_t GetCaseBound(const tX86INSN *aHist, int iHist, uint32_t &ruIndexVA)
+{
+	bool bHaveJa = false;
+	ruIndexVA = 0;
+
+	for(int i = 0; i < iHist; i++)
+	{
+		const tX86INSN &r = aHist[i];
+		if(r.bTwoByte)
+		{
+			if(r.bOpcode == 0x87) bHaveJa = true;
+			else
+			if((r.bOpcode == 0xB6) && !bHaveJa && (r.uDispSize == 4) && (((r.Mod() == 2) && (r.Rm() != 4)) || (r.bHasSIB && (r.Mod() == 0) && (r.Base() == 5) && (r.Scale() == 0))))
+				ruIndexVA = (uint32_t) r.iDisp;
+			else
+				return(0);
+		}
+		else
+		if(r.bOpcode == 0x77)
+			bHaveJa = true;
+		else
+		if(((r.bOpcode == 0x83) || (r.bOpcode == 0x81)) && (r.Mod() == 3) && (r.Reg() == 7))
+			return((bHaveJa && (r.uImm < MAX_CASES)) ? (r.uImm + 1) : 0);
+		else
+		if(r.bOpcode == 0x3D)
+			return((bHaveJa && (r.uImm < MAX_CASES)) ? (r.uImm + 1) : 0);
+		else
+		// Index register setup between the bound and the jump is expected
+		if(!((r.bOpcode == 0x8B) || (r.bOpcode == 0x8D) || ((r.bOpcode >= 0x48) && (r.bOpcode <= 0x4F)) ||
+			 (((r.bOpcode == 0x83) || (r.bOpcode == 0x81)) && ((r.Reg() == 0) || (r.Reg() == 5)))))
+			return(0);
+	}
+
+	return(0);
+}
+
+// Decode a "jmp [table + reg*4]" switch, mark its tables and queue the cases
+static void DecodeSwitch(tCONTEXT &rCtx, const tX86INSN &rJump, const tX86INSN *aHist, int iHist)
+{
+	const tPEIMAGE &rPE = *rCtx.pPE;
+	uint32_t uIndexVA;
+	uint32_t uCases = GetCaseBound(aHist, iHist, uIndexVA);
+	if(uCases == 0)
+		return;
+
+	uint32_t uJumpRVA = rCtx.ToRVA((uint32_t) rJump.iDisp);
+	uint32_t uJumps = uCases;
+	uint32_t uIndexRVA = 0;
+	if(uIndexVA)
+	{
+		uIndexRVA = rCtx.ToRVA(uIndexVA);
+		if((uIndexRVA >= rPE.uSizeOfImage) || (uCases > (rPE.uSizeOfImage - uIndexRVA)))
+			return;
+		uJumps = 0;
+		for(uint32_t i = 0; i < uCases; i++)
+		{
+			if((uint32_t) (rPE.pImage[uIndexRVA + i] + 1) > uJumps)
+				uJumps = (rPE.pImage[uIndexRVA + i] + 1);
+		}
+	}
+
+	// All entries must point into the section
+	if((uJumpRVA >= rPE.uSizeOfImage) || ((uJumps * 4) > (rPE.uSizeOfImage - uJumpRVA)))
+		return;
+	for(uint32_t i = 0; i < uJumps; i++)
+	{
+		if(!rCtx.InSection(rCtx.ToRVA(PE_GetLong(rPE, (uJumpRVA + (i * 4))))))
+			return;
+	}
+
+	// Tables in the section get marked, the reloc pass might have done the jump table already
+	bool bDataEdits = rCtx.pOpt->bDataToBytes;
+	if(IsUnknown(rCtx, uJumpRVA, (uJumps * 4)))
+	{
+		MarkRange(rCtx, uJumpRVA, (uJumps * 4), B_TABLE);
+		if(bDataEdits) EDL_Add(rCtx.pResult->Edits, EDIT_OFFSETS, rCtx.ToVA(uJumpRVA), (uJumps * 4));
+	}
+	if(uIndexVA && IsUnknown(rCtx, uIndexRVA, uCases))
+	{
+		MarkRange(rCtx, uIndexRVA, uCases, B_INDEX);
+		if(bDataEdits) EDL_Add(rCtx.pResult->Edits, EDIT_BYTES, rCtx.ToVA(uIndexRVA), uCases);
+	}
+
+	for(uint32_t i = 0; i < uJumps; i++)
+		Queue(rCtx, rCtx.ToRVA(PE_GetLong(rPE, (uJumpRVA + (i * 4)))), F_TARGET);
+	rCtx.pResult->uSwitches++;
+}
+
+// Recursive descent over the work list
+static void Descend(tCONTEXT &rCtx)
+{
+	const uint8_t *pImage = rCtx.pPE->pImage;
+
+	while(!rCtx.Work.empty() && !TimeUp(rCtx))
+	{
+		uint32_t uRVA = rCtx.Work.back();
+		rCtx.Work.pop_back();
+
+		tX86INSN aHist[4];
+		int iHist = 0;
+		while(rCtx.InSection(uRVA) && (rCtx.State(uRVA) == B_UNKNOWN))
+		{
+			tX86INSN Insn;
+			if(!X86_Decode((pImage + uRVA), (rCtx.uEnd - uRVA), (uint32_t) rCtx.ToVA(uRVA), Insn))
+				break;
+			if(!IsUnknown(rCtx, uRVA, Insn.uLength))
+				break;
+
+			rCtx.SetState(uRVA, B_HEAD);
+			MarkRange(rCtx, (uRVA + 1), (Insn.uLength - 1), B_TAIL);
+
+			bool bStop = false;
+			switch(Insn.eFlow)
+			{
+				case FLOW_CALL:
+				Queue(rCtx, rCtx.ToRVA(Insn.uTarget), F_FUNC);
+				break;
+
+				case FLOW_JCC:
+				Queue(rCtx, rCtx.ToRVA(Insn.uTarget), F_TARGET);
+				break;
+
+				case FLOW_JMP:
+				Queue(rCtx, rCtx.ToRVA(Insn.uTarget), F_TARGET);
+				bStop = true;
+				break;
+
+				case FLOW_JMPI:
+				if(X86_IsTableJump(Insn))
+					DecodeSwitch(rCtx, Insn, aHist, iHist);
+				bStop = true;
+				break;
+
+				case FLOW_RET:
+				case FLOW_STOP:
+				bStop = true;
+				break;
+
+				default:
+				break;
+			};
+
+			if(bStop)
+			{
+				rCtx.At(uRVA + Insn.uLength - 1) |= F_END;
+				break;
+			}
+
+			memmove(&aHist[1], &aHist[0], (sizeof(tX86INSN) * 3));
+			aHist[0] = Insn;
+			if(iHist < 4) iHist++;
+			uRVA += Insn.uLength;
+		};
+	};
+}
+
+// Returns the align run size at the RVA, or 0 if it's not one.
+// Same rule as the plugin, the run must end on a 16 boundary and short runs need code next to them.
+static uint32_t GetAlignRun(tCONTEXT &rCtx, uint32_t uRVA)
+{
+	const uint8_t *pImage = rCtx.pPE->pImage;
+	uint8_t bPad = pImage[uRVA];
+	if(!IsPadByte(bPad))
+		return(0);
+
+	uint32_t uEnd = uRVA;
+	while((uEnd < rCtx.uEnd) && (pImage[uEnd] == bPad) && (rCtx.State(uEnd) == B_UNKNOWN))
+		uEnd++;
+	if((rCtx.ToVA(uEnd) & (16 - 1)) != 0)
+		return(0);
+
+	uint32_t uCount = (uEnd - uRVA);
+	if(uCount <= 2)
+	{
+		bool bBefore = ((uRVA > rCtx.uStart) && (rCtx.At(uRVA - 1) & F_END));
+		bool bAfter  = ((uEnd < rCtx.uEnd) && (rCtx.At(uEnd) & (F_FUNC | F_TARGET)));
+		if(!bBefore && !bAfter)
+			return(0);
+	}
+	return(uCount);
+}
+
+static void MakeAlign(tCONTEXT &rCtx, uint32_t uRVA, uint32_t uCount)
+{
+	MarkRange(rCtx, uRVA, uCount, B_ALIGN);
+	EDL_Add(rCtx.pResult->Edits, EDIT_ALIGN, rCtx.ToVA(uRVA), uCount);
+	rCtx.pResult->uAligns++;
+}
+
+// Returns true if the opcode is rare in compiled code, a sign of decoding data
+static bool IsRareOpcode(const tX86INSN &r)
+{
+	if(r.bTwoByte)
+		return((r.bOpcode == 0x0B) || ((r.bOpcode >= 0x30) && (r.bOpcode <= 0x35)));
+
+	switch(r.bOpcode)
+	{
+		case 0x27: case 0x2F: case 0x37: case 0x3F: case 0x62: case 0x63:
+		case 0x6C: case 0x6D: case 0x6E: case 0x6F: case 0x8E: case 0x9A:
+		case 0xC4: case 0xC5: case 0xCE: case 0xCF: case 0xD4: case 0xD5:
+		case 0xD6: case 0xE4: case 0xE5: case 0xE6: case 0xE7: case 0xEA:
+		case 0xEC: case 0xED: case 0xEE: case 0xEF: case 0xF1: case 0xF4:
+		case 0xFA: case 0xFB:
+		return(true);
+	};
+	return(false);
+}
+
+// Gap function trial, a straight line of sane instructions to a return or jump.
+// Nothing is marked, the descent does that if it passes.
+static bool TryFunction(tCONTEXT &rCtx, uint32_t uRVA)
+{
+	const uint8_t *pImage = rCtx.pPE->pImage;
+	if(((uRVA + 2) > rCtx.uEnd) || IsPadByte(pImage[uRVA]) || ((pImage[uRVA] == 0) && (pImage[uRVA + 1] == 0)) || ((pImage[uRVA] == 0xFF) && (pImage[uRVA + 1] == 0xFF)))
+		return(false);
+
+	for(int iCount = 0; iCount < MAX_TRY_INSN; iCount++)
+	{
+		tX86INSN Insn;
+		if(!X86_Decode((pImage + uRVA), (rCtx.uEnd - uRVA), (uint32_t) rCtx.ToVA(uRVA), Insn))
+			return(false);
+		if(IsRareOpcode(Insn) || !IsUnknown(rCtx, uRVA, Insn.uLength))
+			return(false);
+
+		switch(Insn.eFlow)
+		{
+			case FLOW_CALL:
+			case FLOW_JCC:
+			if(!rCtx.InSection(rCtx.ToRVA(Insn.uTarget)))
+				return(false);
+			break;
+
+			case FLOW_JMP:
+			return(rCtx.InSection(rCtx.ToRVA(Insn.uTarget)));
+
+			case FLOW_RET:
+			case FLOW_JMPI:
+			return(iCount > 0);
+
+			case FLOW_STOP:
+			return(false);
+
+			default:
+			break;
+		};
+		uRVA += Insn.uLength;
+	}
+
+	return(false);
+}
+
+// Pass: offset tables from relocation runs, and code pointers in data
+static void PassRelocs(tCONTEXT &rCtx)
+{
+	const tPEIMAGE &rPE = *rCtx.pPE;
+
+	// Two or more relocated dwords in a row, all pointing into the section, is a jump table.
+	// A single one is just an instruction operand.
+	for(uint32_t uRVA = rCtx.uStart; (uRVA + 4) <= rCtx.uEnd; uRVA++)
+	{
+		if(!rPE.pRelocMap[uRVA >> 3] && !(uRVA & 7))
+		{
+			uRVA += 7;
+			continue;
+		}
+		if(!PE_HasReloc(rPE, uRVA) || !rCtx.InSection(rCtx.ToRVA(PE_GetLong(rPE, uRVA))))
+			continue;
+
+		uint32_t uCount = 1;
+		while(((uRVA + ((uCount + 1) * 4)) <= rCtx.uEnd) && PE_HasReloc(rPE, (uRVA + (uCount * 4))) && rCtx.InSection(rCtx.ToRVA(PE_GetLong(rPE, (uRVA + (uCount * 4))))))
+			uCount++;
+
+		if((uCount >= 2) && IsUnknown(rCtx, uRVA, (uCount * 4)))
+		{
+			MarkRange(rCtx, uRVA, (uCount * 4), B_TABLE);
+			if(rCtx.pOpt->bDataToBytes)
+				EDL_Add(rCtx.pResult->Edits, EDIT_OFFSETS, rCtx.ToVA(uRVA), (uCount * 4));
+			for(uint32_t i = 0; i < uCount; i++)
+				Queue(rCtx, rCtx.ToRVA(PE_GetLong(rPE, (uRVA + (i * 4)))), F_TARGET);
+			rCtx.pResult->uTables++;
+			uRVA += ((uCount * 4) - 1);
+		}
+	}
+
+	// Relocated code pointers in the other sections, vftables and callback tables
+	if(rCtx.pOpt->bVftables)
+	{
+		for(int i = 0; i < rPE.iSections; i++)
+		{
+			const tPESECTION &rSec = rPE.aSections[i];
+			if(rSec.uFlags & (SCN_CNT_CODE | SCN_MEM_EXECUTE))
+				continue;
+			for(uint32_t uRVA = rSec.uRVA; (uRVA + 4) <= (rSec.uRVA + rSec.uVirtualSize); uRVA++)
+			{
+				if(PE_HasReloc(rPE, uRVA))
+				{
+					uint32_t uTarget = rCtx.ToRVA(PE_GetLong(rPE, uRVA));
+					if(rCtx.InSection(uTarget) && !(rCtx.At(uTarget) & F_DATASEED))
+					{
+						Queue(rCtx, uTarget, (F_FUNC | F_DATASEED));
+						rCtx.pResult->uDataSeeds++;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Pass: follow the code from the entry point and exports, plus what the relocs pass queued
+static void PassCode(tCONTEXT &rCtx)
+{
+	const tPEIMAGE &rPE = *rCtx.pPE;
+	Queue(rCtx, rPE.uEntryRVA, F_FUNC);
+	for(uint32_t i = 0; i < rPE.uExports; i++)
+		Queue(rCtx, rPE.pExports[i], F_FUNC);
+	Descend(rCtx);
+}
+
+// Pass: align blocks
+static void PassAlign(tCONTEXT &rCtx)
+{
+	for(uint32_t uRVA = rCtx.uStart; uRVA < rCtx.uEnd; )
+	{
+		if(rCtx.State(uRVA) == B_UNKNOWN)
+		{
+			if(uint32_t uCount = GetAlignRun(rCtx, uRVA))
+			{
+				MakeAlign(rCtx, uRVA, uCount);
+				uRVA += uCount;
+				continue;
+			}
+		}
+		uRVA++;
+	}
+}
+
+// Pass: functions in the gaps, tried after an align block, after code, or on a 16 boundary
+static void PassFunctions(tCONTEXT &rCtx)
+{
+	for(uint32_t uRVA = rCtx.uStart; (uRVA < rCtx.uEnd) && !TimeUp(rCtx); )
+	{
+		if(rCtx.State(uRVA) != B_UNKNOWN)
+		{
+			uRVA++;
+			continue;
+		}
+
+		if(rCtx.pOpt->bAlignBlocks)
+		{
+			if(uint32_t uCount = GetAlignRun(rCtx, uRVA))
+			{
+				MakeAlign(rCtx, uRVA, uCount);
+				uRVA += uCount;
+				continue;
+			}
+		}
+
+		bool bPlausible = ((rCtx.ToVA(uRVA) & (16 - 1)) == 0);
+		if(!bPlausible && (uRVA > rCtx.uStart))
+		{
+			uint8_t bPrev = rCtx.At(uRVA - 1);
+			bPlausible = (((bPrev & B_MASK) == B_ALIGN) || (bPrev & F_END));
+		}
+
+		if(bPlausible && TryFunction(rCtx, uRVA))
+		{
+			Queue(rCtx, uRVA, F_FUNC);
+			Descend(rCtx);
+			rCtx.pResult->uGapFunctions++;
+			continue;
+		}
+		uRVA++;
+	}
+}
+
+// Pass: stray data to unknown, and the function list
+static void PassData(tCONTEXT &rCtx)
+{
+	if(rCtx.pOpt->bDataToBytes)
+	{
+		for(uint32_t uRVA = rCtx.uStart; uRVA < rCtx.uEnd; )
+		{
+			if(rCtx.State(uRVA) != B_UNKNOWN)
+			{
+				uRVA++;
+				continue;
+			}
+
+			uint32_t uEnd = (uRVA + 1);
+			while((uEnd < rCtx.uEnd) && (rCtx.State(uEnd) == B_UNKNOWN))
+				uEnd++;
+			EDL_Add(rCtx.pResult->Edits, EDIT_UNDEFINE, rCtx.ToVA(uRVA), (uEnd - uRVA));
+			rCtx.pResult->uUnknowns++;
+			uRVA = uEnd;
+		}
+	}
+
+	if(rCtx.pOpt->bMissingFunc || rCtx.pOpt->bVftables)
+	{
+		uint8_t bWant = (rCtx.pOpt->bMissingFunc ? F_FUNC : F_DATASEED);
+		for(uint32_t uRVA = rCtx.uStart; uRVA < rCtx.uEnd; uRVA++)
+		{
+			uint8_t b = rCtx.At(uRVA);
+			if(((b & B_MASK) == B_HEAD) && (b & bWant))
+			{
+				EDL_Add(rCtx.pResult->Edits, EDIT_FUNC, rCtx.ToVA(uRVA), 0);
+				rCtx.pResult->uFunctions++;
+			}
+		}
+	}
+}
+
+static void ProcessSection(tCONTEXT &rCtx)
+{
+	uint64_t uSize = (rCtx.uEnd - rCtx.uStart);
+	tPASS_STAT *pStats = rCtx.pResult->aPass;
+	double dTime = ENG_GetTime();
+
+	#define TIME_PASS(_pass, _call) \
+	{ \
+		_call; \
+		double dNow = ENG_GetTime(); \
+		pStats[_pass].dSeconds += (dNow - dTime); \
+		pStats[_pass].uBytes   += uSize; \
+		dTime = dNow; \
+	}
+
+	TIME_PASS(PASS_RELOCS, PassRelocs(rCtx));
+	TIME_PASS(PASS_CODE, PassCode(rCtx));
+	if(rCtx.pOpt->bAlignBlocks)
+		TIME_PASS(PASS_ALIGN, PassAlign(rCtx));
+	if(rCtx.pOpt->bMissingFunc)
+		TIME_PASS(PASS_FUNCS, PassFunctions(rCtx));
+	TIME_PASS(PASS_DATA, PassData(rCtx));
+	#undef TIME_PASS
+}
+
+
+// ****************************************************************************
+// Func: ENG_Process()
+// Desc: Run the passes over the code section(s) of a loaded image.
+//       Edits come out sorted in apply order.
+// ****************************************************************************
+bool ENG_Process(const tPEIMAGE &rPE, const tENGINE_OPTIONS &rOptions, tENGINE_RESULT &rResult)
+{
+	memset(&rResult, 0, sizeof(rResult));
+	EDL_Init(rResult.Edits);
+	rResult.Edits.uImageBase = rPE.uImageBase;
+
+	int iDone = 0;
+	for(int i = 0; i < rPE.iSections; i++)
+	{
+		const tPESECTION &rSec = rPE.aSections[i];
+		if(!(rSec.uFlags & (SCN_CNT_CODE | SCN_MEM_EXECUTE)) || (rSec.uVirtualSize == 0) || (rSec.uRVA >= rPE.uSizeOfImage))
+			continue;
+
+		tCONTEXT Ctx;
+		Ctx.pPE     = &rPE;
+		Ctx.pOpt    = &rOptions;
+		Ctx.pResult = &rResult;
+		Ctx.uStart  = rSec.uRVA;
+		Ctx.uEnd    = (rSec.uRVA + rSec.uVirtualSize);
+		if(!(Ctx.pMap = (uint8_t *) calloc(rSec.uVirtualSize, 1)))
+			break;
+
+		Ctx.uTicks  = 0;
+		ProcessSection(Ctx);
+		free(Ctx.pMap);
+		iDone++;
+
+		if(!rOptions.bAllCode || rResult.bTimedOut)
+			break;
+	}
+
+	EDL_Sort(rResult.Edits);
+	return((iDone > 0) && !rResult.bTimedOut);
+}
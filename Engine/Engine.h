@@ -0,0 +1,64 @@
+// ****************************************************************************
+// File: Engine.h
+// Desc: Standalone ExtraPass engine.
+//       The plugin's function, align and data decisions made straight from a PE file,
+//       with no IDA, output as an edit list.
+//
+// ****************************************************************************
+#pragma once
+#include "PeImage.h"
+#include "EditList.h"
+
+// Processing steps, same numbering as the plugin.
+// Code is always followed from the entry, exports and tables, it stands in for the IDA auto-analysis.
+// Step 5 works on IDA's own function chunks, so it stays in the plugin.
+struct tENGINE_OPTIONS
+{
+	bool bDataToBytes;		// 1 Stray data in code to unknown, offset and index tables
+	bool bAlignBlocks;		// 2 Align blocks
+	bool bMissingFunc;		// 4 Functions in the gaps
+	bool bVftables;			// 6 Methods from code pointers in data
+	bool bAllCode;			// All code sections, else the first only
+	double dDeadline;		// ENG_GetTime() to give up at, 0 for none
+};
+
+// Per pass timing
+enum ePASS
+{
+	PASS_RELOCS,
+	PASS_CODE,
+	PASS_ALIGN,
+	PASS_FUNCS,
+	PASS_DATA,
+
+	PASS_COUNT
+};
+
+struct tPASS_STAT
+{
+	double   dSeconds;
+	uint64_t uBytes;
+};
+
+struct tENGINE_RESULT
+{
+	tEDITLIST  Edits;
+	tPASS_STAT aPass[PASS_COUNT];
+	uint32_t uFunctions;
+	uint32_t uGapFunctions;
+	uint32_t uAligns;
+	uint32_t uUnknowns;
+	uint32_t uTables;
+	uint32_t uSwitches;
+	uint32_t uDataSeeds;
+	bool bTimedOut;			// Stopped at the deadline, the edits are partial
+};
+
+void ENG_DefaultOptions(tENGINE_OPTIONS &rOptions);
+
+// Run the passes over the loaded image, returns false if there was nothing to do or it timed out
+bool ENG_Process(const tPEIMAGE &rPE, const tENGINE_OPTIONS &rOptions, tENGINE_RESULT &rResult);
+void ENG_FreeResult(tENGINE_RESULT &rResult);
+
+const char *ENG_PassName(int iPass);
+double ENG_GetTime();
@@ -0,0 +1,218 @@
+// ****************************************************************************
+// File: PeImage.cpp
+// Desc: Minimal 32 bit PE file loader
+//
+// ****************************************************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PeImage.h"
+
+// Sanity limit, nothing legit is bigger
+#define MAX_IMAGE_SIZE (512 * 1024 * 1024)
+
+// Data directory indexes
+#define DIR_EXPORT 0
+#define DIR_RELOC  5
+
+// Relocation type
+#define REL_HIGHLOW 3
+
+static uint16_t Get16(const uint8_t *p){ return(p[0] | (p[1] << 8)); }
+static uint32_t Get32(const uint8_t *p){ return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24)); }
+
+static bool Fail(char *pszError, size_t uErrorSize, const char *pszReason)
+{
+	snprintf(pszError, uErrorSize, "%s", pszReason);
+	return(false);
+}
+
+// Walk the ".reloc" blocks, setting the map bit for each HIGHLOW entry
+static void LoadRelocs(tPEIMAGE &rPE, uint32_t uRVA, uint32_t uSize)
+{
+	if((uRVA >= rPE.uSizeOfImage) || (uSize > (rPE.uSizeOfImage - uRVA)))
+		return;
+
+	const uint8_t *p = (rPE.pImage + uRVA), *pEnd = (p + uSize);
+	while((p + 8) <= pEnd)
+	{
+		uint32_t uPage  = Get32(p);
+		uint32_t uBlock = Get32(p + 4);
+		if((uBlock < 8) || (uBlock > (uint32_t) (pEnd - p)))
+			break;
+
+		for(uint32_t i = 8; (i + 2) <= uBlock; i += 2)
+		{
+			uint16_t wEntry = Get16(p + i);
+			if((wEntry >> 12) == REL_HIGHLOW)
+			{
+				// The page comes from the file, test without wrapping around
+				uint32_t uTarget = (uPage + (wEntry & 0xFFF));
+				if((uTarget >= uPage) && (uTarget < rPE.uSizeOfImage) && ((rPE.uSizeOfImage - uTarget) >= 4))
+				{
+					rPE.pRelocMap[uTarget >> 3] |= (1 << (uTarget & 7));
+					rPE.uRelocs++;
+				}
+			}
+		}
+		p += uBlock;
+	};
+}
+
+// Collect the exported function RVAs, skipping forwarders
+static void LoadExports(tPEIMAGE &rPE, uint32_t uRVA, uint32_t uSize)
+{
+	if((uRVA >= rPE.uSizeOfImage) || (40 > (rPE.uSizeOfImage - uRVA)))
+		return;
+
+	const uint8_t *pDir = (rPE.pImage + uRVA);
+	uint32_t uCount = Get32(pDir + 20);
+	uint32_t uTable = Get32(pDir + 28);
+	if((uCount == 0) || (uCount > 0x100000) || (uTable >= rPE.uSizeOfImage) || ((uCount * 4) > (rPE.uSizeOfImage - uTable)))
+		return;
+
+	if(!(rPE.pExports = (uint32_t *) malloc(uCount * sizeof(uint32_t))))
+		return;
+	for(uint32_t i = 0; i < uCount; i++)
+	{
+		uint32_t uFunc = Get32(rPE.pImage + uTable + (i * 4));
+		if(uFunc && !((uFunc >= uRVA) && ((uFunc - uRVA) < uSize)))
+			rPE.pExports[rPE.uExports++] = uFunc;
+	}
+}
+
+bool PE_Load(const char *pszFile, tPEIMAGE &rPE, char *pszError, size_t uErrorSize)
+{
+	memset(&rPE, 0, sizeof(rPE));
+
+	FILE *fp = fopen(pszFile, "rb");
+	if(!fp)
+		return(Fail(pszError, uErrorSize, "Can't open file"));
+	fseek(fp, 0, SEEK_END);
+	long lSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if((lSize < 0x200) || (lSize > MAX_IMAGE_SIZE))
+	{
+		fclose(fp);
+		return(Fail(pszError, uErrorSize, "Bad file size"));
+	}
+
+	uint8_t *pFile = (uint8_t *) malloc(lSize);
+	if(!pFile)
+	{
+		fclose(fp);
+		return(Fail(pszError, uErrorSize, "Out of memory"));
+	}
+	bool bRead = (fread(pFile, 1, lSize, fp) == (size_t) lSize);
+	fclose(fp);
+	rPE.uFileSize = lSize;
+
+	bool bResult = false;
+	const char *pszReason = "Read failed";
+	do
+	{
+		if(!bRead) break;
+
+		// DOS and NT headers
+		pszReason = "Not a PE file";
+		if(Get16(pFile) != 0x5A4D) break;
+		uint32_t uNT = Get32(pFile + 0x3C);
+		if((uNT > (uint32_t) lSize) || ((uNT + 0xF8) > (uint32_t) lSize)) break;
+		const uint8_t *pNT = (pFile + uNT);
+		if(Get32(pNT) != 0x00004550) break;
+
+		pszReason = "Not a 32 bit x86 PE";
+		if(Get16(pNT + 4) != 0x014C) break;
+		const uint8_t *pOpt = (pNT + 24);
+		if(Get16(pOpt) != 0x010B) break;
+
+		pszReason = "Bad headers";
+		uint32_t uSections = Get16(pNT + 6);
+		uint32_t uOptSize  = Get16(pNT + 20);
+		rPE.uEntryRVA    = Get32(pOpt + 16);
+		rPE.uImageBase   = Get32(pOpt + 28);
+		rPE.uSizeOfImage = Get32(pOpt + 56);
+		uint32_t uHeaders = Get32(pOpt + 60);
+		uint32_t uDirs    = Get32(pOpt + 92);
+		if((rPE.uSizeOfImage == 0) || (rPE.uSizeOfImage > MAX_IMAGE_SIZE)) break;
+		if((uSections == 0) || (uSections > (sizeof(rPE.aSections) / sizeof(tPESECTION)))) break;
+		uint32_t uSecTable = (uNT + 24 + uOptSize);
+		if((uSecTable + (uSections * 40)) > (uint32_t) lSize) break;
+
+		pszReason = "Out of memory";
+		if(!(rPE.pImage = (uint8_t *) calloc(rPE.uSizeOfImage, 1))) break;
+		if(!(rPE.pRelocMap = (uint8_t *) calloc(((rPE.uSizeOfImage + 7) >> 3), 1))) break;
+
+		// Map headers and sections, clipping anything out of bounds
+		if(uHeaders > rPE.uSizeOfImage) uHeaders = rPE.uSizeOfImage;
+		if(uHeaders > (uint32_t) lSize)  uHeaders = (uint32_t) lSize;
+		memcpy(rPE.pImage, pFile, uHeaders);
+		for(uint32_t i = 0; i < uSections; i++)
+		{
+			const uint8_t *pSec = (pFile + uSecTable + (i * 40));
+			tPESECTION &rSec = rPE.aSections[rPE.iSections++];
+			memcpy(rSec.szName, pSec, 8);
+			rSec.szName[8]    = 0;
+			rSec.uVirtualSize = Get32(pSec + 8);
+			rSec.uRVA         = Get32(pSec + 12);
+			rSec.uRawSize     = Get32(pSec + 16);
+			rSec.uRawOffset   = Get32(pSec + 20);
+			rSec.uFlags       = Get32(pSec + 36);
+			if(rSec.uVirtualSize == 0)
+				rSec.uVirtualSize = rSec.uRawSize;
+
+			if(rSec.uRVA >= rPE.uSizeOfImage)
+				continue;
+			uint32_t uVSize = rSec.uVirtualSize;
+			if(uVSize > (rPE.uSizeOfImage - rSec.uRVA))
+				uVSize = rSec.uVirtualSize = (rPE.uSizeOfImage - rSec.uRVA);
+			uint32_t uCopy = ((rSec.uRawSize < uVSize) ? rSec.uRawSize : uVSize);
+			if(rSec.uRawOffset >= (uint32_t) lSize)
+				uCopy = 0;
+			else
+			if(uCopy > ((uint32_t) lSize - rSec.uRawOffset))
+				uCopy = ((uint32_t) lSize - rSec.uRawOffset);
+			if(uCopy)
+				memcpy((rPE.pImage + rSec.uRVA), (pFile + rSec.uRawOffset), uCopy);
+		}
+
+		// Directories
+		const uint8_t *pDirs = (pOpt + 96);
+		if(uDirs > DIR_EXPORT)
+			LoadExports(rPE, Get32(pDirs + (DIR_EXPORT * 8)), Get32(pDirs + (DIR_EXPORT * 8) + 4));
+		if(uDirs > DIR_RELOC)
+			LoadRelocs(rPE, Get32(pDirs + (DIR_RELOC * 8)), Get32(pDirs + (DIR_RELOC * 8) + 4));
+
+		bResult = true;
+
+	}while(false);
+
+	free(pFile);
+	if(!bResult)
+	{
+		PE_Free(rPE);
+		return(Fail(pszError, uErrorSize, pszReason));
+	}
+	return(true);
+}
+
+void PE_Free(tPEIMAGE &rPE)
+{
+	free(rPE.pImage);
+	free(rPE.pRelocMap);
+	free(rPE.pExports);
+	rPE.pImage = rPE.pRelocMap = NULL;
+	rPE.pExports = NULL;
+	rPE.uExports = rPE.uRelocs = 0;
+}
+
+bool PE_IsCode(const tPEIMAGE &rPE, uint32_t uRVA)
+{
+	for(int i = 0; i < rPE.iSections; i++)
+	{
+		const tPESECTION &rSec = rPE.aSections[i];
+		if((rSec.uFlags & (SCN_CNT_CODE | SCN_MEM_EXECUTE)) && (uRVA >= rSec.uRVA) && (uRVA < (rSec.uRVA + rSec.uVirtualSize)))
+			return(true);
+	}
+	return(false);
+}
@@ -0,0 +1,62 @@
+// ****************************************************************************
+// File: PeImage.h
+// Desc: Minimal 32 bit PE file loader for the standalone engine.
+//       Maps the sections to a flat image and collects relocations and exports.
+//
+// ****************************************************************************
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Section characteristics used
+#define SCN_CNT_CODE    0x00000020
+#define SCN_MEM_EXECUTE 0x20000000
+
+struct tPESECTION
+{
+	char     szName[9];
+	uint32_t uRVA;
+	uint32_t uVirtualSize;
+	uint32_t uRawOffset;
+	uint32_t uRawSize;
+	uint32_t uFlags;
+};
+
+struct tPEIMAGE
+{
+	uint32_t   uImageBase;
+	uint32_t   uSizeOfImage;
+	uint32_t   uEntryRVA;
+	uint8_t   *pImage;			// Mapped image, "uSizeOfImage" bytes
+	uint64_t   uFileSize;
+
+	tPESECTION aSections[96];
+	int        iSections;
+
+	uint8_t   *pRelocMap;		// Bit per image byte, set where a 32 bit absolute relocation starts
+	uint32_t   uRelocs;
+
+	uint32_t  *pExports;		// Exported function RVAs
+	uint32_t   uExports;
+};
+
+// Load a PE file, on failure returns false with the reason in "pszError"
+bool PE_Load(const char *pszFile, tPEIMAGE &rPE, char *pszError, size_t uErrorSize);
+void PE_Free(tPEIMAGE &rPE);
+
+// Returns true if a 32 bit absolute relocation starts at the RVA
+inline bool PE_HasReloc(const tPEIMAGE &rPE, uint32_t uRVA)
+{
+	return((uRVA < rPE.uSizeOfImage) && (rPE.pRelocMap[uRVA >> 3] & (1 << (uRVA & 7))));
+}
+
+// Returns true if the RVA is inside a code section
+bool PE_IsCode(const tPEIMAGE &rPE, uint32_t uRVA);
+
+// Read a dword at the RVA, 0 if out of bounds
+inline uint32_t PE_GetLong(const tPEIMAGE &rPE, uint32_t uRVA)
+{
+	if((uRVA >= rPE.uSizeOfImage) || ((rPE.uSizeOfImage - uRVA) < 4))
+		return(0);
+	return(rPE.pImage[uRVA] | (rPE.pImage[uRVA + 1] << 8) | (rPE.pImage[uRVA + 2] << 16) | ((uint32_t) rPE.pImage[uRVA + 3] << 24));
+}
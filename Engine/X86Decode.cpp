@@ -0,0 +1,257 @@
+// ****************************************************************************
+// File: X86Decode.cpp
+// Desc: Minimal 32 bit x86 instruction length and flow decoder
+//
+// ****************************************************************************
+#include <string.h>
+#include "X86Decode.h"
+
+// One byte opcode table attribute flags
+#define F_MODRM  0x01	// Has a ModRM byte
+#define F_IMM8   0x02	// 8 bit immediate
+#define F_IMM16  0x04	// 16 bit immediate
+#define F_IMMZ   0x08	// 32 bit immediate, 16 with 66 prefix
+#define F_MOFFS  0x10	// Address size memory offset
+#define F_FAR    0x20	// Far pointer, 16:32
+#define F_PREFIX 0x40	// Prefix byte
+#define F_GRP3   0x80	// F6/F7 group, immediate only for /0 and /1
+
+#define M F_MODRM
+#define I8 F_IMM8
+#define IZ F_IMMZ
+
+static const uint8_t s_abOneByte[256] =
+{
+	//        0       1       2       3       4       5       6         7       8       9       A       B       C       D       E         F
+	/* 00 */  M,      M,      M,      M,      I8,     IZ,     0,        0,      M,      M,      M,      M,      I8,     IZ,     0,        0,
+	/* 10 */  M,      M,      M,      M,      I8,     IZ,     0,        0,      M,      M,      M,      M,      I8,     IZ,     0,        0,
+	/* 20 */  M,      M,      M,      M,      I8,     IZ,     F_PREFIX, 0,      M,      M,      M,      M,      I8,     IZ,     F_PREFIX, 0,
+	/* 30 */  M,      M,      M,      M,      I8,     IZ,     F_PREFIX, 0,      M,      M,      M,      M,      I8,     IZ,     F_PREFIX, 0,
+	/* 40 */  0,      0,      0,      0,      0,      0,      0,        0,      0,      0,      0,      0,      0,      0,      0,        0,
+	/* 50 */  0,      0,      0,      0,      0,      0,      0,        0,      0,      0,      0,      0,      0,      0,      0,        0,
+	/* 60 */  0,      0,      M,      M,      F_PREFIX,F_PREFIX,F_PREFIX,F_PREFIX,IZ,   M|IZ,   I8,     M|I8,   0,      0,      0,        0,
+	/* 70 */  I8,     I8,     I8,     I8,     I8,     I8,     I8,       I8,     I8,     I8,     I8,     I8,     I8,     I8,     I8,       I8,
+	/* 80 */  M|I8,   M|IZ,   M|I8,   M|I8,   M,      M,      M,        M,      M,      M,      M,      M,      M,      M,      M,        M,
+	/* 90 */  0,      0,      0,      0,      0,      0,      0,        0,      0,      0,      F_FAR,  0,      0,      0,      0,        0,
+	/* A0 */  F_MOFFS,F_MOFFS,F_MOFFS,F_MOFFS,0,      0,      0,        0,      I8,     IZ,     0,      0,      0,      0,      0,        0,
+	/* B0 */  I8,     I8,     I8,     I8,     I8,     I8,     I8,       I8,     IZ,     IZ,     IZ,     IZ,     IZ,     IZ,     IZ,       IZ,
+	/* C0 */  M|I8,   M|I8,   F_IMM16,0,      M,      M,      M|I8,     M|IZ,   F_IMM16|I8,0,   F_IMM16,0,      0,      I8,     0,        0,
+	/* D0 */  M,      M,      M,      M,      I8,     I8,     0,        0,      M,      M,      M,      M,      M,      M,      M,        M,
+	/* E0 */  I8,     I8,     I8,     I8,     I8,     I8,     I8,       I8,     IZ,     IZ,     F_FAR,  I8,     0,      0,      0,        0,
+	/* F0 */  F_PREFIX,0,     F_PREFIX,F_PREFIX,0,    0,      M|F_GRP3, M|F_GRP3,0,     0,      0,      0,      0,      0,      M,        M,
+};
+
+// Two byte (0F xx) opcodes without a ModRM byte
+static bool NoModRM2(uint8_t b)
+{
+	return((b <= 0x0F && b != 0x00 && b != 0x01 && b != 0x02 && b != 0x03 && b != 0x0D) ||
+		   ((b >= 0x30) && (b <= 0x37)) || (b == 0x77) || ((b >= 0x80) && (b <= 0x8F)) ||
+		   (b == 0xA0) || (b == 0xA1) || (b == 0xA2) || (b == 0xA8) || (b == 0xA9) || (b == 0xAA) ||
+		   ((b >= 0xC8) && (b <= 0xCF)));
+}
+
+// Two byte opcodes with an 8 bit immediate
+static bool Imm8Op2(uint8_t b)
+{
+	return(((b >= 0x70) && (b <= 0x73)) || (b == 0xA4) || (b == 0xAC) || (b == 0xBA) || (b == 0xC2) ||
+		   (b == 0xC4) || (b == 0xC5) || (b == 0xC6));
+}
+
+bool X86_Decode(const uint8_t *pb, uint32_t uAvail, uint32_t uEA, tX86INSN &r)
+{
+	memset(&r, 0, sizeof(r));
+	uint32_t uPos = 0;
+	#define NEED(_n) if((uPos + (_n)) > uAvail) return(false)
+
+	// Prefixes
+	uint8_t bFlags;
+	while(true)
+	{
+		NEED(1);
+		bFlags = s_abOneByte[pb[uPos]];
+		if(!(bFlags & F_PREFIX))
+			break;
+		if(pb[uPos] == 0x66) r.bOpSize16 = true;
+		else
+		if(pb[uPos] == 0x67) r.bAddrSize16 = true;
+		if(++uPos >= 14)
+			return(false);
+	};
+
+	uint8_t bOp = pb[uPos++];
+	r.bOpcode = bOp;
+	uint32_t uImmSize = 0, uImm2Size = 0;
+
+	if(((bOp == 0xC4) || (bOp == 0xC5)) && (uPos < uAvail) && ((pb[uPos] & 0xC0) == 0xC0))
+	{
+		// VEX prefix, "les/lds" can't have a register operand in 32 bit mode
+		uint32_t uMap = 1;
+		if(bOp == 0xC4)
+		{
+			NEED(2);
+			uMap = (pb[uPos] & 0x1F);
+			uPos += 2;
+		}
+		else
+			uPos++;
+
+		NEED(1);
+		bOp = pb[uPos++];
+		r.bOpcode   = bOp;
+		r.bTwoByte  = true;
+		r.bHasModRM = !((uMap == 1) && (bOp == 0x77)); // "vzeroupper/vzeroall"
+		if((uMap == 3) || ((uMap == 1) && Imm8Op2(bOp))) uImmSize = 1;
+	}
+	else
+	if(bOp == 0x0F)
+	{
+		NEED(1);
+		bOp = pb[uPos++];
+		r.bOpcode  = bOp;
+		r.bTwoByte = true;
+
+		if((bOp == 0x38) || (bOp == 0x3A))
+		{
+			// Three byte opcodes, all with a ModRM
+			NEED(1);
+			uPos++;
+			r.bHasModRM = true;
+			if(bOp == 0x3A) uImmSize = 1;
+		}
+		else
+		{
+			r.bHasModRM = !NoModRM2(bOp);
+			if(Imm8Op2(bOp)) uImmSize = 1;
+			if((bOp >= 0x80) && (bOp <= 0x8F)) uImmSize = (r.bOpSize16 ? 2 : 4);
+		}
+	}
+	else
+	{
+		r.bHasModRM = ((bFlags & F_MODRM) != 0);
+		if(bFlags & F_IMM8)  uImmSize = 1;
+		if(bFlags & F_IMM16) { uImm2Size = uImmSize; uImmSize = 2; }
+		if(bFlags & F_IMMZ)  uImmSize = (r.bOpSize16 ? 2 : 4);
+		if(bFlags & F_MOFFS) uImmSize = (r.bAddrSize16 ? 2 : 4);
+		if(bFlags & F_FAR)   uImmSize = (r.bOpSize16 ? 4 : 6);
+	}
+
+	// ModRM, SIB and displacement
+	if(r.bHasModRM)
+	{
+		NEED(1);
+		r.bModRM = pb[uPos++];
+		uint32_t uMod = r.Mod(), uRm = r.Rm();
+
+		if(r.bAddrSize16)
+		{
+			if(((uMod == 0) && (uRm == 6)) || (uMod == 2)) r.uDispSize = 2;
+			else
+			if(uMod == 1) r.uDispSize = 1;
+		}
+		else
+		if(uMod != 3)
+		{
+			if(uRm == 4)
+			{
+				NEED(1);
+				r.bHasSIB = true;
+				r.bSIB = pb[uPos++];
+				if((uMod == 0) && (r.Base() == 5)) r.uDispSize = 4;
+			}
+			if((uMod == 0) && (uRm == 5)) r.uDispSize = 4;
+			else
+			if(uMod == 1) r.uDispSize = 1;
+			else
+			if(uMod == 2) r.uDispSize = 4;
+		}
+
+		if(!r.bTwoByte && (bFlags & F_GRP3))
+			uImmSize = (r.Reg() <= 1) ? ((bOp == 0xF6) ? 1 : (r.bOpSize16 ? 2 : 4)) : 0;
+	}
+
+	if(r.uDispSize)
+	{
+		NEED(r.uDispSize);
+		if(r.uDispSize == 1)      r.iDisp = (int8_t) pb[uPos];
+		else if(r.uDispSize == 2) r.iDisp = (int16_t) (pb[uPos] | (pb[uPos + 1] << 8));
+		else                      memcpy(&r.iDisp, &pb[uPos], 4);
+		uPos += r.uDispSize;
+	}
+
+	if(uImmSize)
+	{
+		NEED(uImmSize + uImm2Size);
+		if(uImmSize == 1)      r.uImm = pb[uPos];
+		else if(uImmSize == 2) r.uImm = (pb[uPos] | (pb[uPos + 1] << 8));
+		else                   memcpy(&r.uImm, &pb[uPos], 4);
+		r.uImmSize = uImmSize;
+		uPos += (uImmSize + uImm2Size);
+	}
+
+	if(uPos > 15)
+		return(false);
+	r.uLength = uPos;
+	#undef NEED
+
+	// Flow classification
+	uint32_t uNext = (uEA + uPos);
+	if(r.bTwoByte)
+	{
+		if((bOp >= 0x80) && (bOp <= 0x8F)) { r.eFlow = FLOW_JCC; r.uTarget = (uNext + (int32_t) r.uImm); }
+		else
+		if(bOp == 0x0B) r.eFlow = FLOW_STOP; // ud2
+	}
+	else
+	{
+		switch(bOp)
+		{
+			case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+			case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+			case 0xE0: case 0xE1: case 0xE2: case 0xE3:
+			r.eFlow = FLOW_JCC;
+			r.uTarget = (uNext + (int8_t) r.uImm);
+			break;
+
+			case 0xEB:
+			r.eFlow = FLOW_JMP;
+			r.uTarget = (uNext + (int8_t) r.uImm);
+			break;
+
+			case 0xE9:
+			r.eFlow = FLOW_JMP;
+			r.uTarget = (uNext + (int32_t) r.uImm);
+			break;
+
+			case 0xE8:
+			r.eFlow = FLOW_CALL;
+			r.uTarget = (uNext + (int32_t) r.uImm);
+			break;
+
+			case 0xC2: case 0xC3: case 0xCA: case 0xCB: case 0xCF:
+			r.eFlow = FLOW_RET;
+			break;
+
+			case 0xCC: case 0xF4:
+			r.eFlow = FLOW_STOP;
+			break;
+
+			case 0xEA:
+			r.eFlow = FLOW_JMPI;
+			break;
+
+			case 0xFF:
+			if((r.Reg() == 2) || (r.Reg() == 3)) r.eFlow = FLOW_CALLI;
+			else
+			if((r.Reg() == 4) || (r.Reg() == 5)) r.eFlow = FLOW_JMPI;
+			break;
+		};
+	}
+
+	return(true);
+}
+
+bool X86_IsTableJump(const tX86INSN &r)
+{
+	return(!r.bTwoByte && (r.bOpcode == 0xFF) && (r.Reg() == 4) && r.bHasSIB && (r.Mod() == 0) &&
+		   (r.Base() == 5) && (r.Scale() == 2) && (r.Index() != 4));
+}
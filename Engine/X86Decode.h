@@ -0,0 +1,54 @@
+// ****************************************************************************
+// File: X86Decode.h
+// Desc: Minimal 32 bit x86 instruction length and flow decoder
+//       for the standalone engine. Enough to follow code, not to disassemble it.
+//
+// ****************************************************************************
+#pragma once
+#include <stdint.h>
+
+// Instruction flow types
+enum eFLOW
+{
+	FLOW_NONE,	// Falls through to the next instruction
+	FLOW_JCC,	// Conditional branch, both ways
+	FLOW_JMP,	// Direct jump
+	FLOW_JMPI,	// Indirect jump (maybe a switch)
+	FLOW_CALL,	// Direct call
+	FLOW_CALLI,	// Indirect call
+	FLOW_RET,	// Any return
+	FLOW_STOP,	// "int 3", "hlt", "ud2", no fall through
+};
+
+// Decoded instruction
+struct tX86INSN
+{
+	uint32_t uLength;
+	eFLOW    eFlow;
+	uint32_t uTarget;		// Branch target for direct branches
+
+	uint8_t  bOpcode;		// Primary opcode, second byte if "bTwoByte"
+	bool     bTwoByte;		// 0F xx opcode
+	bool     bHasModRM, bHasSIB;
+	uint8_t  bModRM, bSIB;
+	int32_t  iDisp;			// Memory displacement, if any
+	uint32_t uDispSize;
+	uint32_t uImm;			// First immediate, if any
+	uint32_t uImmSize;
+	bool     bOpSize16;		// 66 prefix
+	bool     bAddrSize16;	// 67 prefix
+
+	inline uint32_t Mod() const { return(bModRM >> 6); }
+	inline uint32_t Reg() const { return((bModRM >> 3) & 7); }
+	inline uint32_t Rm() const { return(bModRM & 7); }
+	inline uint32_t Scale() const { return(bSIB >> 6); }
+	inline uint32_t Index() const { return((bSIB >> 3) & 7); }
+	inline uint32_t Base() const { return(bSIB & 7); }
+};
+
+// Decode one instruction at "pb" (virtual address "uEA"), with "uAvail" bytes readable.
+// Returns false on a bad or truncated instruction.
+bool X86_Decode(const uint8_t *pb, uint32_t uAvail, uint32_t uEA, tX86INSN &rInsn);
+
+// Returns true if the instruction is "jmp [disp32 + reg*4]", the switch table jump
+bool X86_IsTableJump(const tX86INSN &rInsn);
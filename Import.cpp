@@ -0,0 +1,215 @@
+// ****************************************************************************
+// File: Import.cpp
+// Desc: Applies an edit list made by the standalone engine ("Engine" folder)
+//       to the IDB in one batch.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include <WaitBoxEx.h>
+#include "Engine/EditList.h"
+
+// Apply counts per edit kind
+static UINT s_auApplied[EDIT_KINDS];
+
+extern void JRN_Range(ea_t ea, asize_t Size);
+extern void JRN_AddFunc(ea_t ea);
+extern void JRN_DelFunc(ea_t ea);
+extern void JRN_Tail(ea_t eaOwner, ea_t eaStart, ea_t eaEnd);
+
+// Make the data items in the range unknown, code is left alone like step 1 does
+static BOOL UndefineData(ea_t eaStart, ea_t eaEnd)
+{
+	BOOL bResult = FALSE;
+	ea_t ea = get_item_head(eaStart);
+	while((ea != BADADDR) && (ea < eaEnd))
+	{
+		if(isData(getFlags(ea)))
+		{
+			JRN_Range(ea, get_item_size(ea));
+			do_unknown(ea, DOUNK_SIMPLE);
+			bResult = TRUE;
+		}
+		ea = next_head(ea, eaEnd);
+	};
+	return(bResult);
+}
+
+// Apply one edit, returns TRUE if it took
+static BOOL ApplyEdit(const tEDIT &rEdit, adiff_t Delta)
+{
+	ea_t ea = (ea_t) (rEdit.uEA + Delta);
+	asize_t Size = (asize_t) rEdit.uSize;
+
+	switch(rEdit.uKind)
+	{
+		case EDIT_DELFUNC:
+		JRN_DelFunc(ea);
+		return(del_func(ea));
+
+		case EDIT_UNDEFINE:
+		return(UndefineData(ea, (ea + Size)));
+
+		case EDIT_BYTES:
+		if(isCode(getFlags(ea)))
+			return(FALSE);
+		JRN_Range(ea, Size);
+		do_unknown_range(ea, Size, DOUNK_SIMPLE);
+		return(doByte(ea, Size));
+
+		case EDIT_OFFSETS:
+		if(isCode(getFlags(ea)))
+			return(FALSE);
+		JRN_Range(ea, Size);
+		do_unknown_range(ea, Size, DOUNK_SIMPLE);
+		return(doDwrd(ea, Size) && op_offset(ea, 0, REF_OFF32));
+
+		case EDIT_ALIGN:
+		{
+			if(isCode(getFlags(ea)) || isAlign(getFlags(ea)))
+				return(FALSE);
+			JRN_Range(ea, Size);
+			do_unknown_range(ea, Size, DOUNK_SIMPLE);
+
+			// Same retries as step 2
+			return(doAlign(ea, Size, 0) || doAlign(ea, Size, 32) || doAlign(ea, Size, 16));
+		}
+
+		case EDIT_CODE:
+		{
+			if(isCode(getFlags(ea)))
+				return(FALSE);
+			JRN_Range(ea, (Size ? Size : 1));
+			do_unknown_range(ea, Size, DOUNK_SIMPLE);
+			if(create_insn(ea))
+				return(TRUE);
+			auto_make_code(ea);
+			return(FALSE);
+		}
+
+		case EDIT_FUNC:
+		{
+			if(get_fchunk(ea))
+				return(FALSE);
+			if(!isCode(getFlags(ea)))
+			{
+				JRN_Range(ea, 1);
+				do_unknown(ea, DOUNK_SIMPLE);
+				if(!create_insn(ea))
+					return(FALSE);
+			}
+			if(!add_func(ea, (Size ? (ea + Size) : BADADDR)))
+				return(FALSE);
+			JRN_AddFunc(ea);
+			return(TRUE);
+		}
+
+		case EDIT_TAIL:
+		{
+			if(func_t *pOwner = get_func((ea_t) (rEdit.uOwner + Delta)))
+			{
+				if(!append_func_tail(pOwner, ea, (ea + Size)))
+					return(FALSE);
+				JRN_Tail(pOwner->startEA, ea, (ea + Size));
+				return(TRUE);
+			}
+		}
+		break;
+	};
+
+	return(FALSE);
+}
+
+
+// ****************************************************************************
+// Func: IMP_ApplyEdits()
+// Desc: Sort and apply an edit list, then wait once for the auto-analysis.
+//       The caller shows the wait box. Returns the count of edits looked at,
+//       less than the list count if canceled.
+// ****************************************************************************
+size_t IMP_ApplyEdits(tEDITLIST &rList, adiff_t Delta, UINT &ruFailed)
+{
+	ZeroMemory(s_auApplied, sizeof(s_auApplied));
+	ruFailed = 0;
+	size_t uDone = 0;
+
+	EDL_Sort(rList);
+	for(size_t i = 0; i < rList.uCount; i++)
+	{
+		const tEDIT &rEdit = rList.pEdits[i];
+		if(ApplyEdit(rEdit, Delta))
+			s_auApplied[rEdit.uKind]++;
+		else
+			ruFailed++;
+		uDone++;
+
+		if(WaitBox::isUpdateTime())
+		{
+			if(WaitBox::updateAndCancelCheck((int) ((i * 100) / rList.uCount)))
+			{
+				msg("* Aborted *\n");
+				break;
+			}
+		}
+	}
+	autoWait();
+
+	return(uDone);
+}
+
+
+// ****************************************************************************
+// Func: IMP_ApplyEditList()
+// Desc: Ask for an edit list file and apply it, with a single auto-analysis wait at the end.
+//       Addresses are rebased if the IDB image base differs from the one in the list.
+// ****************************************************************************
+void IMP_ApplyEditList()
+{
+	tEDITLIST List;
+	EDL_Init(List);
+
+	try
+	{
+		char *pszFile = askfile_c(0, "*.ep?", "Select an ExtraPass edit list or plan to apply:");
+		if(!pszFile)
+			return;
+		if(!autoIsOk())
+		{
+			msg("** Wait for IDA to finish processing before starting plugin! **\n*** Aborted ***\n\n");
+			return;
+		}
+		if(!EDL_Load(pszFile, List))
+		{
+			msg("** Failed to load edit list \"%s\"! **\n*** Aborted ***\n\n", pszFile);
+			EDL_Free(List);
+			return;
+		}
+
+		msg("\n===== Applying edit list =====\n");
+		adiff_t Delta = (adiff_t) (get_imagebase() - (ea_t) List.uImageBase);
+		if(Delta)
+			msg("Rebased by %a.\n", Delta);
+
+		TIMESTAMP StartTime = GetTimeStamp();
+		int iStartFuncCount = get_func_qty();
+		UINT uFailed = 0;
+		WaitBox::show();
+
+		size_t uDone = IMP_ApplyEdits(List, Delta, uFailed);
+		WaitBox::hide();
+
+		for(UINT i = 0; i < EDIT_KINDS; i++)
+		{
+			if(s_auApplied[i])
+				msg("%12s: %u\n", EDL_KindName(i), s_auApplied[i]);
+		}
+		msg("     Skipped: %u\n", uFailed);
+		msg("   Functions: %d\n", ((int) get_func_qty() - iStartFuncCount));
+		msg("  Total time: %.2f seconds.\n\n", (GetTimeStamp() - StartTime));
+		if(uDone < List.uCount)
+			msg("Partial, %u of %u edits were looked at.\n\n", (UINT) uDone, (UINT) List.uCount);
+	}
+	CATCH()
+
+	WaitBox::hide();
+	EDL_Free(List);
+}
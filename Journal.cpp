@@ -0,0 +1,416 @@
+// ****************************************************************************
+// File: Journal.cpp
+// Desc: Change journal. Records the prior state of everything the plug-in changes,
+//       so a run can be rolled back without an IDB backup.
+//
+//       Append only, kept in the IDB as a series of blob chunks. Each run starts
+//       with a run marker, a rollback undoes the records after the last marker
+//       in reverse then cuts them off.
+//
+//       Only the direct changes are recorded. What the auto-analysis does in
+//       reaction to them, like code it follows on its own, is not.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include <WaitBoxEx.h>
+
+static const char JOURNAL_NODE[] = "$ ExtraPass journal";
+#define JOURNAL_TAG   'J'
+
+// Record buffer size, written as one blob chunk when full
+#define CHUNK_SIZE    (64 * 1024)
+// Blob index spacing between chunks, blobs use one supval per 1024 bytes
+#define CHUNK_SLOTS   128
+
+// Record kinds
+enum eJOURNAL
+{
+	JRN_RUN,		// Start of a run
+	JRN_RANGE,		// Prior items of a range, followed by "uCount" tITEM
+	JRN_ADDFUNC,	// A function was added at "ea"
+	JRN_DELFUNC,	// Function "ea" to "ea2" deleted, followed by "uCount" tail tRANGE
+	JRN_TAIL,		// Tail "ea" to "ea2" appended to function "eaOwner"
+	JRN_NAME,		// Name at "ea" changed, followed by "uCount" bytes of the prior name
+	JRN_SWITCH,		// Switch table at "ea" marked known
+};
+
+#pragma pack(push, 1)
+struct tRECORD
+{
+	BYTE bKind;
+	UINT uCount;
+	ea_t ea, ea2, eaOwner;
+};
+
+struct tITEM
+{
+	ea_t ea;
+	UINT uSize;
+	flags_t Flags;
+};
+
+struct tTAIL
+{
+	ea_t startEA, endEA;
+};
+#pragma pack(pop)
+
+static BOOL s_bActive = FALSE;
+static qvector<BYTE> s_Buffer;		// Records not written yet
+static size_t s_uBufferMem = 0;		// Its buffer as counted to MEM_JOURNAL
+static UINT s_uChunks = 0;			// Chunks in the IDB
+static UINT s_uRecords = 0;
+static UINT64 s_uBytes = 0;
+static TIMESTAMP s_Time = 0;		// Time spent journaling this run
+
+extern void SWI_ForgetTable(ea_t ea);
+
+
+static void Append(const void *pData, size_t uSize)
+{
+	const BYTE *pb = (const BYTE *) pData;
+	s_Buffer.insert(s_Buffer.end(), pb, (pb + uSize));
+	s_uBytes += uSize;
+}
+
+// Write the buffer as the next chunk
+static void Flush()
+{
+	if(!s_Buffer.empty())
+	{
+		// Split so no blob outgrows its slot range; the rollback concatenates them anyway
+		netnode Node(JOURNAL_NODE, 0, true);
+		for(size_t uOffset = 0; uOffset < s_Buffer.size(); uOffset += CHUNK_SIZE)
+		{
+			Node.setblob(&s_Buffer[uOffset], min((size_t) CHUNK_SIZE, (s_Buffer.size() - uOffset)), (s_uChunks * CHUNK_SLOTS), JOURNAL_TAG);
+			s_uChunks++;
+		}
+		Node.altset(0, s_uChunks);
+		s_Buffer.clear();
+		MemTrackVector(MEM_JOURNAL, s_Buffer, s_uBufferMem);
+	}
+}
+
+static void AddRecord(BYTE bKind, ea_t ea, ea_t ea2, ea_t eaOwner, UINT uCount, const void *pData, size_t uSize)
+{
+	tRECORD Record = { bKind, uCount, ea, ea2, eaOwner };
+	Append(&Record, sizeof(Record));
+	if(uSize)
+		Append(pData, uSize);
+	s_uRecords++;
+	if(s_Buffer.size() >= CHUNK_SIZE)
+		Flush();
+	else
+		MemTrackVector(MEM_JOURNAL, s_Buffer, s_uBufferMem);
+}
+
+
+// ****************************************************************************
+// Func: JRN_BeginRun()
+// Desc: Start journaling a run. "bContinue" for a resumed run, no new marker.
+// ****************************************************************************
+void JRN_BeginRun(BOOL bContinue)
+{
+	netnode Node(JOURNAL_NODE);
+	s_uChunks = ((Node != BADNODE) ? (UINT) Node.altval(0) : 0);
+	s_Buffer.clear();
+	MemTrackVector(MEM_JOURNAL, s_Buffer, s_uBufferMem);
+	s_uRecords = 0;
+	s_uBytes = 0;
+	s_Time = 0;
+	s_bActive = TRUE;
+	if(!bContinue)
+		AddRecord(JRN_RUN, 0, 0, 0, 0, NULL, 0);
+}
+
+// Write out what's buffered, i.e. with a run checkpoint
+void JRN_Flush()
+{
+	if(s_bActive)
+		Flush();
+}
+
+void JRN_EndRun()
+{
+	if(s_bActive)
+	{
+		Flush();
+		s_bActive = FALSE;
+	}
+}
+
+// Record the items of a range before it's changed
+void JRN_Range(ea_t ea, asize_t Size)
+{
+	if(!s_bActive || !Size)
+		return;
+	TIMESTAMP StartTime = GetTimeStamp();
+
+	qvector<tITEM> Items;
+	ea_t eaEnd = (ea + Size);
+	ea_t eaHead = get_item_head(ea);
+	if(!isHead(getFlags(eaHead)))
+		eaHead = next_head(eaHead, eaEnd);
+	while((eaHead != BADADDR) && (eaHead < eaEnd))
+	{
+		tITEM Item = { eaHead, (UINT) get_item_size(eaHead), getFlags(eaHead) };
+		Items.push_back(Item);
+		eaHead = next_head(eaHead, eaEnd);
+	};
+
+	// Cover any item sticking out on either side, it's undefined with the range
+	if(!Items.empty())
+	{
+		ea = min(ea, Items.front().ea);
+		eaEnd = max(eaEnd, (Items.back().ea + Items.back().uSize));
+	}
+	AddRecord(JRN_RANGE, ea, eaEnd, 0, (UINT) Items.size(), (Items.empty() ? NULL : &Items[0]), (Items.size() * sizeof(tITEM)));
+	s_Time += (GetTimeStamp() - StartTime);
+}
+
+// Record a function added
+void JRN_AddFunc(ea_t ea)
+{
+	if(s_bActive)
+		AddRecord(JRN_ADDFUNC, ea, 0, 0, 0, NULL, 0);
+}
+
+// Record a function before it's deleted
+void JRN_DelFunc(ea_t ea)
+{
+	if(!s_bActive)
+		return;
+	TIMESTAMP StartTime = GetTimeStamp();
+
+	func_t *pFunc = get_fchunk(ea);
+	if(pFunc && (pFunc->startEA == ea) && !(pFunc->flags & FUNC_TAIL))
+	{
+		qvector<tTAIL> Tails;
+		for(int i = 0; i < pFunc->tailqty; i++)
+		{
+			tTAIL Tail = { pFunc->tails[i].startEA, pFunc->tails[i].endEA };
+			Tails.push_back(Tail);
+		}
+		AddRecord(JRN_DELFUNC, pFunc->startEA, pFunc->endEA, 0, (UINT) Tails.size(), (Tails.empty() ? NULL : &Tails[0]), (Tails.size() * sizeof(tTAIL)));
+	}
+	s_Time += (GetTimeStamp() - StartTime);
+}
+
+// Record a tail appended
+void JRN_Tail(ea_t eaOwner, ea_t eaStart, ea_t eaEnd)
+{
+	if(s_bActive)
+		AddRecord(JRN_TAIL, eaStart, eaEnd, eaOwner, 0, NULL, 0);
+}
+
+// Record a name before it's changed
+void JRN_Name(ea_t ea)
+{
+	if(!s_bActive)
+		return;
+	// Only user names, auto names come back by themselves
+	char szName[MAXNAMELEN + 1] = { 0 };
+	if(has_user_name(getFlags(ea)))
+		get_true_name(BADADDR, ea, szName, SIZESTR(szName));
+	size_t uLen = strlen(szName);
+	AddRecord(JRN_NAME, ea, 0, 0, (UINT) uLen, szName, uLen);
+}
+
+// Record a switch table marked as known
+void JRN_Switch(ea_t ea)
+{
+	if(s_bActive)
+		AddRecord(JRN_SWITCH, ea, 0, 0, 0, NULL, 0);
+}
+
+// Journal stats for the end of run report
+void JRN_GetStats(UINT &ruRecords, UINT64 &ruBytes, TIMESTAMP &rTime)
+{
+	ruRecords = s_uRecords;
+	ruBytes = s_uBytes;
+	rTime = s_Time;
+}
+
+
+// Put back an item as it was
+static void RestoreItem(const tITEM &rItem)
+{
+	if(isCode(rItem.Flags))
+		create_insn(rItem.ea);
+	else
+	if(isAlign(rItem.Flags))
+		doAlign(rItem.ea, rItem.uSize, 0);
+	else
+	if(isData(rItem.Flags))
+	{
+		do_data_ex(rItem.ea, (rItem.Flags & DT_TYPE), rItem.uSize, BADNODE);
+		if(isOff0(rItem.Flags))
+			op_offset(rItem.ea, 0, REF_OFF32);
+	}
+}
+
+// Undo one record
+static void UndoRecord(const tRECORD &rRecord, const BYTE *pData)
+{
+	switch(rRecord.bKind)
+	{
+		case JRN_RANGE:
+		{
+			do_unknown_range(rRecord.ea, (rRecord.ea2 - rRecord.ea), DOUNK_SIMPLE);
+			const tITEM *pItems = (const tITEM *) pData;
+			for(UINT i = 0; i < rRecord.uCount; i++)
+				RestoreItem(pItems[i]);
+		}
+		break;
+
+		case JRN_ADDFUNC:
+		del_func(rRecord.ea);
+		break;
+
+		case JRN_DELFUNC:
+		{
+			if(add_func(rRecord.ea, rRecord.ea2))
+			{
+				if(func_t *pFunc = get_func(rRecord.ea))
+				{
+					const tTAIL *pTails = (const tTAIL *) pData;
+					for(UINT i = 0; i < rRecord.uCount; i++)
+						append_func_tail(pFunc, pTails[i].startEA, pTails[i].endEA);
+				}
+			}
+		}
+		break;
+
+		case JRN_TAIL:
+		{
+			if(func_t *pFunc = get_func(rRecord.eaOwner))
+				remove_func_tail(pFunc, rRecord.ea);
+		}
+		break;
+
+		case JRN_NAME:
+		{
+			char szName[MAXNAMELEN + 1];
+			UINT uLen = min(rRecord.uCount, (UINT) SIZESTR(szName));
+			memcpy(szName, pData, uLen);
+			szName[uLen] = 0;
+			set_name(rRecord.ea, szName, (uLen ? SN_NOWARN : SN_AUTO));
+		}
+		break;
+
+		case JRN_SWITCH:
+		SWI_ForgetTable(rRecord.ea);
+		break;
+	};
+}
+
+// Payload size of a record
+static size_t DataSize(const tRECORD &rRecord)
+{
+	switch(rRecord.bKind)
+	{
+		case JRN_RANGE:   return(rRecord.uCount * sizeof(tITEM));
+		case JRN_DELFUNC: return(rRecord.uCount * sizeof(tTAIL));
+		case JRN_NAME:    return(rRecord.uCount);
+	};
+	return(0);
+}
+
+
+// ****************************************************************************
+// Func: JRN_Rollback()
+// Desc: Undo the last journaled run, newest change first, then drop it from the journal.
+//       Returns TRUE if it was rolled back.
+// ****************************************************************************
+BOOL JRN_Rollback()
+{
+	BOOL bResult = FALSE;
+	try
+	{
+		netnode Node(JOURNAL_NODE);
+		UINT uChunks = ((Node != BADNODE) ? (UINT) Node.altval(0) : 0);
+		if(!uChunks)
+		{
+			msg("Nothing to roll back, the change journal is empty.\n");
+			return(FALSE);
+		}
+		if(!autoIsOk())
+		{
+			msg("** Wait for IDA to finish processing before starting plugin! **\n*** Aborted ***\n\n");
+			return(FALSE);
+		}
+
+		// Whole journal in one buffer
+		qvector<BYTE> Journal;
+		for(UINT i = 0; i < uChunks; i++)
+		{
+			size_t uSize = 0;
+			if(BYTE *pChunk = (BYTE *) Node.getblob(NULL, &uSize, (i * CHUNK_SLOTS), JOURNAL_TAG))
+			{
+				Journal.insert(Journal.end(), pChunk, (pChunk + uSize));
+				qfree(pChunk);
+			}
+		}
+
+		// Record offsets, to the last run marker
+		qvector<size_t> Records;
+		size_t uRunStart = 0;
+		for(size_t uOffset = 0; (uOffset + sizeof(tRECORD)) <= Journal.size(); )
+		{
+			const tRECORD *pRecord = (const tRECORD *) &Journal[uOffset];
+			size_t uNext = (uOffset + sizeof(tRECORD) + DataSize(*pRecord));
+			if(uNext > Journal.size())
+				break;
+			if(pRecord->bKind == JRN_RUN)
+			{
+				uRunStart = uOffset;
+				Records.clear();
+			}
+			else
+				Records.push_back(uOffset);
+			uOffset = uNext;
+		}
+
+		if(askyn_c(0, "Roll back the last ExtraPass run, %u changes?", (UINT) Records.size()) != 1)
+			return(FALSE);
+
+		msg("\n===== Rolling back =====\n");
+		TIMESTAMP StartTime = GetTimeStamp();
+		int iStartFuncCount = get_func_qty();
+		WaitBox::show();
+		for(size_t i = Records.size(); i > 0; i--)
+		{
+			const tRECORD *pRecord = (const tRECORD *) &Journal[Records[i - 1]];
+			UndoRecord(*pRecord, ((const BYTE *) pRecord + sizeof(tRECORD)));
+
+			if(WaitBox::isUpdateTime())
+				WaitBox::updateAndCancelCheck((int) (((Records.size() - i) * 100) / Records.size()));
+		}
+		autoWait();
+		WaitBox::hide();
+
+		// Cut the run off the journal
+		Journal.resize(uRunStart);
+		for(UINT i = 0; i < uChunks; i++)
+			Node.delblob((i * CHUNK_SLOTS), JOURNAL_TAG);
+		s_uChunks = 0;
+		for(size_t uOffset = 0; uOffset < Journal.size(); uOffset += CHUNK_SIZE)
+		{
+			Node.setblob(&Journal[uOffset], min((size_t) CHUNK_SIZE, (Journal.size() - uOffset)), (s_uChunks * CHUNK_SLOTS), JOURNAL_TAG);
+			s_uChunks++;
+		}
+		Node.altset(0, s_uChunks);
+		if(!s_uChunks)
+			Node.kill();
+
+		refresh_idaview_anyway();
+		msg("Changes undone: %u\n", (UINT) Records.size());
+		msg("   Functions: %d\n", ((int) get_func_qty() - iStartFuncCount));
+		msg("  Total time: %.2f seconds.\n\n", (GetTimeStamp() - StartTime));
+		bResult = TRUE;
+	}
+	CATCH()
+
+	WaitBox::hide();
+	return(bResult);
+}
@@ -27,7 +27,7 @@ const char IDAP_name[] = "ExtraPass";
 extern "C" ALIGN(16) plugin_t PLUGIN =
 {
 	IDP_INTERFACE_VERSION,	// IDA version plug-in is written for
-	PLUGIN_UNL,				// Plug-in flags
+	0,						// Plug-in flags, stays resident to keep its caches warm between runs
 	IDAP_init,	            // Initialization function
 	IDAP_term,	            // Clean-up function
 	IDAP_run,	            // Main plug-in body
@@ -45,7 +45,7 @@ int idaapi IDAP_init()
         return(PLUGIN_SKIP);
 
     CORE_Init();
-    return(PLUGIN_OK);
+    return(PLUGIN_KEEP);
 }
 
 // Un-init
@@ -0,0 +1,97 @@
+// ****************************************************************************
+// File: Plan.cpp
+// Desc: Dry run edit plan.
+//       In a dry run the passes record the edits they would make here instead of
+//       changing the IDB. The plan is saved at the end to be looked at, or applied
+//       later in one sorted batch with the plug-in's edit list import (argument 1).
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "Engine/EditList.h"
+
+static tEDITLIST s_Plan;
+static BOOL s_bActive = FALSE;
+static size_t s_uPlanMem = 0;	// The edit array as counted to MEM_PLAN, it's the engine's malloc()
+
+static void TrackPlan()
+{
+	size_t uSize = (s_Plan.uCapacity * sizeof(tEDIT));
+	if(uSize != s_uPlanMem)
+	{
+		MemTrack(MEM_PLAN, s_uPlanMem, uSize);
+		s_uPlanMem = uSize;
+	}
+}
+
+BOOL PLN_IsActive()
+{
+	return(s_bActive);
+}
+
+// Start a new plan
+void PLN_Begin()
+{
+	EDL_Free(s_Plan);
+	TrackPlan();
+	s_Plan.uImageBase = get_imagebase();
+	s_bActive = TRUE;
+}
+
+// Record an edit, only while a plan is being made
+void PLN_Add(UINT uKind, ea_t ea, asize_t Size, ea_t eaOwner)
+{
+	if(!s_bActive)
+		return;
+	if(!EDL_Add(s_Plan, uKind, ea, Size, eaOwner))
+		msg("** Out of memory for the edit plan! **\n");
+	TrackPlan();
+}
+
+// Count of unique edits, sorts the plan
+UINT PLN_Count()
+{
+	EDL_Sort(s_Plan);
+	EDL_Unique(s_Plan);
+	return((UINT) s_Plan.uCount);
+}
+
+// Ask for a file name and save the plan, with an optional JSON dump along side
+void PLN_Save()
+{
+	try
+	{
+		char *pszFile = askfile_c(1, "*.epb", "Save the ExtraPass edit plan as:");
+		if(!pszFile)
+		{
+			msg("Edit plan not saved.\n");
+			return;
+		}
+
+		char szFile[QMAXPATH];
+		qstrncpy(szFile, pszFile, sizeof(szFile));
+		if(!EDL_SavePlan(szFile, s_Plan))
+		{
+			msg("** Failed to save edit plan \"%s\"! **\n", szFile);
+			return;
+		}
+		msg("Edit plan: \"%s\".\n", szFile);
+
+		if(askyn_c(0, "Also write the plan as JSON?") == 1)
+		{
+			qstrncat(szFile, ".json", sizeof(szFile));
+			if(EDL_SaveJson(szFile, s_Plan))
+				msg("JSON dump: \"%s\".\n", szFile);
+			else
+				msg("** Failed to save JSON dump \"%s\"! **\n", szFile);
+		}
+	}
+	CATCH()
+}
+
+// Done with the plan, i.e. saved or the run canceled
+void PLN_End()
+{
+	EDL_Free(s_Plan);
+	TrackPlan();
+	s_bActive = FALSE;
+}
@@ -0,0 +1,126 @@
+// ****************************************************************************
+// File: Sound.cpp
+// Desc: Completion sound. Started and left to play on its own so IDA is free
+//       right away.
+//
+//       A "Complete.wav" or "Complete.ogg" in the "ExtraPass" folder under the
+//       IDA user folder is played instead of the built in clip. It's read once
+//       and kept for the following runs. Builds with NO_BUILTIN_SOUND defined
+//       leave the clip out, then only the file is played.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include <IdaOgg.h>
+#ifndef NO_BUILTIN_SOUND
+#include "complete_ogg.h"
+#endif
+
+// Sound file folder under the IDA user folder, the same as the cache's
+#define SOUND_FOLDER "ExtraPass"
+
+static BYTE *s_pSound  = NULL; // The file's bytes, PCM for a wave
+static int   s_iSize   = 0;
+static BOOL  s_bWave   = FALSE;
+static BOOL  s_bLoaded = FALSE; // Looked for the file
+static BOOL  s_bOggPlaying = FALSE;
+
+void SND_Stop();
+
+// Read the sound file, if there is one
+static void LoadSound()
+{
+	s_bLoaded = TRUE;
+	static const char *apszNames[] = { "Complete.wav", "Complete.ogg" };
+	for(int i = 0; i < (int) qnumber(apszNames); i++)
+	{
+		char szFile[QMAXPATH];
+		qmakepath(szFile, sizeof(szFile), get_user_idadir(), SOUND_FOLDER, apszNames[i], NULL);
+		if(FILE *fp = qfopen(szFile, "rb"))
+		{
+			int iSize = (int) qfsize(fp);
+			if(iSize > 0)
+			{
+				if(s_pSound = (BYTE *) MemAlloc(MEM_SOUND, iSize))
+				{
+					if(qfread(fp, s_pSound, iSize) == iSize)
+					{
+						s_iSize = iSize;
+						s_bWave = (i == 0);
+					}
+					else
+					{
+						MemFree(MEM_SOUND, s_pSound, iSize);
+						s_pSound = NULL;
+					}
+				}
+			}
+			qfclose(fp);
+			if(s_pSound)
+			{
+				msg("Completion sound: \"%s\".\n", szFile);
+				return;
+			}
+			msg("** Failed to read completion sound \"%s\"! **\n", szFile);
+		}
+	}
+}
+
+// ****************************************************************************
+// Func: SND_PlayDone()
+// Desc: Start the completion sound and return.
+// ****************************************************************************
+void SND_PlayDone()
+{
+	try
+	{
+		// No one to hear it
+		if(batch)
+			return;
+
+		SND_Stop();
+		if(!s_bLoaded)
+			LoadSound();
+
+		if(s_pSound && s_bWave)
+			PlaySound((LPCSTR) s_pSound, NULL, (SND_MEMORY | SND_ASYNC | SND_NODEFAULT));
+		else
+		if(s_pSound)
+		{
+			OggPlay::playFromMemory((const PVOID) s_pSound, s_iSize, TRUE);
+			s_bOggPlaying = TRUE;
+		}
+		#ifndef NO_BUILTIN_SOUND
+		else
+		{
+			OggPlay::playFromMemory((const PVOID) complete_ogg, complete_ogg_len, TRUE);
+			s_bOggPlaying = TRUE;
+		}
+		#endif
+	}
+	CATCH()
+}
+
+// Stop the sound if it's still playing
+void SND_Stop()
+{
+	if(s_bWave)
+		PlaySound(NULL, NULL, 0);
+	if(s_bOggPlaying)
+	{
+		OggPlay::endPlay();
+		s_bOggPlaying = FALSE;
+	}
+}
+
+// Stop and let go of the sound file, i.e. the plug-in is unloading
+void SND_Exit()
+{
+	SND_Stop();
+	if(s_pSound)
+	{
+		MemFree(MEM_SOUND, s_pSound, s_iSize);
+		s_pSound = NULL;
+	}
+	s_iSize = 0;
+	s_bWave = s_bLoaded = FALSE;
+}
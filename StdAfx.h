@@ -32,6 +32,9 @@
 #include <search.hpp>
 #include <kernwin.hpp>
 #include <name.hpp>
+#include <fixup.hpp>
+#include <offset.hpp>
+#include <nalt.hpp>
 #include <allins.hpp>
 
 #include "Utility.h"
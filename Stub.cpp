@@ -0,0 +1,244 @@
+// ****************************************************************************
+// File: Stub.cpp
+// Desc: Bulk recognizer for runs of tiny same shape stub functions.
+//       Typical of embedded script system bind stubs, "mov eax, imm / jmp" et al.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "Engine/EditList.h"
+
+// Need at least this many stubs in a row to call it a run
+#define MIN_RUN 4
+
+// Largest stub template, must fit in one SSE register compare
+#define MAX_STUB 16
+
+// Stub template, what bytes are opcodes (compared) and which are operands (don't care)
+struct tTEMPLATE
+{
+	__m128i Pattern;
+	__m128i Mask;
+	UINT uLength;		// Stub byte size
+	UINT uStride;		// Distance to the next stub, including any alignment padding
+	UINT uFirstSize;	// Size of the first instruction
+	UINT uRelOffset;	// Offset of branch rel32 or rel8 operand, 0 if none
+	UINT uRelSize;
+};
+
+extern BOOL PLN_IsActive();
+extern void PLN_Add(UINT uKind, ea_t ea, asize_t Size, ea_t eaOwner = 0);
+extern void JRN_Range(ea_t ea, asize_t Size);
+extern void JRN_AddFunc(ea_t ea);
+
+static BOOL IsPadByte(BYTE b){ return((b == 0xCC) || (b == 0x90)); }
+
+// Match a stub template at the given bytes, returns TRUE and fills in the template on match
+static BOOL GetTemplate(const BYTE *pb, const BYTE *pbEnd, tTEMPLATE &rT)
+{
+	ALIGN(16) BYTE abMask[MAX_STUB] = {0};
+	UINT uLen = 0;
+
+	// First instruction, the value load or push
+	if((pb[0] >= 0xB8) && (pb[0] <= 0xBF)) // mov reg, imm32
+	{
+		abMask[0] = 0xFF;
+		uLen = 5;
+	}
+	else
+	if(pb[0] == 0x68) // push imm32
+	{
+		abMask[0] = 0xFF;
+		uLen = 5;
+	}
+	else
+	if(pb[0] == 0x6A) // push imm8
+	{
+		abMask[0] = 0xFF;
+		uLen = 2;
+	}
+	else
+		return(FALSE);
+	rT.uFirstSize = uLen;
+
+	// Second, the branch
+	const BYTE *p2 = (pb + uLen);
+	if(p2[0] == 0xE9) // jmp rel32
+	{
+		abMask[uLen] = 0xFF;
+		rT.uRelOffset = (uLen + 1); rT.uRelSize = 4;
+		uLen += 5;
+	}
+	else
+	if(p2[0] == 0xEB) // jmp rel8
+	{
+		abMask[uLen] = 0xFF;
+		rT.uRelOffset = (uLen + 1); rT.uRelSize = 1;
+		uLen += 2;
+	}
+	else
+	if((p2[0] == 0xFF) && (p2[1] == 0x25)) // jmp [abs32]
+	{
+		abMask[uLen] = abMask[uLen + 1] = 0xFF;
+		rT.uRelOffset = rT.uRelSize = 0;
+		uLen += 6;
+	}
+	else
+	if(p2[0] == 0xE8) // call rel32, then the return
+	{
+		abMask[uLen] = 0xFF;
+		rT.uRelOffset = (uLen + 1); rT.uRelSize = 4;
+		uLen += 5;
+
+		static const BYTE abRet1[] = { 0xC3 };					// retn
+		static const BYTE abRet2[] = { 0x59, 0xC3 };			// pop ecx, retn
+		static const BYTE abRet3[] = { 0x83, 0xC4, 0x04, 0xC3 };	// add esp, 4, retn
+		const BYTE *pRet = (pb + uLen);
+		UINT uRet = 0;
+		if(memcmp(pRet, abRet3, sizeof(abRet3)) == 0)      uRet = sizeof(abRet3);
+		else if(memcmp(pRet, abRet2, sizeof(abRet2)) == 0) uRet = sizeof(abRet2);
+		else if(memcmp(pRet, abRet1, sizeof(abRet1)) == 0) uRet = sizeof(abRet1);
+		else
+			return(FALSE);
+		memset(&abMask[uLen], 0xFF, uRet);
+		uLen += uRet;
+	}
+	else
+		return(FALSE);
+
+	if((pb + uLen) > pbEnd)
+		return(FALSE);
+
+	// Stride includes the alignment padding, it's part of the compare if it fits
+	UINT uStride = uLen;
+	while(((pb + uStride) < pbEnd) && IsPadByte(pb[uStride]))
+	{
+		if(uStride < MAX_STUB)
+			abMask[uStride] = 0xFF;
+		uStride++;
+	};
+
+	rT.uLength = uLen;
+	rT.uStride = uStride;
+	rT.Mask    = _mm_load_si128((const __m128i *) abMask);
+	rT.Pattern = _mm_and_si128(_mm_loadu_si128((const __m128i *) pb), rT.Mask);
+	return(TRUE);
+}
+
+// Masked 16 byte compare against the template
+static inline BOOL IsMatch(const BYTE *pb, const tTEMPLATE &rT)
+{
+	__m128i Value = _mm_and_si128(_mm_loadu_si128((const __m128i *) pb), rT.Mask);
+	return(_mm_movemask_epi8(_mm_cmpeq_epi8(Value, rT.Pattern)) == 0xFFFF);
+}
+
+// Returns TRUE if the stub branch lands inside the segment
+static BOOL IsGoodTarget(const BYTE *pb, ea_t ea, const tTEMPLATE &rT, ea_t eaSegStart, ea_t eaSegEnd)
+{
+	if(rT.uRelSize == 0)
+		return(TRUE);
+
+	ea_t eaNext = (ea + rT.uRelOffset + rT.uRelSize);
+	ea_t eaTarget;
+	if(rT.uRelSize == 4)
+		eaTarget = (eaNext + *((const int *) (pb + rT.uRelOffset)));
+	else
+		eaTarget = (eaNext + *((const signed char *) (pb + rT.uRelOffset)));
+	return((eaTarget >= eaSegStart) && (eaTarget < eaSegEnd));
+}
+
+
+// ****************************************************************************
+// Func: STB_CreateStubRuns()
+// Desc: Find runs of same template stubs in the range and make functions of them
+//       in one batch. Returns the count of functions created.
+// ****************************************************************************
+UINT STB_CreateStubRuns(ea_t eaStart, ea_t eaEnd, ea_t eaSegStart, ea_t eaSegEnd)
+{
+	UINT uSize = (UINT) (eaEnd - eaStart);
+	if(uSize < (MIN_RUN * 4))
+		return(0);
+
+	// Local copy of the bytes, with slack so the 16 byte loads never read past the end
+	BYTE *pBuffer = (BYTE *) qalloc(uSize + MAX_STUB);
+	if(!pBuffer)
+		return(0);
+	ZeroMemory((pBuffer + uSize), MAX_STUB);
+	if(!get_many_bytes(eaStart, pBuffer, uSize))
+	{
+		qfree(pBuffer);
+		return(0);
+	}
+
+	qvector<ea_t> Stubs;
+	qvector<UINT> Sizes;
+	const BYTE *pbEnd = (pBuffer + uSize);
+	for(UINT uOffset = 0; (uOffset + 4) <= uSize; )
+	{
+		tTEMPLATE T;
+		const BYTE *pb = (pBuffer + uOffset);
+		if(GetTemplate(pb, pbEnd, T) && IsGoodTarget(pb, (eaStart + uOffset), T, eaSegStart, eaSegEnd))
+		{
+			// Slide along at the stride while the template matches
+			UINT uCount = 1;
+			UINT uNext  = (uOffset + T.uStride);
+			while(((uNext + T.uLength) <= uSize) && IsMatch((pBuffer + uNext), T) && IsGoodTarget((pBuffer + uNext), (eaStart + uNext), T, eaSegStart, eaSegEnd))
+			{
+				uCount++;
+				uNext += T.uStride;
+			};
+
+			if(uCount >= MIN_RUN)
+			{
+				for(UINT i = 0; i < uCount; i++)
+				{
+					Stubs.push_back(eaStart + uOffset + (i * T.uStride));
+					Sizes.push_back((T.uFirstSize << 16) | T.uLength);
+				}
+				uOffset = uNext;
+				continue;
+			}
+		}
+
+		uOffset++;
+	}
+	qfree(pBuffer);
+
+	// Create them all, then wait once
+	UINT uCreated = 0;
+	for(size_t i = 0; i < Stubs.size(); i++)
+	{
+		ea_t ea = Stubs[i];
+		UINT uLength = (Sizes[i] & 0xFFFF), uFirst = (Sizes[i] >> 16);
+		if(get_fchunk(ea))
+			continue;
+		if(PLN_IsActive())
+		{
+			PLN_Add(EDIT_FUNC, ea, uLength);
+			uCreated++;
+			continue;
+		}
+
+		if(!isCode(getFlags(ea)) || !isCode(getFlags(ea + uFirst)))
+		{
+			JRN_Range(ea, uLength);
+			do_unknown_range(ea, uLength, DOUNK_SIMPLE);
+			for(ea_t eaInsn = ea; eaInsn < (ea + uLength); )
+			{
+				int iSize = create_insn(eaInsn);
+				if(iSize <= 0)
+					break;
+				eaInsn += iSize;
+			}
+		}
+
+		if(add_func(ea, (ea + uLength)))
+		{
+			JRN_AddFunc(ea);
+			uCreated++;
+		}
+	}
+	if(uCreated)
+		autoWait();
+
+	return(uCreated);
+}
@@ -0,0 +1,265 @@
+// ****************************************************************************
+// File: Switch.cpp
+// Desc: x86 "switch()" jump table idiom recognizer.
+//       Marks the jump and index tables once so later passes and runs leave them alone.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "Engine/EditList.h"
+
+// From the x86 module "intel.hpp", the SIB byte of a memory operand
+#define hasSIB specflag1
+#define sib    specflag2
+
+// Sanity limit for the case count
+#define MAX_CASES 2048
+
+// Recognized tables are kept in the IDB so future runs see them too
+static const char TABLES_NODE[] = "$ ExtraPass switch tables";
+static netnode s_TablesNode;		// Looked up once a run, BADNODE until there's a table
+static BOOL    s_bTablesLooked = FALSE;
+
+extern BOOL PLN_IsActive();
+extern void PLN_Add(UINT uKind, ea_t ea, asize_t Size, ea_t eaOwner = 0);
+extern void JRN_Range(ea_t ea, asize_t Size);
+extern void JRN_Switch(ea_t ea);
+
+// Returns TRUE if instruction is a "jmp ds:table[reg*4]"
+static BOOL IsTableJump(const insn_t &rInsn)
+{
+	const op_t &rOp = rInsn.Operands[0];
+	return((rInsn.itype == NN_jmpni) && (rOp.type == o_mem) && (rOp.dtyp == dt_dword) && rOp.hasSIB &&
+		   (((rOp.sib >> 6) & 3) == 2) && (((rOp.sib >> 3) & 7) != 4));
+}
+
+// Index register of a table jump
+static inline int JumpIndexReg(const insn_t &rInsn)
+{
+	return((rInsn.Operands[0].sib >> 3) & 7);
+}
+
+// Returns the index register if instruction is a "movzx reg, byte ptr table[reg]", else -1.
+// MSVC makes "[reg+table]", a displacement off a base register, else it's a SIB "table[reg]".
+static int IndexTableReg(const insn_t &rInsn)
+{
+	const op_t &rOp = rInsn.Operands[1];
+	if((rInsn.itype != NN_movzx) || (rInsn.Operands[0].type != o_reg) || (rOp.dtyp != dt_byte))
+		return(-1);
+	if((rOp.type == o_displ) && !rOp.hasSIB)
+		return(rOp.reg);
+	if((rOp.type == o_mem) && rOp.hasSIB && (((rOp.sib >> 6) & 3) == 0) && (((rOp.sib >> 3) & 7) != 4))
+		return((rOp.sib >> 3) & 7);
+	return(-1);
+}
+
+// Returns TRUE if the instruction writes to the register
+static inline BOOL WritesReg(const insn_t &rInsn, int iReg)
+{
+	return((rInsn.Operands[0].type == o_reg) && (rInsn.Operands[0].reg == iReg) && (rInsn.itype != NN_cmp) && (rInsn.itype != NN_test));
+}
+
+// Look back from the switch for the "cmp reg, imm / ja default" bound on the index register
+// "iReg", returns case count or 0
+static UINT GetCaseBound(ea_t eaSwitch, int iReg)
+{
+	BOOL bHaveJa = FALSE;
+	ea_t ea = eaSwitch;
+
+	for(int i = 0; i < 4; i++)
+	{
+		if((ea = decode_prev_insn(ea)) == BADADDR)
+			break;
+
+		switch(cmd.itype)
+		{
+			case NN_ja: case NN_jnbe:
+			bHaveJa = TRUE;
+			break;
+
+			case NN_cmp:
+			{
+				if(bHaveJa && (cmd.Operands[0].type == o_reg) && (cmd.Operands[0].reg == iReg) && (cmd.Operands[1].type == o_imm))
+				{
+					uval_t uMax = cmd.Operands[1].value;
+					if(uMax < MAX_CASES)
+						return((UINT) uMax + 1);
+				}
+				return(0);
+			}
+			break;
+
+			// Index register setup between the bound and the jump is expected, a copy is followed
+			case NN_mov: case NN_movzx: case NN_sub: case NN_add: case NN_dec: case NN_lea:
+			{
+				if(WritesReg(cmd, iReg))
+				{
+					if((cmd.itype == NN_mov) && (cmd.Operands[1].type == o_reg))
+						iReg = cmd.Operands[1].reg;
+					else
+						return(0);
+				}
+			}
+			break;
+
+			default:
+			return(0);
+		};
+	}
+
+	return(0);
+}
+
+// Start of a run or background slice, the node is looked up again on first use
+void SWI_Begin()
+{
+	s_bTablesLooked = FALSE;
+}
+
+// Returns TRUE if address is the start of a table that was recognized before
+// Called for every data reference in pass 1, so no name lookup here
+BOOL SWI_IsKnownTable(ea_t ea)
+{
+	if(!s_bTablesLooked)
+	{
+		s_TablesNode = netnode(TABLES_NODE);
+		s_bTablesLooked = TRUE;
+	}
+	return((s_TablesNode != BADNODE) && (s_TablesNode.altval(ea) != 0));
+}
+
+// Unmark a table, for a rollback
+void SWI_ForgetTable(ea_t ea)
+{
+	netnode Node(TABLES_NODE);
+	if(Node != BADNODE)
+		Node.altdel(ea);
+}
+
+
+// ****************************************************************************
+// Func: SWI_DecodeSwitch()
+// Desc: Try to recognize a switch idiom from an instruction referencing table data.
+//       Handles "jmp ds:jumps[reg*4]" and the "movzx reg, ds:index[reg]" index + jump table pair,
+//       from either instruction, with the case count from the preceding "cmp/ja" on the index.
+//       Returns TRUE if the tables are (or already were) marked.
+// ****************************************************************************
+BOOL SWI_DecodeSwitch(ea_t eaRef, ea_t eaSegStart, ea_t eaSegEnd)
+{
+	if(!decode_insn(eaRef))
+		return(FALSE);
+	insn_t Ref = cmd;
+
+	// The bound is on "iReg" before "eaFirst", the jump's index or the index table's
+	ea_t eaJumps = BADADDR, eaIndex = BADADDR, eaFirst = eaRef;
+	int iReg = -1;
+	if(IsTableJump(Ref))
+	{
+		eaJumps = Ref.Operands[0].addr;
+		iReg = JumpIndexReg(Ref);
+
+		// Fed by an index table? Then it's the index table's bound
+		ea_t ea = eaRef;
+		for(int i = 0; i < 3; i++)
+		{
+			if((ea = decode_prev_insn(ea)) == BADADDR)
+				break;
+			if(WritesReg(cmd, JumpIndexReg(Ref)))
+			{
+				int iIndexReg = IndexTableReg(cmd);
+				if(iIndexReg != -1)
+				{
+					eaIndex = cmd.Operands[1].addr;
+					eaFirst = ea;
+					iReg    = iIndexReg;
+				}
+				break;
+			}
+		}
+	}
+	else
+	if((iReg = IndexTableReg(Ref)) != -1)
+	{
+		// The table jump on the loaded index should follow right after
+		eaIndex = Ref.Operands[1].addr;
+		ea_t ea = (eaRef + Ref.size);
+		for(int i = 0; i < 3; i++)
+		{
+			if(!decode_insn(ea))
+				break;
+			if(IsTableJump(cmd) && (JumpIndexReg(cmd) == Ref.Operands[0].reg))
+			{
+				eaJumps = cmd.Operands[0].addr;
+				break;
+			}
+			if(WritesReg(cmd, Ref.Operands[0].reg))
+				break;
+			ea += cmd.size;
+		}
+	}
+	if(eaJumps == BADADDR)
+		return(FALSE);
+
+	if(SWI_IsKnownTable(eaJumps))
+		return(TRUE);
+
+	UINT uCases = GetCaseBound(eaFirst, iReg);
+	if(uCases == 0)
+		return(FALSE);
+
+	// Jump entry count is the largest index table value + 1
+	UINT uJumps = uCases;
+	if(eaIndex != BADADDR)
+	{
+		BYTE abIndex[MAX_CASES];
+		if(!get_many_bytes(eaIndex, abIndex, uCases))
+			return(FALSE);
+		uJumps = 0;
+		for(UINT i = 0; i < uCases; i++)
+			uJumps = max(uJumps, ((UINT) abIndex[i] + 1));
+	}
+
+	// All entries must point into the segment
+	for(UINT i = 0; i < uJumps; i++)
+	{
+		ea_t eaTarget = get_long(eaJumps + (i * 4));
+		if((eaTarget < eaSegStart) || (eaTarget >= eaSegEnd))
+			return(FALSE);
+	}
+
+	// Dry run, plan the tables and the case targets
+	if(PLN_IsActive())
+	{
+		PLN_Add(EDIT_OFFSETS, eaJumps, (uJumps * 4));
+		for(UINT i = 0; i < uJumps; i++)
+			PLN_Add(EDIT_CODE, get_long(eaJumps + (i * 4)), 0);
+		if(eaIndex != BADADDR)
+			PLN_Add(EDIT_BYTES, eaIndex, uCases);
+		return(TRUE);
+	}
+
+	// Mark the jump table as an offset array
+	JRN_Range(eaJumps, (uJumps * 4));
+	do_unknown_range(eaJumps, (uJumps * 4), DOUNK_SIMPLE);
+	doDwrd(eaJumps, (uJumps * 4));
+	op_offset(eaJumps, 0, REF_OFF32);
+	for(UINT i = 0; i < uJumps; i++)
+		auto_make_code(get_long(eaJumps + (i * 4)));
+
+	// And the index table as a byte array
+	netnode Node(TABLES_NODE, 0, true);
+	s_TablesNode = Node;
+	s_bTablesLooked = TRUE;
+	if(eaIndex != BADADDR)
+	{
+		JRN_Range(eaIndex, uCases);
+		do_unknown_range(eaIndex, uCases, DOUNK_SIMPLE);
+		doByte(eaIndex, uCases);
+		Node.altset(eaIndex, uCases);
+		JRN_Switch(eaIndex);
+	}
+	Node.altset(eaJumps, uJumps);
+	JRN_Switch(eaJumps);
+
+	//msg("%08X switch, cases: %u, jumps: %u\n", eaRef, uCases, uJumps);
+	return(TRUE);
+}
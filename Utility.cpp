@@ -80,25 +80,318 @@ TIMESTAMP GetTimeStampLow()
 }
 
 
+// ==== Memory accounting ====
+static size_t s_auMemLive[MEM_TAGS], s_auMemPeak[MEM_TAGS];
+static size_t s_uMemLive = 0, s_uMemPeak = 0;
+static size_t s_uMemBudget = 0; // Zero for none
+
+static void MemAdd(UINT uTag, size_t uSize)
+{
+	s_auMemLive[uTag] += uSize;
+	if(s_auMemLive[uTag] > s_auMemPeak[uTag])
+		s_auMemPeak[uTag] = s_auMemLive[uTag];
+	s_uMemLive += uSize;
+	if(s_uMemLive > s_uMemPeak)
+		s_uMemPeak = s_uMemLive;
+}
+
+static void MemSub(UINT uTag, size_t uSize)
+{
+	_ASSERT((s_auMemLive[uTag] >= uSize) && (s_uMemLive >= uSize));
+	s_auMemLive[uTag] -= uSize;
+	s_uMemLive -= uSize;
+}
+
 // ****************************************************************************
-// Func: Log()
-// Desc: Send text to a log file.
-//
+// Func: MemAlloc()
+// Desc: qalloc() counted to the owner "uTag". The frees give the size back, so
+//       there's no header on the blocks.
 // ****************************************************************************
-void Log(FILE *pLogFile, const char *format, ...)
+void *MemAlloc(UINT uTag, size_t uSize)
+{
+	_ASSERT(uTag < MEM_TAGS);
+	void *p = qalloc(uSize);
+	if(p)
+		MemAdd(uTag, uSize);
+	return(p);
+}
+
+void *MemRealloc(UINT uTag, void *p, size_t uOldSize, size_t uNewSize)
 {
-	if(pLogFile && format)
+	_ASSERT(uTag < MEM_TAGS);
+	void *pNew = qrealloc(p, uNewSize);
+	if(pNew)
 	{
-		// Format string
-		va_list vl;
-        char	str[4096] = {0};
+		MemSub(uTag, (p ? uOldSize : 0));
+		MemAdd(uTag, uNewSize);
+	}
+	return(pNew);
+}
 
-		va_start(vl, format);
-		_vsnprintf(str, (sizeof(str) - 1), format, vl);
-		va_end(vl);
+void MemFree(UINT uTag, void *p, size_t uSize)
+{
+	_ASSERT(uTag < MEM_TAGS);
+	if(p)
+	{
+		qfree(p);
+		MemSub(uTag, uSize);
+	}
+}
+
+// Count memory allocated elsewhere, i.e. a qvector's or the edit list's, by its change in size
+void MemTrack(UINT uTag, size_t uOldSize, size_t uNewSize)
+{
+	_ASSERT(uTag < MEM_TAGS);
+	MemSub(uTag, uOldSize);
+	MemAdd(uTag, uNewSize);
+}
+
+// Set the budget in bytes, zero for none
+void MemSetBudget(size_t uBytes)
+{
+	s_uMemBudget = uBytes;
+}
+
+// Returns TRUE if the live bytes, plus "uMore" about to be allocated, are over the budget.
+// The structures that can do without go to the slower IDA lookups instead.
+BOOL MemOverBudget(size_t uMore)
+{
+	return(s_uMemBudget && ((s_uMemLive + uMore) > s_uMemBudget));
+}
+
+// Start the peaks over from the live bytes, i.e. a new run
+void MemResetPeaks()
+{
+	for(UINT i = 0; i < MEM_TAGS; i++)
+		s_auMemPeak[i] = s_auMemLive[i];
+	s_uMemPeak = s_uMemLive;
+}
+
+void MemGetStats(UINT uTag, size_t &ruLive, size_t &ruPeak)
+{
+	_ASSERT(uTag < MEM_TAGS);
+	ruLive = s_auMemLive[uTag];
+	ruPeak = s_auMemPeak[uTag];
+}
+
+void MemGetTotals(size_t &ruLive, size_t &ruPeak)
+{
+	ruLive = s_uMemLive;
+	ruPeak = s_uMemPeak;
+}
+
+LPCSTR MemTagName(UINT uTag)
+{
+	static const char *apszNames[MEM_TAGS] = { "Other", "Function gaps", "Chunk map", "Address sets", "Indexes", "Reloc maps", "Vftable scan", "Log buffer", "Sound", "Result cache", "Journal", "Background", "Dry run plan" };
+	return((uTag < MEM_TAGS) ? apszNames[uTag] : "?");
+}
+
+
+// ==== Log ====
+// Lines are formatted on the caller's thread straight into a ring buffer, and a
+// writer thread takes them out to the file in big blocks. There is only the one
+// producer and the one consumer, each owning one of the positions, so no locks.
+#define LOG_RING_SIZE  (1024 * 1024)       // Power of two
+#define LOG_LINE_MAX   4096
+#define LOG_WAKE_BYTES (LOG_RING_SIZE / 8) // Wake the writer after this much, else it looks on its own a few times a second
+
+UINT g_uLogMask = 0;
+static char *s_pLogRing        = NULL;
+static FILE *s_pLogFile        = NULL;
+static HANDLE s_hLogThread     = NULL;
+static HANDLE s_hLogWake       = NULL;
+static volatile LONG s_lLogHead = 0; // Written to, by the producer
+static volatile LONG s_lLogTail = 0; // Out to the file, by the writer
+static volatile LONG s_lLogQuit = FALSE;
+static UINT s_uLogWakeHead     = 0;
+static BOOL s_bLogToFile       = FALSE;
+static BOOL s_bLogToWindow     = FALSE;
+
+// Categories of each level
+static const UINT s_auLevelMask[] =
+{
+	0,
+	LOGC_ERRORS,
+	(LOGC_ERRORS | LOGC_GAPS | LOGC_FUNCS),
+	LOGC_ALL
+};
+
+static DWORD WINAPI LogWriter(LPVOID lpParameter)
+{
+	while(TRUE)
+	{
+		// Anything written before the quit gets out
+		BOOL bQuit = (s_lLogQuit != FALSE);
+		MemoryBarrier();
+		UINT uHead = (UINT) s_lLogHead;
+		UINT uTail = (UINT) s_lLogTail;
+		BOOL bWrote = (uTail != uHead);
+		while(uTail != uHead)
+		{
+			// To the head, or the end of the buffer then around
+			UINT uOffset = (uTail & (LOG_RING_SIZE - 1));
+			UINT uSize   = min((uHead - uTail), (LOG_RING_SIZE - uOffset));
+			qfwrite(s_pLogFile, (s_pLogRing + uOffset), uSize);
+			uTail += uSize;
+			MemoryBarrier();
+			s_lLogTail = (LONG) uTail;
+		}
+
+		// Out of the CRT buffer once caught up, the file stays open across runs
+		if(bWrote)
+			qflush(s_pLogFile);
+		if(bQuit)
+			break;
+		WaitForSingleObject(s_hLogWake, 250);
+	};
+
+	return(0);
+}
+
+// Wait until there is room for "uSize" bytes
+static void LogWaitRoom(UINT uHead, UINT uSize)
+{
+	while(((uHead - (UINT) s_lLogTail) + uSize) > LOG_RING_SIZE)
+	{
+		SetEvent(s_hLogWake);
+		Sleep(1);
+	};
+}
+
+// ****************************************************************************
+// Func: LogOpen()
+// Desc: Open a log file for appending and start its writer.
+//       Nothing is logged until a mask is set with LogSetMask().
+// ****************************************************************************
+BOOL LogOpen(LPCSTR pszFile)
+{
+	if(s_pLogFile)
+		return(TRUE);
+
+	if(s_pLogFile = qfopen(pszFile, "ab"))
+	{
+		if(s_pLogRing = (char *) MemAlloc(MEM_LOG, LOG_RING_SIZE))
+		{
+			s_lLogHead = s_lLogTail = 0;
+			s_lLogQuit = FALSE;
+			s_uLogWakeHead = 0;
+			if(s_hLogWake = CreateEvent(NULL, FALSE, FALSE, NULL))
+			{
+				if(s_hLogThread = CreateThread(NULL, 0, LogWriter, NULL, 0, NULL))
+				{
+					SetThreadPriority(s_hLogThread, THREAD_PRIORITY_BELOW_NORMAL);
+					return(TRUE);
+				}
+				CloseHandle(s_hLogWake);
+				s_hLogWake = NULL;
+			}
+			MemFree(MEM_LOG, s_pLogRing, LOG_RING_SIZE);
+			s_pLogRing = NULL;
+		}
+		qfclose(s_pLogFile);
+		s_pLogFile = NULL;
+	}
+	return(FALSE);
+}
+
+BOOL LogIsOpen()
+{
+	return(s_pLogFile != NULL);
+}
+
+// Set the categories to log, limited to the ones of the level and lower, and where to
+void LogSetMask(UINT uLevel, UINT uFlags)
+{
+	if(uLevel > LOGL_VERBOSE)
+		uLevel = LOGL_VERBOSE;
+	s_bLogToFile   = ((uFlags & LOGT_FILE) && s_pLogFile);
+	s_bLogToWindow = ((uFlags & LOGT_WINDOW) != 0);
+	g_uLogMask = ((s_bLogToFile || s_bLogToWindow) ? (uFlags & s_auLevelMask[uLevel]) : 0);
+}
+
+// ****************************************************************************
+// Func: LogWrite()
+// Desc: Send text to the log file. Call through LOG() so nothing is formatted
+//       for a category that is off.
+// ****************************************************************************
+void LogWrite(const char *format, ...)
+{
+	if(!format)
+		return;
+
+	// Format in place when a whole line fits before the end of the buffer
+	char szLine[LOG_LINE_MAX];
+	char *pszLine = szLine;
+	BOOL bFile = (s_bLogToFile && s_pLogRing);
+	UINT uHead = 0, uOffset = 0;
+	if(bFile)
+	{
+		uHead = (UINT) s_lLogHead;
+		uOffset = (uHead & (LOG_RING_SIZE - 1));
+		if((LOG_RING_SIZE - uOffset) >= LOG_LINE_MAX)
+		{
+			LogWaitRoom(uHead, LOG_LINE_MAX);
+			pszLine = (s_pLogRing + uOffset);
+		}
+	}
+
+	va_list vl;
+	va_start(vl, format);
+	_vsnprintf(pszLine, (LOG_LINE_MAX - 1), format, vl);
+	va_end(vl);
+	pszLine[LOG_LINE_MAX - 1] = 0;
+	if(s_bLogToWindow)
+		msg("%s", pszLine);
+	if(!bFile)
+		return;
+
+	UINT uSize = (UINT) strlen(pszLine);
+	if(pszLine == szLine)
+	{
+		// Around the end
+		LogWaitRoom(uHead, uSize);
+		UINT uFirst = min(uSize, (LOG_RING_SIZE - uOffset));
+		memcpy((s_pLogRing + uOffset), szLine, uFirst);
+		memcpy(s_pLogRing, (szLine + uFirst), (uSize - uFirst));
+	}
+
+	// Publish
+	MemoryBarrier();
+	uHead += uSize;
+	s_lLogHead = (LONG) uHead;
+	if((uHead - s_uLogWakeHead) >= LOG_WAKE_BYTES)
+	{
+		s_uLogWakeHead = uHead;
+		SetEvent(s_hLogWake);
+	}
+}
 
-		// Out to file
-		qfputs(str, pLogFile);
-        qflush(pLogFile);
+// Stop logging, write out what's left and close the file
+void LogClose()
+{
+	g_uLogMask = 0;
+	s_bLogToFile = s_bLogToWindow = FALSE;
+	if(s_hLogThread)
+	{
+		InterlockedExchange(&s_lLogQuit, TRUE);
+		SetEvent(s_hLogWake);
+		WaitForSingleObject(s_hLogThread, INFINITE);
+		CloseHandle(s_hLogThread);
+		s_hLogThread = NULL;
+	}
+	if(s_hLogWake)
+	{
+		CloseHandle(s_hLogWake);
+		s_hLogWake = NULL;
+	}
+	if(s_pLogFile)
+	{
+		qfclose(s_pLogFile);
+		s_pLogFile = NULL;
 	}
-}
\ No newline at end of file
+	if(s_pLogRing)
+	{
+		MemFree(MEM_LOG, s_pLogRing, LOG_RING_SIZE);
+		s_pLogRing = NULL;
+	}
+}
@@ -22,8 +22,83 @@ typedef double TIMESTAMP;  // Time in floating seconds
 TIMESTAMP GetTimeStamp();
 TIMESTAMP GetTimeStampLow();
 void Trace(LPCTSTR pszFormat, ...);
-void Log(FILE *pLogFile, const char *format, ...);
 
+// Log, lines go through a ring buffer to a writer thread, and or to the output window
+// Categories, each has a fixed level so the level only has to be applied to the mask once
+#define LOGC_ERRORS (1 << 0) // Level 1, problems and range errors
+#define LOGC_GAPS   (1 << 1) // Level 2, function gap list and gap walk bounds
+#define LOGC_FUNCS  (1 << 2) // Level 2, function tries and results
+#define LOGC_WALK   (1 << 3) // Level 3, every item of the gap walk
+#define LOGC_ALL    (LOGC_ERRORS | LOGC_GAPS | LOGC_FUNCS | LOGC_WALK)
+// Where the lines go, either or both
+#define LOGT_FILE   (1 << 4)
+#define LOGT_WINDOW (1 << 5) // IDA's output window
+#define LOGL_OFF     0
+#define LOGL_ERRORS  1
+#define LOGL_INFO    2
+#define LOGL_VERBOSE 3
+
+extern UINT g_uLogMask; // Categories being logged, zero when off
+#define LOGGING(_cat) (g_uLogMask & (_cat))
+// Arguments are only evaluated when the category is on
+#define LOG(_cat, ...) do { if(LOGGING(_cat)) LogWrite(__VA_ARGS__); } while(0)
+
+BOOL LogOpen(LPCSTR pszFile);
+BOOL LogIsOpen();
+void LogSetMask(UINT uLevel, UINT uFlags);
+void LogWrite(const char *format, ...);
+void LogClose();
+
+
+// Memory accounting, the live and peak bytes of the plug-in's own structures by owner.
+// From IDA's thread only.
+enum eMEMTAG
+{
+	MEM_OTHER,
+	MEM_FUNCLIST,  // Function gap list nodes
+	MEM_CHUNKS,    // Function chunk map
+	MEM_ADDRSETS,  // Address hash sets and maps
+	MEM_INDEXES,   // Sorted address indexes
+	MEM_RELOCS,    // Relocation bitmaps
+	MEM_VFTABLES,  // Vftable scan snapshots and kept results
+	MEM_LOG,       // Log ring buffer
+	MEM_SOUND,     // Completion sound file
+	MEM_CACHE,     // Result cache snapshot and segment hashes
+	MEM_JOURNAL,   // Change journal records not written yet
+	MEM_BACKGROUND,// Background mode changed ranges
+	MEM_PLAN,      // Dry run edit plan
+	MEM_TAGS
+};
+
+void *MemAlloc(UINT uTag, size_t uSize);
+void *MemRealloc(UINT uTag, void *p, size_t uOldSize, size_t uNewSize);
+void MemFree(UINT uTag, void *p, size_t uSize);
+void MemTrack(UINT uTag, size_t uOldSize, size_t uNewSize);
+void MemSetBudget(size_t uBytes);
+BOOL MemOverBudget(size_t uMore = 0);
+void MemResetPeaks();
+void MemGetStats(UINT uTag, size_t &ruLive, size_t &ruPeak);
+void MemGetTotals(size_t &ruLive, size_t &ruPeak);
+LPCSTR MemTagName(UINT uTag);
+
+// Count a qvector's buffer after it changed, "ruCounted" is the size last counted for it
+template <class T> inline void MemTrackVector(UINT uTag, const qvector<T> &rVector, size_t &ruCounted)
+{
+	size_t uSize = (rVector.capacity() * sizeof(T));
+	if(uSize != ruCounted)
+	{
+		MemTrack(uTag, ruCounted, uSize);
+		ruCounted = uSize;
+	}
+}
+
+// Allocation policy for the containers in "ContainersInl.h", counted to "uTag"
+template <UINT uTag> struct MemTagAlloc
+{
+	static void *Alloc(size_t uSize) { return(MemAlloc(uTag, uSize)); }
+	static void *Realloc(void *p, size_t uOldSize, size_t uNewSize) { return(MemRealloc(uTag, p, uOldSize, uNewSize)); }
+	static void Free(void *p, size_t uSize) { MemFree(uTag, p, uSize); }
+};
 
 // Sequential 32 bit flag serializer
 struct SBITFLAG
@@ -0,0 +1,332 @@
+// ****************************************************************************
+// File: Vftable.cpp
+// Desc: MSVC RTTI vftable scanner.
+//       Seeds virtual methods that are only reachable through vftables.
+//
+// ****************************************************************************
+#include "stdafx.h"
+#include "Engine/EditList.h"
+
+// Minimum snapshot chunk size per worker thread
+#define CHUNK_SIZE (256 * 1024)
+
+// Max worker threads
+#define MAX_THREADS 32
+
+// x86 "RTTICompleteObjectLocator", the dword right before a vftable points to it
+#pragma pack(push, 1)
+struct tRTTICOL
+{
+	UINT uSignature;		// 0 for x86
+	UINT uOffset;			// Offset of this vftable in the complete class
+	UINT uCdOffset;			// Constructor displacement offset
+	UINT pTypeDescriptor;	// -> "TypeDescriptor"
+	UINT pClassDescriptor;	// -> "RTTIClassHierarchyDescriptor"
+};
+#pragma pack(pop)
+
+// Offset to "TypeDescriptor" decorated name, after "pVFTable" and "spare"
+#define TD_NAME_OFFSET 8
+
+// Snapshot of a data segment's bytes, so workers never have to call into IDA
+struct tSNAPSHOT
+{
+	ea_t eaStart, eaEnd;
+	BYTE *pData;
+};
+
+// Per thread work unit
+struct tCHUNK
+{
+	const tSNAPSHOT *pSnap;
+	UINT uStart, uEnd;			// Byte range inside the snapshot
+	const qvector<area_t> *pCode;	// Code ranges the slots can point into
+	UINT uTables;
+	qvector<ea_t> Slots;		// Virtual method addresses found
+};
+
+extern BOOL PLN_IsActive();
+extern void PLN_Add(UINT uKind, ea_t ea, asize_t Size, ea_t eaOwner = 0);
+extern void JRN_Range(ea_t ea, asize_t Size);
+extern void JRN_AddFunc(ea_t ea);
+
+static tSNAPSHOT s_Snaps[64];
+static int s_iSnaps = 0;
+
+// Last scan results, reused by the next run until the IDB bytes or segments change
+static BOOL s_bScanValid = FALSE;
+static qvector<area_t> s_ScanCode;
+static qvector<ea_t> s_ScanTargets;
+static size_t s_uScanTargetsMem = 0;	// Its buffer as counted to MEM_VFTABLES
+static UINT s_uScanTables = 0;
+
+// Return pointer to snapshot bytes for the range, or NULL if it's not inside one
+static const BYTE *SnapPtr(ea_t ea, UINT uSize)
+{
+	for(int i = 0; i < s_iSnaps; i++)
+	{
+		if((ea >= s_Snaps[i].eaStart) && ((ea + uSize) <= s_Snaps[i].eaEnd))
+			return(s_Snaps[i].pData + (ea - s_Snaps[i].eaStart));
+	}
+	return(NULL);
+}
+
+// Take a snapshot of a data segment
+// Uninitialized (".bss" style) parts fail to read and are left zero filled.
+static BOOL TakeSnapshot(segment_t *pSeg)
+{
+	tSNAPSHOT &rSnap = s_Snaps[s_iSnaps];
+	UINT uSize = (UINT) pSeg->size();
+	if(!(rSnap.pData = (BYTE *) MemAlloc(MEM_VFTABLES, uSize)))
+		return(FALSE);
+	rSnap.eaStart = pSeg->startEA;
+	rSnap.eaEnd   = pSeg->endEA;
+
+	if(!get_many_bytes(rSnap.eaStart, rSnap.pData, uSize))
+	{
+		for(UINT uOffset = 0; uOffset < uSize; uOffset += 4096)
+		{
+			UINT uPage = min(4096, (uSize - uOffset));
+			if(!get_many_bytes((rSnap.eaStart + uOffset), (rSnap.pData + uOffset), uPage))
+				ZeroMemory((rSnap.pData + uOffset), uPage);
+		}
+	}
+
+	s_iSnaps++;
+	return(TRUE);
+}
+
+static void FreeSnapshots()
+{
+	for(int i = 0; i < s_iSnaps; i++)
+		MemFree(MEM_VFTABLES, s_Snaps[i].pData, (size_t) (s_Snaps[i].eaEnd - s_Snaps[i].eaStart));
+	s_iSnaps = 0;
+}
+
+// Returns TRUE if address points to a plausible complete object locator
+static BOOL IsValidCOL(ea_t eaCOL)
+{
+	if(eaCOL & 3)
+		return(FALSE);
+
+	const tRTTICOL *pCOL = (const tRTTICOL *) SnapPtr(eaCOL, sizeof(tRTTICOL));
+	if(!pCOL || (pCOL->uSignature != 0))
+		return(FALSE);
+	if(!SnapPtr(pCOL->pClassDescriptor, (sizeof(UINT) * 4)))
+		return(FALSE);
+
+	// Decorated class name ".?AV" (class) or ".?AU" (struct)
+	const char *pszName = (const char *) SnapPtr((pCOL->pTypeDescriptor + TD_NAME_OFFSET), 4);
+	return(pszName && (pszName[0] == '.') && (pszName[1] == '?') && (pszName[2] == 'A') && ((pszName[3] == 'V') || (pszName[3] == 'U')));
+}
+
+// Returns TRUE if the address is in one of the code ranges, there are only a few
+static inline BOOL InCode(const qvector<area_t> &rCode, ea_t ea)
+{
+	for(size_t i = 0; i < rCode.size(); i++)
+	{
+		if((ea >= rCode[i].startEA) && (ea < rCode[i].endEA))
+			return(TRUE);
+	}
+	return(FALSE);
+}
+
+// Worker thread, scans a chunk for COL pointers and collects the vftable slots that follow
+// No IDA API use here, it's not thread safe.
+static DWORD WINAPI ScanThread(LPVOID lpParameter)
+{
+	tCHUNK *pChunk = (tCHUNK *) lpParameter;
+	const tSNAPSHOT *pSnap = pChunk->pSnap;
+	UINT uSnapSize = (UINT) (pSnap->eaEnd - pSnap->eaStart);
+
+	for(UINT uOffset = pChunk->uStart; (uOffset + 4) <= pChunk->uEnd; uOffset += 4)
+	{
+		UINT uValue = *((const UINT *) (pSnap->pData + uOffset));
+		if(!IsValidCOL(uValue))
+			continue;
+
+		// Walk the vftable slots while they point to code
+		UINT uSlots = 0;
+		for(UINT uSlot = (uOffset + 4); (uSlot + 4) <= uSnapSize; uSlot += 4)
+		{
+			ea_t eaTarget = *((const UINT *) (pSnap->pData + uSlot));
+			if(!InCode(*pChunk->pCode, eaTarget))
+				break;
+			pChunk->Slots.push_back(eaTarget);
+			uSlots++;
+		}
+
+		if(uSlots)
+		{
+			pChunk->uTables++;
+			uOffset += (uSlots * 4);
+		}
+	}
+
+	return(0);
+}
+
+static int __cdecl CompareEA(const void *p1, const void *p2)
+{
+	ea_t ea1 = *((const ea_t *) p1), ea2 = *((const ea_t *) p2);
+	return((ea1 < ea2) ? -1 : ((ea1 > ea2) ? 1 : 0));
+}
+
+// Drop the kept scan results
+void VFT_Invalidate()
+{
+	s_bScanValid = FALSE;
+	s_ScanTargets.clear();
+	MemTrackVector(MEM_VFTABLES, s_ScanTargets, s_uScanTargetsMem);
+}
+
+// Snapshot the data segments and scan them in parallel, the work units with their results go in "rChunks"
+static void ScanDataSegments(const qvector<area_t> &rCode, qvector<tCHUNK *> &rChunks)
+{
+	// Snapshot the ".rdata" and other data segments, where the vftables, COLs and type descriptors are
+	int iSegCount = get_segm_qty();
+	for(int i = 0; (i < iSegCount) && (s_iSnaps < (sizeof(s_Snaps) / sizeof(tSNAPSHOT))); i++)
+	{
+		if(segment_t *pSeg = getnseg(i))
+		{
+			char szClass[32];
+			if(get_segm_class(pSeg, szClass, SIZESTR(szClass)) <= 0)
+				continue;
+			if((strcmp(szClass, "DATA") == 0) || (strcmp(szClass, "CONST") == 0))
+			{
+				if(!TakeSnapshot(pSeg))
+					break;
+			}
+		}
+	}
+
+	// Split into dword aligned chunks
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	UINT uThreads = max(1, min(MAX_THREADS, si.dwNumberOfProcessors));
+
+	for(int i = 0; i < s_iSnaps; i++)
+	{
+		UINT uSize = (UINT) (s_Snaps[i].eaEnd - s_Snaps[i].eaStart);
+		UINT uChunk = max(CHUNK_SIZE, (((uSize / uThreads) + 3) & ~3));
+		for(UINT uStart = 0; uStart < uSize; uStart += uChunk)
+		{
+			tCHUNK *pChunk = new tCHUNK();
+			pChunk->pSnap  = &s_Snaps[i];
+			pChunk->uStart = uStart;
+			pChunk->uEnd   = min(uSize, (uStart + uChunk));
+			pChunk->pCode  = &rCode;
+			pChunk->uTables = 0;
+			rChunks.push_back(pChunk);
+		}
+	}
+
+	// Collect in parallel, a batch of up to "uThreads" at the time
+	for(size_t uBatch = 0; uBatch < rChunks.size(); uBatch += uThreads)
+	{
+		HANDLE ahThreads[MAX_THREADS];
+		DWORD dwCount = 0;
+		for(size_t i = uBatch; (i < rChunks.size()) && (dwCount < uThreads); i++)
+		{
+			if(!(ahThreads[dwCount] = CreateThread(NULL, 0, ScanThread, rChunks[i], 0, NULL)))
+				ScanThread(rChunks[i]);
+			else
+				dwCount++;
+		}
+
+		if(dwCount)
+		{
+			WaitForMultipleObjects(dwCount, ahThreads, TRUE, INFINITE);
+			for(DWORD i = 0; i < dwCount; i++)
+				CloseHandle(ahThreads[i]);
+		}
+	}
+	FreeSnapshots();
+}
+
+
+// ****************************************************************************
+// Func: VFT_SeedFunctions()
+// Desc: Scan data segments for RTTI vftables and create a function at every slot
+//       that points into the code ranges but is not in a function yet.
+//       All of a run's ranges are done in one go. Returns the count of functions created.
+// ****************************************************************************
+UINT VFT_SeedFunctions(const qvector<area_t> &rCode)
+{
+	UINT uCreated = 0;
+	qvector<tCHUNK *> Chunks;
+
+	try
+	{
+		// Same code ranges scanned before and nothing changed since, reuse those results
+		BOOL bCached = (s_bScanValid && (s_ScanCode.size() == rCode.size()));
+		for(size_t i = 0; bCached && (i < rCode.size()); i++)
+			bCached = ((s_ScanCode[i].startEA == rCode[i].startEA) && (s_ScanCode[i].endEA == rCode[i].endEA));
+		if(!bCached)
+		{
+			VFT_Invalidate();
+			ScanDataSegments(rCode, Chunks);
+
+			// Merge and remove duplicates, the same methods are shared by many tables
+			s_uScanTables = 0;
+			for(size_t i = 0; i < Chunks.size(); i++)
+			{
+				s_uScanTables += Chunks[i]->uTables;
+				for(size_t j = 0; j < Chunks[i]->Slots.size(); j++)
+					s_ScanTargets.push_back(Chunks[i]->Slots[j]);
+			}
+			if(!s_ScanTargets.empty())
+				qsort(&s_ScanTargets[0], s_ScanTargets.size(), sizeof(ea_t), CompareEA);
+			MemTrackVector(MEM_VFTABLES, s_ScanTargets, s_uScanTargetsMem);
+			s_ScanCode   = rCode;
+			s_bScanValid = TRUE;
+		}
+		const qvector<ea_t> &Targets = s_ScanTargets;
+		UINT uTables = s_uScanTables;
+
+		// Create the missing functions in one batch, with a single wait at the end
+		UINT uMethods = 0;
+		ea_t eaLast = BADADDR;
+		for(size_t i = 0; i < Targets.size(); i++)
+		{
+			ea_t ea = Targets[i];
+			if(ea == eaLast)
+				continue;
+			eaLast = ea;
+			uMethods++;
+
+			// Code or unknown bytes only, a defined data item is more likely than the heuristic
+			flags_t Flags = getFlags(ea);
+			if(get_fchunk(ea) || isData(Flags))
+				continue;
+			if(PLN_IsActive())
+			{
+				PLN_Add(EDIT_FUNC, ea, 0);
+				uCreated++;
+				continue;
+			}
+			if(!isCode(Flags))
+			{
+				JRN_Range(ea, 1);
+				do_unknown(ea, DOUNK_SIMPLE);
+				if(!create_insn(ea))
+					continue;
+			}
+			if(add_func(ea, BADADDR))
+			{
+				JRN_AddFunc(ea);
+				uCreated++;
+			}
+		}
+		autoWait();
+
+		msg("Vftables: %u, methods: %u, new functions: %u%s\n", uTables, uMethods, uCreated, (bCached ? " (cached scan)" : ""));
+	}
+	CATCH()
+
+	FreeSnapshots();
+	for(size_t i = 0; i < Chunks.size(); i++)
+		delete Chunks[i];
+
+	return(uCreated);
+}